@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <cerrno>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "async_io.hpp"
+#include "exceptions.hpp"
+#include "lines.hpp"
+
+using std::int64_t;
+using std::size_t;
+using std::string_view;
+using std::uint64_t;
+
+namespace
+{
+    /**
+     * Blocking write of all of [s:s+n) to fd.
+     */
+    void write_all(int fd, const char *s, size_t n)
+    {
+        while (n > 0)
+        {
+            const auto w = ::write(fd, s, n);
+            if (w < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            // writing nothing would be retried forever, so it fails as EIO
+            // would
+            if (w <= 0)
+            {
+                throw File_error{"Can't write output."};
+            }
+
+            s += w;
+            n -= w;
+        }
+    }
+}
+
+Async_reader::Async_reader(int fd, size_t block_size, size_t depth)
+    : fd{fd}, block_size{block_size}, blocks(std::max<size_t>(depth, 1))
+{
+    for (auto &b : blocks)
+    {
+        b.data.resize(block_size);
+    }
+
+    ring = Uring::create(static_cast<unsigned>(blocks.size()));
+
+    struct stat info;
+    const auto position = ::lseek(fd, 0, SEEK_CUR);
+    if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && position >= 0)
+    {
+        seekable = true;
+        start = position;
+
+        const auto bytes = static_cast<uint64_t>(
+            std::max<int64_t>(info.st_size - position, 0));
+        total = (bytes + block_size - 1) / block_size;
+    }
+}
+
+Async_reader::~Async_reader()
+{
+    // the kernel may still be writing into our blocks
+    try
+    {
+        while (ring && in_flight > 0)
+        {
+            complete_one();
+        }
+    }
+    catch (File_error &)
+    {
+    }
+}
+
+void Async_reader::submit_reads()
+{
+    // the block handed out by the last call to next() is still in use
+    const auto first_busy = next_deliver - (next_deliver > 0 ? 1 : 0);
+
+    while (next_submit - first_busy < blocks.size())
+    {
+        if (seekable ? next_submit == total : (at_eof || in_flight > 0))
+        {
+            break;
+        }
+
+        auto &b = blocks[next_submit % blocks.size()];
+        b.filled = 0;
+        b.done = false;
+        b.wanted = block_size;
+
+        int64_t offset = -1;
+        if (seekable)
+        {
+            offset = start + static_cast<int64_t>(next_submit * block_size);
+        }
+
+        ring->read(fd, b.data.data(), b.wanted, offset, next_submit);
+        ++in_flight;
+        ++next_submit;
+    }
+
+    ring->submit();
+}
+
+void Async_reader::complete_one()
+{
+    const auto [tag, res] = ring->wait();
+    --in_flight;
+
+    if (res < 0)
+    {
+        throw File_error{"Can't read input."};
+    }
+
+    auto &b = blocks[tag % blocks.size()];
+    b.filled += res;
+
+    // a short read of a regular file before its end: read the rest
+    if (seekable && res > 0 && b.filled < b.wanted)
+    {
+        const auto offset = start +
+                            static_cast<int64_t>(tag * block_size + b.filled);
+        ring->read(fd, b.data.data() + b.filled, b.wanted - b.filled,
+                   offset, tag);
+        ++in_flight;
+        return;
+    }
+
+    b.done = true;
+    if (!seekable && res == 0)
+    {
+        at_eof = true;
+    }
+}
+
+string_view Async_reader::next()
+{
+    if (!ring)
+    {
+        auto &b = blocks[0];
+        while (true)
+        {
+            const auto r = ::read(fd, b.data.data(), b.data.size());
+            if (r >= 0)
+            {
+                return {b.data.data(), static_cast<size_t>(r)};
+            }
+            if (errno != EINTR)
+            {
+                throw File_error{"Can't read input."};
+            }
+        }
+    }
+
+    if (seekable && next_deliver == total)
+    {
+        return {};
+    }
+    if (!seekable && at_eof && next_submit == next_deliver)
+    {
+        return {};
+    }
+
+    submit_reads();
+
+    auto &b = blocks[next_deliver % blocks.size()];
+    while (!b.done)
+    {
+        complete_one();
+        // a non-seekable descriptor only has one read in flight at a time
+        submit_reads();
+    }
+    ++next_deliver;
+
+    // keep reading ahead while the caller works on this block
+    submit_reads();
+
+    return {b.data.data(), b.filled};
+}
+
+bool Async_reader::next_line(string_view &line)
+{
+    // between calls, carry is either empty or holds the line returned last
+    carry.clear();
+
+    while (true)
+    {
+        if (!rest.empty())
+        {
+            const auto end = rest.data() + rest.size();
+            const auto nl = find_newline(rest.data(), end);
+            if (nl != end)
+            {
+                const string_view head{rest.data(),
+                                       static_cast<size_t>(nl - rest.data())};
+                rest.remove_prefix(head.size() + 1);
+
+                if (carry.empty())
+                {
+                    line = head;
+                }
+                else
+                {
+                    carry += head;
+                    line = carry;
+                }
+                return true;
+            }
+
+            // the line continues in the next block
+            carry += rest;
+            rest = {};
+        }
+
+        if (input_done)
+        {
+            if (carry.empty())
+            {
+                return false;
+            }
+
+            line = carry;
+            return true;
+        }
+
+        rest = next();
+        if (rest.empty())
+        {
+            input_done = true;
+        }
+    }
+}
+
+Async_writer::Async_writer(int fd, size_t block_size)
+    : fd{fd}, block_size{block_size}, ring{Uring::create(2)}
+{
+    buffers[0].reserve(block_size);
+    buffers[1].reserve(block_size);
+}
+
+Async_writer::~Async_writer()
+{
+    try
+    {
+        flush();
+    }
+    catch (File_error &)
+    {
+    }
+}
+
+void Async_writer::write(string_view s)
+{
+    auto &b = buffers[current];
+    b.insert(b.end(), s.begin(), s.end());
+
+    if (b.size() >= block_size)
+    {
+        submit_current();
+    }
+}
+
+void Async_writer::flush()
+{
+    submit_current();
+    wait_in_flight();
+}
+
+void Async_writer::submit_current()
+{
+    auto &b = buffers[current];
+    if (b.empty())
+    {
+        return;
+    }
+
+    if (!ring)
+    {
+        write_all(fd, b.data(), b.size());
+        b.clear();
+        return;
+    }
+
+    // at most one write is in flight, which keeps the output in order
+    wait_in_flight();
+    ring->write(fd, b.data(), b.size(), -1, 0);
+    ring->submit();
+    in_flight = true;
+    flight_written = 0;
+
+    current ^= 1;
+    buffers[current].clear();
+}
+
+void Async_writer::wait_in_flight()
+{
+    const auto &b = buffers[current ^ 1];
+    while (in_flight)
+    {
+        const auto [tag, res] = ring->wait();
+        // writing nothing would be resubmitted forever, so it fails as EIO
+        // would
+        if (res <= 0)
+        {
+            in_flight = false;
+            throw File_error{"Can't write output."};
+        }
+
+        flight_written += res;
+        if (flight_written < b.size())
+        {
+            ring->write(fd, b.data() + flight_written,
+                        b.size() - flight_written, -1, tag);
+            ring->submit();
+        }
+        else
+        {
+            in_flight = false;
+        }
+    }
+}
@@ -0,0 +1,132 @@
+#ifndef A2100_PCALC_ASYNC_IO
+#define A2100_PCALC_ASYNC_IO 1
+#pragma once
+
+/**
+ * This library provides:
+ * - Async_reader UDT, which reads a file descriptor ahead of its consumer
+ * - Async_writer UDT, which writes to a file descriptor behind its producer
+ *
+ * Both use io_uring when the kernel offers it and fall back to plain
+ * read()/write() calls otherwise.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "batch/uring.hpp"
+
+/**
+ * Reads fd from its current position to its end in blocks of block_size
+ * bytes.
+ *
+ * For regular files, up to depth blocks are read concurrently at their
+ * offsets. Other descriptors (pipes, terminals) are read one request at a
+ * time, but still ahead of the consumer: up to depth blocks are buffered.
+ */
+class Async_reader
+{
+public:
+    explicit Async_reader(int fd, std::size_t block_size = 1 << 20,
+                          std::size_t depth = 4);
+    Async_reader(const Async_reader &other) = delete;
+    Async_reader &operator=(const Async_reader &other) = delete;
+    ~Async_reader();
+
+    /**
+     * Return the next block of data; an empty view means end of input. The
+     * view is valid until the next call.
+     */
+    std::string_view next();
+
+    /**
+     * Store the next line (without its '\n') in line and return true, or
+     * return false at end of input. Line boundaries follow std::getline.
+     * line is valid until the next call.
+     */
+    bool next_line(std::string_view &line);
+
+    /**
+     * Whether requests go through io_uring rather than blocking read()s.
+     */
+    bool is_async() const
+    {
+        return ring != nullptr;
+    }
+
+private:
+    struct Block
+    {
+        std::vector<char> data;
+        std::size_t wanted = 0; // bytes requested
+        std::size_t filled = 0; // bytes read so far
+        bool done = false;
+    };
+
+    void submit_reads();
+    void complete_one();
+
+    int fd;
+    std::size_t block_size;
+    std::unique_ptr<Uring> ring;
+    std::vector<Block> blocks; // block k lives in blocks[k % depth]
+
+    bool seekable = false;
+    std::int64_t start = 0;   // file offset of block 0
+    std::uint64_t total = 0;  // blocks in a regular file
+    bool at_eof = false;      // a non-seekable read returned 0
+    std::uint64_t next_submit = 0;
+    std::uint64_t next_deliver = 0;
+    std::size_t in_flight = 0;
+
+    // state of next_line()
+    std::string_view rest;
+    std::string carry;
+    bool input_done = false;
+};
+
+/**
+ * Collects writes in blocks of block_size bytes. A full block is handed to
+ * the kernel while the producer goes on filling the next one, so the
+ * producer only waits if it outruns the device.
+ */
+class Async_writer
+{
+public:
+    explicit Async_writer(int fd, std::size_t block_size = 1 << 20);
+    Async_writer(const Async_writer &other) = delete;
+    Async_writer &operator=(const Async_writer &other) = delete;
+    ~Async_writer();
+
+    void write(std::string_view s);
+
+    /**
+     * Write out everything written so far and wait until it's done.
+     */
+    void flush();
+
+    bool is_async() const
+    {
+        return ring != nullptr;
+    }
+
+private:
+    void submit_current();
+    void wait_in_flight();
+
+    int fd;
+    std::size_t block_size;
+    std::unique_ptr<Uring> ring;
+
+    std::vector<char> buffers[2];
+    int current = 0;
+
+    bool in_flight = false;
+    std::size_t flight_written = 0;
+};
+
+#endif
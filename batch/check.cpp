@@ -0,0 +1,36 @@
+#include <map>
+#include <string>
+
+#include "check.hpp"
+
+using std::map;
+using std::ostream;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::vector;
+
+size_t check_lines(Parser &calc, const vector<string_view> &lines,
+                   ostream &out)
+{
+    map<string, Dimension> dimensions;
+    size_t errors = 0;
+    for (size_t n = 0; n < lines.size(); ++n)
+    {
+        const auto line = lines[n];
+        if (line.find_first_not_of(" \t\n\v\f\r") == string_view::npos)
+        {
+            continue;
+        }
+
+        const auto error = calc.check(line, dimensions);
+        if (error.code != Evaluation_errc::none)
+        {
+            out << n + 1 << ":" << error.span.begin + 1 << ": "
+                << error.message(line) << "\n";
+            ++errors;
+        }
+    }
+
+    return errors;
+}
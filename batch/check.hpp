@@ -0,0 +1,28 @@
+#ifndef A2100_PCALC_CHECK
+#define A2100_PCALC_CHECK 1
+#pragma once
+
+/**
+ * This library provides:
+ * - check_lines(), which reports every syntax and unit error in a list of
+ *   statements without evaluating any of them
+ */
+
+#include <cstddef>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "parser/parser.hpp"
+
+/**
+ * Check each of lines in order with Parser::check(), declarations carrying
+ * over from line to line, and write one line per error to out:
+ * "<line>:<column>: <message>", both counted from 1. Blank lines are
+ * skipped. Return the number of errors.
+ */
+std::size_t check_lines(Parser &calc,
+                        const std::vector<std::string_view> &lines,
+                        std::ostream &out);
+
+#endif
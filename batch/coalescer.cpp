@@ -0,0 +1,316 @@
+#include <chrono>
+#include <cstring>
+#include <exception>
+
+#include "coalescer.hpp"
+
+using std::exception;
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::ostream;
+using std::promise;
+using std::shared_future;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::uint64_t;
+using std::vector;
+
+namespace
+{
+    /**
+     * A string that is equal for equal token sequences. Numbers are left out
+     * of the key of a shape.
+     */
+    string key_of(const vector<Token> &tokens, bool with_numbers)
+    {
+        string key;
+        key.reserve(tokens.size() * (with_numbers ? 10 : 2));
+        for (const auto &t : tokens)
+        {
+            switch (t.kind)
+            {
+            case Token_type::operator_type:
+                key += 'o';
+                key += t.op;
+                break;
+            case Token_type::number:
+                key += 'n';
+                if (with_numbers)
+                {
+                    char bits[sizeof(t.val)];
+                    std::memcpy(bits, &t.val, sizeof(bits));
+                    key.append(bits, sizeof(bits));
+                }
+                break;
+            case Token_type::identifier:
+                key += 'i';
+                key += t.name;
+                key += '\0';
+                break;
+            }
+        }
+        return key;
+    }
+
+    bool is_variable(const map<string, Primary> &variables_table,
+                     const string &name)
+    {
+        return variables_table.count(name) != 0;
+    }
+
+    bool is_variable(const Variable_store &variables, const string &name)
+    {
+        return variables.contains(name);
+    }
+
+    template <class Table>
+    bool is_pure(const vector<Token> &tokens, const Table &variables_table)
+    {
+        for (const auto &t : tokens)
+        {
+            if (t.kind == Token_type::operator_type && t.op == '=')
+            {
+                return false;
+            }
+            if (t.kind == Token_type::identifier &&
+                is_variable(variables_table, t.name))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+ostream &operator<<(ostream &out, const Coalescing_counters &c)
+{
+    return out << "requests " << c.requests
+               << ", pure " << c.pure
+               << ", coalesced " << c.coalesced
+               << ", reused " << c.reused
+               << ", shapes " << c.shapes
+               << ", shape repeats " << c.shape_repeats
+               << ", compiled runs " << c.compiled_runs;
+}
+
+Coalescer::Coalescer(Parser &calc, size_t capacity)
+    : calc{calc}, capacity{capacity}
+{
+}
+
+Coalescer::Shape *Coalescer::count_shape(const vector<Token> &tokens)
+{
+    auto key = key_of(tokens, false);
+    lock_guard<mutex> guard{lock};
+    auto it = shapes.find(key);
+    if (it != shapes.end())
+    {
+        ++shape_repeats;
+    }
+    else if (shapes.size() < capacity)
+    {
+        it = shapes.emplace(std::move(key), Shape{}).first;
+        ++shape_count;
+    }
+    else
+    {
+        return nullptr;
+    }
+
+    ++it->second.seen;
+    return &it->second;
+}
+
+void Coalescer::compile_shape(Shape &shape, const vector<Token> &tokens,
+                              const Evaluation_result &result)
+{
+    if (!result)
+    {
+        // this request's values failed; the next one may compile
+        lock_guard<mutex> guard{lock};
+        shape.tried = false;
+        return;
+    }
+
+    // nobody can type these names, so no parameter is taken for a unit
+    auto parameterized = tokens;
+    vector<string> parameters;
+    for (auto &t : parameterized)
+    {
+        if (t.kind == Token_type::number)
+        {
+            t.kind = Token_type::identifier;
+            t.name = "#" + std::to_string(parameters.size());
+            parameters.push_back(t.name);
+        }
+    }
+
+    Numeric_program program;
+    try
+    {
+        const auto error = calc.compile(parameterized, parameters, program);
+        if (error.code != Evaluation_errc::none || !program ||
+            program.units() != result.value().get_units())
+        {
+            return;
+        }
+    }
+    catch (exception &)
+    {
+        // the shape is evaluated as usual
+        return;
+    }
+
+    auto compiled = std::make_shared<const Compiled_shape>(Compiled_shape{
+        std::move(program), result.value().with_value(0)});
+    lock_guard<mutex> guard{lock};
+    shape.compiled = std::move(compiled);
+}
+
+Primary Coalescer::evaluate(const vector<Token> &tokens,
+                            map<string, Primary> &variables_table)
+{
+    auto result = try_evaluate(tokens, variables_table);
+    if (!result)
+    {
+        result.error().raise(tokens);
+    }
+
+    return result.value();
+}
+
+Evaluation_result Coalescer::try_evaluate(
+    const vector<Token> &tokens, map<string, Primary> &variables_table)
+{
+    return coalesce(tokens, variables_table);
+}
+
+Evaluation_result Coalescer::try_evaluate(const vector<Token> &tokens,
+                                          Variable_store &variables)
+{
+    return coalesce(tokens, variables);
+}
+
+template <class Table>
+Evaluation_result Coalescer::coalesce(const vector<Token> &tokens,
+                                      Table &variables_table)
+{
+    ++requests;
+    const auto shape = count_shape(tokens);
+    if (!is_pure(tokens, variables_table))
+    {
+        return calc.try_evaluate(tokens, variables_table);
+    }
+    ++pure;
+
+    const auto key = key_of(tokens, true);
+    promise<Evaluation_result> evaluation;
+    shared_future<Evaluation_result> earlier;
+    {
+        lock_guard<mutex> guard{lock};
+        const auto it = results.find(key);
+        if (it != results.end())
+        {
+            earlier = it->second;
+        }
+        else
+        {
+            if (results.size() >= capacity)
+            {
+                // whoever waits on a dropped result still holds its future
+                results.clear();
+            }
+            results.emplace(key, evaluation.get_future().share());
+        }
+    }
+
+    if (earlier.valid())
+    {
+        const auto done = earlier.wait_for(std::chrono::seconds(0)) ==
+                          std::future_status::ready;
+        ++(done ? reused : coalesced);
+        // rethrows what the earlier evaluation threw, if anything
+        return earlier.get();
+    }
+
+    try
+    {
+        auto result = evaluate_pure(shape, tokens, variables_table);
+        evaluation.set_value(result);
+        if (!result &&
+            result.error().code == Evaluation_errc::limit_exceeded)
+        {
+            // running out of time says nothing about the expression: let
+            // the next copy try again
+            lock_guard<mutex> guard{lock};
+            results.erase(key);
+        }
+        return result;
+    }
+    catch (...)
+    {
+        evaluation.set_exception(std::current_exception());
+        lock_guard<mutex> guard{lock};
+        results.erase(key);
+        throw;
+    }
+}
+
+template <class Table>
+Evaluation_result Coalescer::evaluate_pure(Shape *shape,
+                                           const vector<Token> &tokens,
+                                           Table &variables_table)
+{
+    shared_ptr<const Compiled_shape> compiled;
+    auto compile = false;
+    if (shape)
+    {
+        lock_guard<mutex> guard{lock};
+        compiled = shape->compiled;
+        compile = !compiled && shape->seen > 1 && !shape->tried;
+        shape->tried = shape->tried || compile;
+    }
+
+    if (compiled)
+    {
+        ++compiled_runs;
+        vector<double> arguments;
+        for (const auto &t : tokens)
+        {
+            if (t.kind == Token_type::number)
+            {
+                arguments.push_back(t.val);
+            }
+        }
+
+        double value;
+        const auto error = compiled->program.run(arguments, value);
+        if (error.code != Evaluation_errc::none)
+        {
+            return error;
+        }
+        return compiled->unit.with_value(value);
+    }
+
+    auto result = calc.try_evaluate(tokens, variables_table);
+    if (compile)
+    {
+        compile_shape(*shape, tokens, result);
+    }
+    return result;
+}
+
+Coalescing_counters Coalescer::counters() const
+{
+    Coalescing_counters c;
+    c.requests = requests;
+    c.pure = pure;
+    c.coalesced = coalesced;
+    c.reused = reused;
+    c.shapes = shape_count;
+    c.shape_repeats = shape_repeats;
+    c.compiled_runs = compiled_runs;
+    return c;
+}
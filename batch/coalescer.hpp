@@ -0,0 +1,153 @@
+#ifndef A2100_PCALC_COALESCER
+#define A2100_PCALC_COALESCER 1
+#pragma once
+
+/**
+ * This library provides:
+ * - Coalescer UDT, which saves evaluations of requests that are repeated or
+ *   run concurrently
+ * - Coalescing_counters UDT, which tells how much a Coalescer saved
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "parser/parser.hpp"
+#include "token/token.hpp"
+
+struct Coalescing_counters
+{
+    std::uint64_t requests = 0;
+    // requests whose result doesn't depend on or change any variable
+    std::uint64_t pure = 0;
+    // pure requests that waited for the same request already being evaluated
+    std::uint64_t coalesced = 0;
+    // pure requests answered with the result of an earlier evaluation
+    std::uint64_t reused = 0;
+    // distinct shapes: requests with the same tokens except for the values
+    // of numbers have the same shape
+    std::uint64_t shapes = 0;
+    // requests of a shape seen before
+    std::uint64_t shape_repeats = 0;
+    // requests run on the Numeric_program of their shape instead of being
+    // evaluated
+    std::uint64_t compiled_runs = 0;
+};
+
+std::ostream &operator<<(std::ostream &out, const Coalescing_counters &c);
+
+/**
+ * Evaluates requests with a Parser, but only once for identical pure
+ * requests: the first one is evaluated, and the others wait for it if it's
+ * still in flight or take its result if it's done. A request is pure if it
+ * assigns nothing and none of its identifiers names a variable of the table
+ * it is evaluated against; its result (or error) then depends on its tokens
+ * alone. Requests are identical if their tokens are, so spacing doesn't
+ * matter.
+ *
+ * Requests are also bucketed by shape. Once a pure request of a shape
+ * that was seen before has been evaluated, the shape is compiled with its
+ * numbers as parameters; later pure requests of that shape run the compiled
+ * Numeric_program on their numbers instead of being evaluated. Shapes that
+ * don't compile to numbers, such as those with variables, are always
+ * evaluated.
+ *
+ * All member functions can be called concurrently, as long as each variables
+ * table is used by one thread at a time.
+ */
+class Coalescer
+{
+public:
+    /**
+     * Remember up to capacity results and shapes; beyond that, older results
+     * are forgotten and new shapes aren't tracked.
+     */
+    explicit Coalescer(Parser &calc, std::size_t capacity = 1 << 14);
+
+    Primary evaluate(const std::vector<Token> &tokens,
+                     std::map<std::string, Primary> &variables_table);
+
+    /**
+     * Like evaluate(), but errors are returned as with
+     * Parser::try_evaluate().
+     */
+    Evaluation_result try_evaluate(
+        const std::vector<Token> &tokens,
+        std::map<std::string, Primary> &variables_table);
+
+    Evaluation_result try_evaluate(const std::vector<Token> &tokens,
+                                   Variable_store &variables);
+
+    Coalescing_counters counters() const;
+
+private:
+    /**
+     * A shape compiled to numbers, and a result of it with value 0 to give
+     * results their units.
+     */
+    struct Compiled_shape
+    {
+        Numeric_program program;
+        Primary unit;
+    };
+
+    struct Shape
+    {
+        std::uint64_t seen = 0;
+        std::shared_ptr<const Compiled_shape> compiled;
+        // whether compiling was attempted, successfully or not
+        bool tried = false;
+    };
+
+    /**
+     * The shape of tokens, counted as seen once more, or null if it isn't
+     * tracked.
+     */
+    Shape *count_shape(const std::vector<Token> &tokens);
+
+    template <class Table>
+    Evaluation_result coalesce(const std::vector<Token> &tokens,
+                               Table &variables_table);
+
+    /**
+     * Evaluate the pure request tokens, running the program of its shape if
+     * there is one.
+     */
+    template <class Table>
+    Evaluation_result evaluate_pure(Shape *shape,
+                                    const std::vector<Token> &tokens,
+                                    Table &variables_table);
+
+    /**
+     * Compile shape, the shape of tokens, whose evaluation gave result.
+     */
+    void compile_shape(Shape &shape, const std::vector<Token> &tokens,
+                       const Evaluation_result &result);
+
+    Parser &calc;
+    std::size_t capacity;
+
+    std::mutex lock;
+    std::unordered_map<std::string, std::shared_future<Evaluation_result>>
+        results;
+    std::unordered_map<std::string, Shape> shapes;
+
+    std::atomic<std::uint64_t> requests{0};
+    std::atomic<std::uint64_t> pure{0};
+    std::atomic<std::uint64_t> coalesced{0};
+    std::atomic<std::uint64_t> reused{0};
+    std::atomic<std::uint64_t> shape_count{0};
+    std::atomic<std::uint64_t> shape_repeats{0};
+    std::atomic<std::uint64_t> compiled_runs{0};
+};
+
+#endif
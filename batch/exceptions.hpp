@@ -0,0 +1,42 @@
+#ifndef A2100_PCALC_BATCH_EXCEPTIONS
+#define A2100_PCALC_BATCH_EXCEPTIONS 1
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+class File_error : public std::exception
+{
+public:
+    File_error(const std::string &s = "")
+        : what_err{s}
+    {
+    }
+
+    const char *what() const noexcept
+    {
+        return what_err.c_str();
+    }
+
+private:
+    std::string what_err;
+};
+
+class Pipeline_error : public std::exception
+{
+public:
+    Pipeline_error(const std::string &s = "")
+        : what_err{s}
+    {
+    }
+
+    const char *what() const noexcept
+    {
+        return what_err.c_str();
+    }
+
+private:
+    std::string what_err;
+};
+
+#endif
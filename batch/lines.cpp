@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "lines.hpp"
+
+using std::size_t;
+using std::string_view;
+using std::thread;
+using std::vector;
+
+const char *find_newline(const char *s, const char *e)
+{
+#ifdef __SSE2__
+    // compare 16 bytes at a time; the mask has one bit per matching byte
+    const auto newlines = _mm_set1_epi8('\n');
+    for (; e - s >= 16; s += 16)
+    {
+        const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+        const auto mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+        if (mask != 0)
+        {
+            return s + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    const auto found = std::memchr(s, '\n', e - s);
+    return found ? static_cast<const char *>(found) : e;
+}
+
+namespace
+{
+    /**
+     * Append the lines starting in [s:e) to lines. The last of them may end
+     * past e, but not past end.
+     */
+    void scan_lines(const char *s, const char *e, const char *end,
+                    vector<string_view> &lines)
+    {
+        while (s < e)
+        {
+            const auto nl = find_newline(s, end);
+            lines.emplace_back(s, nl - s);
+            s = nl + 1;
+        }
+    }
+}
+
+vector<string_view> split_lines(string_view text, size_t threads)
+{
+    const auto begin = text.data();
+    const auto end = text.data() + text.size();
+
+    // splitting small inputs isn't worth starting threads for
+    constexpr size_t min_chunk = 1 << 20;
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+    if (text.size() / threads < min_chunk)
+    {
+        threads = text.size() / min_chunk + 1;
+    }
+
+    /**
+     * Every chunk but the first starts right after a newline, so that each
+     * line is found by exactly one thread: the one whose chunk it starts in.
+     */
+    vector<const char *> starts{begin};
+    for (size_t i = 1; i < threads; ++i)
+    {
+        const auto guess = begin + text.size() / threads * i;
+        const auto nl = find_newline(std::max(guess, starts.back()), end);
+        starts.push_back(nl == end ? end : nl + 1);
+    }
+    starts.push_back(end);
+
+    vector<vector<string_view>> chunks(threads);
+    vector<thread> helpers;
+    for (size_t i = 1; i < threads; ++i)
+    {
+        helpers.emplace_back(scan_lines, starts[i], starts[i + 1], end,
+                             std::ref(chunks[i]));
+    }
+    scan_lines(starts[0], starts[1], end, chunks[0]);
+    for (auto &h : helpers)
+    {
+        h.join();
+    }
+
+    vector<string_view> lines;
+    size_t total = 0;
+    for (const auto &c : chunks)
+    {
+        total += c.size();
+    }
+    lines.reserve(total);
+    for (const auto &c : chunks)
+    {
+        lines.insert(lines.end(), c.begin(), c.end());
+    }
+
+    return lines;
+}
@@ -0,0 +1,31 @@
+#ifndef A2100_PCALC_LINES
+#define A2100_PCALC_LINES 1
+#pragma once
+
+/**
+ * This library provides:
+ * - find_newline(), a vectorized search for the next '\n'
+ * - split_lines(), which breaks a buffer into lines on several threads
+ */
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+/**
+ * Return a pointer to the first '\n' in [s:e), or e if there is none.
+ */
+const char *find_newline(const char *s, const char *e);
+
+/**
+ * Break text into lines the way repeated calls to std::getline would: lines
+ * are separated by '\n', which isn't part of any line, and a trailing '\n'
+ * doesn't start another (empty) line.
+ *
+ * The returned views point into text. text is cut into up to threads chunks
+ * of roughly equal size, which are scanned concurrently.
+ */
+std::vector<std::string_view> split_lines(std::string_view text,
+                                          std::size_t threads);
+
+#endif
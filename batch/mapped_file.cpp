@@ -0,0 +1,52 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.hpp"
+#include "exceptions.hpp"
+
+using std::string;
+
+Mapped_file::Mapped_file(const string &path)
+{
+    const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw File_error{"Can't open " + path + "."};
+    }
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        ::close(fd);
+        throw File_error{path + " is not a regular file."};
+    }
+
+    size = info.st_size;
+    if (size == 0)
+    {
+        // mmap refuses empty mappings; an empty view does just as well
+        ::close(fd);
+        return;
+    }
+
+    void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        throw File_error{"Can't map " + path + " into memory."};
+    }
+
+    // the file is read from front to back exactly once
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+    data = static_cast<const char *>(mapping);
+}
+
+Mapped_file::~Mapped_file()
+{
+    if (data)
+    {
+        ::munmap(const_cast<char *>(data), size);
+    }
+}
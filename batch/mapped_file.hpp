@@ -0,0 +1,40 @@
+#ifndef A2100_PCALC_MAPPED_FILE
+#define A2100_PCALC_MAPPED_FILE 1
+#pragma once
+
+/**
+ * This library provides:
+ * - Mapped_file UDT, a read-only memory mapping of a whole file
+ */
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/**
+ * The contents of a regular file, mapped into memory for as long as the
+ * Mapped_file lives. The contents can be read through string_views without
+ * copying them.
+ *
+ * Throw a File_error if the file can't be opened or mapped, e.g., because it
+ * is a pipe.
+ */
+class Mapped_file
+{
+public:
+    explicit Mapped_file(const std::string &path);
+    Mapped_file(const Mapped_file &other) = delete;
+    Mapped_file &operator=(const Mapped_file &other) = delete;
+    ~Mapped_file();
+
+    std::string_view contents() const
+    {
+        return {data, size};
+    }
+
+private:
+    const char *data = nullptr;
+    std::size_t size = 0;
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include <exception>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "exceptions.hpp"
+#include "pipeline.hpp"
+#include "ring_buffer.hpp"
+#include "token/token.hpp"
+
+using std::exception;
+using std::getline;
+using std::istream;
+using std::optional;
+using std::ostream;
+using std::ostringstream;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::thread;
+using std::vector;
+
+namespace
+{
+    constexpr auto answer = "= ";
+    constexpr auto error = "! ";
+
+    /**
+     * Output of the tokenizing stage. If the line couldn't be tokenized,
+     * error holds the reason and tokens is meaningless.
+     */
+    struct Tokenized_line
+    {
+        vector<Token> tokens;
+        string error;
+    };
+
+    /**
+     * Output of the evaluation stage. Exactly one of result and error is
+     * meaningful.
+     */
+    struct Evaluated_line
+    {
+        optional<Primary> result;
+        string error;
+    };
+
+    /**
+     * Run the pipeline over the lines produced by next_line, which stores
+     * the next line in its argument and returns false once there are no
+     * more lines. Every formatted line (including its '\n') is passed to
+     * emit.
+     *
+     * next_line is only called from the tokenizing thread and emit only
+     * from the formatting thread.
+     */
+    template <class Next_line, class Emit>
+    void run_stages(Parser &calc, Next_line next_line, Emit emit,
+                    size_t depth, Coalescer *coalescer)
+    {
+        if (depth == 0)
+        {
+            throw Pipeline_error{"The pipeline depth must be at least 1."};
+        }
+        Ring_buffer<Tokenized_line> tokenized{depth};
+        Ring_buffer<Evaluated_line> evaluated{depth};
+
+        thread reader{[&next_line, &tokenized]()
+                      {
+                          for (string_view line; next_line(line);)
+                          {
+                              Tokenized_line t;
+                              Token_error error;
+                              t.tokens = tokenize(line, error);
+                              if (error.code != Token_errc::none)
+                              {
+                                  t.error = error.what();
+                              }
+                              tokenized.push(std::move(t));
+                          }
+                          tokenized.close();
+                      }};
+
+        thread writer{[&emit, &evaluated]()
+                      {
+                          ostringstream line;
+                          while (auto e = evaluated.pop())
+                          {
+                              line.str("");
+                              if (e->result)
+                              {
+                                  line << answer << *e->result << "\n";
+                              }
+                              else
+                              {
+                                  line << error << e->error << "\n";
+                              }
+                              emit(line.str());
+                          }
+                      }};
+
+        while (auto t = tokenized.pop())
+        {
+            Evaluated_line e;
+            if (!t->error.empty())
+            {
+                e.error = std::move(t->error);
+            }
+            else
+            {
+                try
+                {
+                    auto r = coalescer
+                                 ? coalescer->try_evaluate(t->tokens,
+                                                           calc.variables())
+                                 : calc.try_evaluate(t->tokens);
+                    if (r)
+                    {
+                        e.result.emplace(r.value());
+                    }
+                    else
+                    {
+                        e.error = r.error().message(t->tokens);
+                    }
+                }
+                catch (exception &ex)
+                {
+                    e.error = ex.what();
+                }
+            }
+            evaluated.push(std::move(e));
+        }
+        evaluated.close();
+
+        reader.join();
+        writer.join();
+    }
+
+    /**
+     * next_line for run_stages() that walks over lines already in memory.
+     */
+    class Line_walker
+    {
+    public:
+        explicit Line_walker(const vector<string_view> &lines)
+            : lines{lines}
+        {
+        }
+
+        bool operator()(string_view &line)
+        {
+            if (next == lines.size())
+            {
+                return false;
+            }
+
+            line = lines[next++];
+            return true;
+        }
+
+    private:
+        const vector<string_view> &lines;
+        size_t next = 0;
+    };
+}
+
+void run_pipeline(Parser &calc, istream &in, ostream &out, size_t depth,
+                  Coalescer *coalescer)
+{
+    string buffer;
+    auto next_line = [&in, &buffer](string_view &line)
+    {
+        if (!getline(in, buffer))
+        {
+            return false;
+        }
+
+        line = buffer;
+        return true;
+    };
+    auto emit = [&out](string_view s)
+    { out << s; };
+
+    run_stages(calc, next_line, emit, depth, coalescer);
+    out.flush();
+}
+
+void run_pipeline(Parser &calc, const vector<string_view> &lines,
+                  ostream &out, size_t depth, Coalescer *coalescer)
+{
+    auto emit = [&out](string_view s)
+    { out << s; };
+
+    run_stages(calc, Line_walker{lines}, emit, depth, coalescer);
+    out.flush();
+}
+
+void run_pipeline(Parser &calc, Async_reader &in, Async_writer &out,
+                  size_t depth, Coalescer *coalescer)
+{
+    auto next_line = [&in](string_view &line)
+    { return in.next_line(line); };
+    auto emit = [&out](string_view s)
+    { out.write(s); };
+
+    run_stages(calc, next_line, emit, depth, coalescer);
+    out.flush();
+}
+
+void run_pipeline(Parser &calc, const vector<string_view> &lines,
+                  Async_writer &out, size_t depth, Coalescer *coalescer)
+{
+    auto emit = [&out](string_view s)
+    { out.write(s); };
+
+    run_stages(calc, Line_walker{lines}, emit, depth, coalescer);
+    out.flush();
+}
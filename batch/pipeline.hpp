@@ -0,0 +1,58 @@
+#ifndef A2100_PCALC_PIPELINE
+#define A2100_PCALC_PIPELINE 1
+#pragma once
+
+/**
+ * This library provides:
+ * - run_pipeline(), which evaluates a stream of expressions, one per line,
+ *   with tokenizing, evaluation and formatting running on separate threads
+ */
+
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "batch/async_io.hpp"
+#include "batch/coalescer.hpp"
+#include "parser/parser.hpp"
+
+/**
+ * Evaluate every line of in with calc and write one line per input line to
+ * out: "= <result>" on success or "! <error>" on failure.
+ *
+ * Lines are evaluated strictly in order, so `let` and assignments behave
+ * exactly as they do in the interactive prompt. What runs concurrently is
+ * everything around evaluation: while line N is being evaluated, a reader
+ * thread is tokenizing lines up to N + depth and a writer thread is
+ * formatting lines down to N - depth. The stages are connected by bounded
+ * Ring_buffers of the given depth, which must be at least 1 (or a
+ * Pipeline_error is thrown).
+ *
+ * If coalescer isn't null, lines are evaluated through it, so repeated pure
+ * lines are only evaluated once.
+ */
+void run_pipeline(Parser &calc, std::istream &in, std::ostream &out,
+                  std::size_t depth = 64, Coalescer *coalescer = nullptr);
+
+/**
+ * Same as above, but for lines that are already in memory, e.g., split out
+ * of a Mapped_file. The lines are tokenized in place.
+ */
+void run_pipeline(Parser &calc, const std::vector<std::string_view> &lines,
+                  std::ostream &out, std::size_t depth = 64,
+                  Coalescer *coalescer = nullptr);
+
+/**
+ * Same as above, but reading and writing file descriptors asynchronously,
+ * so that neither tokenizing nor formatting waits for the device.
+ */
+void run_pipeline(Parser &calc, Async_reader &in, Async_writer &out,
+                  std::size_t depth = 64, Coalescer *coalescer = nullptr);
+
+void run_pipeline(Parser &calc, const std::vector<std::string_view> &lines,
+                  Async_writer &out, std::size_t depth = 64,
+                  Coalescer *coalescer = nullptr);
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef A2100_PCALC_RING_BUFFER
+#define A2100_PCALC_RING_BUFFER 1
+#pragma once
+
+/**
+ * This library provides:
+ * - Ring_buffer UDT, a bounded single-producer/single-consumer queue used to
+ *   connect the stages of a batch pipeline
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "batch/exceptions.hpp"
+
+/**
+ * A bounded queue with exactly one pushing thread and one popping thread.
+ *
+ * head is only written by the consumer and tail only by the producer, so
+ * neither side takes a lock while the other keeps up. When the ring is full
+ * (or empty), the blocked side spins briefly and then sleeps until the
+ * other side makes progress, so an idle pipeline uses no CPU.
+ *
+ * Slots are std::optional so that element types without a default
+ * constructor or copy assignment (such as Primary) can be stored.
+ */
+template <class T>
+class Ring_buffer
+{
+public:
+    explicit Ring_buffer(std::size_t capacity)
+        : slots(capacity + 1)
+    {
+        if (capacity == 0)
+        {
+            // a push could never complete
+            throw Pipeline_error{"A ring needs room for an element."};
+        }
+    }
+
+    Ring_buffer(const Ring_buffer &other) = delete;
+    Ring_buffer &operator=(const Ring_buffer &other) = delete;
+
+    /**
+     * Block until there is room in the ring, then append v.
+     */
+    void push(T v)
+    {
+        const auto t = tail.load(std::memory_order_relaxed);
+        const auto next = advance(t);
+        wait_until([this, next]() { return next != head.load(); });
+
+        slots[t].reset();
+        slots[t].emplace(std::move(v));
+        tail.store(next);
+        wake_sleeper();
+    }
+
+    /**
+     * Block until an element is available and return it. Once the producer
+     * has called close() and the ring has been drained, return an empty
+     * optional.
+     */
+    std::optional<T> pop()
+    {
+        const auto h = head.load(std::memory_order_relaxed);
+        wait_until([this, h]() { return h != tail.load() || closed.load(); });
+        // the producer may have pushed right before closing
+        if (h == tail.load())
+        {
+            return std::nullopt;
+        }
+
+        std::optional<T> v{std::move(slots[h])};
+        slots[h].reset();
+        head.store(advance(h));
+        wake_sleeper();
+
+        return v;
+    }
+
+    /**
+     * Signal the consumer that nothing more will be pushed.
+     */
+    void close()
+    {
+        closed.store(true);
+        wake_sleeper();
+    }
+
+private:
+    // checks of the other side's progress before going to sleep
+    static constexpr int spins = 64;
+
+    /**
+     * Return once ready() holds: spin first, then sleep until the other
+     * side calls wake_sleeper().
+     */
+    template <class Ready>
+    void wait_until(Ready ready)
+    {
+        for (int i = 0; i < spins; ++i)
+        {
+            if (ready())
+            {
+                return;
+            }
+            std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> guard{lock};
+        // the other side stores its progress before it checks sleepers,
+        // and we count ourselves before checking its progress: one of us
+        // sees the other
+        sleepers.fetch_add(1);
+        progress.wait(guard, ready);
+        sleepers.fetch_sub(1);
+    }
+
+    void wake_sleeper()
+    {
+        if (sleepers.load() > 0)
+        {
+            // a sleeper that hasn't started waiting yet holds the lock
+            {
+                std::lock_guard<std::mutex> guard{lock};
+            }
+            progress.notify_all();
+        }
+    }
+
+    std::size_t advance(std::size_t i) const
+    {
+        return (i + 1 == slots.size()) ? 0 : i + 1;
+    }
+
+    std::vector<std::optional<T>> slots;
+
+    // head and tail live on separate cache lines so that the producer and
+    // the consumer don't invalidate each other's cache on every operation
+    alignas(64) std::atomic<std::size_t> head{0};
+    alignas(64) std::atomic<std::size_t> tail{0};
+    alignas(64) std::atomic<bool> closed{false};
+
+    alignas(64) std::atomic<int> sleepers{0};
+    std::mutex lock;
+    std::condition_variable progress;
+};
+
+#endif
@@ -0,0 +1,232 @@
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "scheduler.hpp"
+
+using std::atomic;
+using std::condition_variable;
+using std::deque;
+using std::function;
+using std::lock_guard;
+using std::mutex;
+using std::optional;
+using std::size_t;
+using std::thread;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+
+namespace
+{
+    /**
+     * The deque of ready tasks owned by one worker.
+     */
+    class Work_queue
+    {
+    public:
+        void push(size_t t)
+        {
+            lock_guard<mutex> lock{m};
+            tasks.push_back(t);
+        }
+
+        // the owner takes the most recently readied task...
+        optional<size_t> pop()
+        {
+            lock_guard<mutex> lock{m};
+            if (tasks.empty())
+            {
+                return std::nullopt;
+            }
+
+            const auto t = tasks.back();
+            tasks.pop_back();
+            return t;
+        }
+
+        // ...while thieves take the oldest one
+        optional<size_t> steal()
+        {
+            lock_guard<mutex> lock{m};
+            if (tasks.empty())
+            {
+                return std::nullopt;
+            }
+
+            const auto t = tasks.front();
+            tasks.pop_front();
+            return t;
+        }
+
+    private:
+        mutex m;
+        deque<size_t> tasks;
+    };
+
+    // rounds of looking for work before a worker goes to sleep
+    constexpr int idle_rounds = 64;
+
+    /**
+     * Where workers with nothing to do sleep until a task becomes ready or
+     * the graph is done.
+     */
+    class Parking
+    {
+    public:
+        /**
+         * A task was pushed: wake a sleeper, if there is one.
+         */
+        void task_ready()
+        {
+            ready.fetch_add(1);
+            if (sleepers.load() > 0)
+            {
+                {
+                    lock_guard<mutex> lock{m};
+                }
+                wake.notify_one();
+            }
+        }
+
+        /**
+         * A ready task was taken.
+         */
+        void task_taken()
+        {
+            ready.fetch_sub(1);
+        }
+
+        void finish()
+        {
+            done.store(true);
+            {
+                lock_guard<mutex> lock{m};
+            }
+            wake.notify_all();
+        }
+
+        /**
+         * Sleep until some task is ready or the graph is done.
+         */
+        void park()
+        {
+            unique_lock<mutex> lock{m};
+            // pushers store ready before checking sleepers, and we count
+            // ourselves before checking ready: one of us sees the other
+            sleepers.fetch_add(1);
+            wake.wait(lock, [this]()
+                      { return ready.load() > 0 || done.load(); });
+            sleepers.fetch_sub(1);
+        }
+
+    private:
+        atomic<size_t> ready{0};
+        atomic<size_t> sleepers{0};
+        atomic<bool> done{false};
+        mutex m;
+        condition_variable wake;
+    };
+}
+
+void run_task_graph(const Task_graph &graph,
+                    const function<void(size_t)> &task, size_t threads)
+{
+    if (graph.size() == 0)
+    {
+        return;
+    }
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+
+    // number of unfinished predecessors of each task
+    unique_ptr<atomic<size_t>[]> pending{new atomic<size_t>[graph.size()]};
+    for (size_t i = 0; i < graph.size(); ++i)
+    {
+        pending[i].store(0, std::memory_order_relaxed);
+    }
+    for (const auto &succs : graph.successors)
+    {
+        for (const auto s : succs)
+        {
+            pending[s].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    vector<Work_queue> queues(threads);
+    Parking parking;
+    for (size_t i = 0, next = 0; i < graph.size(); ++i)
+    {
+        if (pending[i].load(std::memory_order_relaxed) == 0)
+        {
+            queues[next].push(i);
+            parking.task_ready();
+            next = (next + 1) % threads;
+        }
+    }
+
+    atomic<size_t> unfinished{graph.size()};
+
+    auto worker = [&](size_t self)
+    {
+        int idle = 0;
+        while (unfinished.load(std::memory_order_acquire) != 0)
+        {
+            auto t = queues[self].pop();
+            for (size_t k = 1; !t && k < threads; ++k)
+            {
+                t = queues[(self + k) % threads].steal();
+            }
+
+            if (!t)
+            {
+                // the graph may be waiting on a long task
+                if (++idle < idle_rounds)
+                {
+                    std::this_thread::yield();
+                }
+                else
+                {
+                    parking.park();
+                    idle = 0;
+                }
+                continue;
+            }
+            idle = 0;
+            parking.task_taken();
+
+            task(*t);
+
+            for (const auto s : graph.successors[*t])
+            {
+                if (pending[s].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    queues[self].push(s);
+                    parking.task_ready();
+                }
+            }
+            if (unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                parking.finish();
+            }
+        }
+    };
+
+    vector<thread> helpers;
+    for (size_t i = 1; i < threads; ++i)
+    {
+        helpers.emplace_back(worker, i);
+    }
+    worker(0);
+
+    for (auto &h : helpers)
+    {
+        h.join();
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef A2100_PCALC_SCHEDULER
+#define A2100_PCALC_SCHEDULER 1
+#pragma once
+
+/**
+ * This library provides:
+ * - Task_graph UDT to describe tasks and the order they must run in
+ * - run_task_graph(), a work-stealing executor for Task_graphs
+ */
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+/**
+ * A directed acyclic graph of tasks identified by 0, 1, ..., size() - 1.
+ *
+ * successors[i] lists the tasks that may only start after task i has
+ * finished.
+ */
+struct Task_graph
+{
+    std::vector<std::vector<std::size_t>> successors;
+
+    explicit Task_graph(std::size_t tasks = 0)
+        : successors(tasks)
+    {
+    }
+
+    std::size_t size() const
+    {
+        return successors.size();
+    }
+
+    void add_edge(std::size_t before, std::size_t after)
+    {
+        successors[before].push_back(after);
+    }
+};
+
+/**
+ * Call task(i) for every task i of graph, on up to threads threads, never
+ * starting a task before all of its predecessors have finished.
+ *
+ * Each thread owns a deque of ready tasks. It pushes tasks it makes ready to
+ * the back of its own deque and pops from there too, which keeps chains of
+ * dependent tasks on one thread. A thread whose deque is empty steals from
+ * the front of another thread's deque. A thread that finds nothing to run
+ * or steal for a while sleeps until a task becomes ready or the graph is
+ * done.
+ *
+ * task must not throw.
+ */
+void run_task_graph(const Task_graph &graph,
+                    const std::function<void(std::size_t)> &task,
+                    std::size_t threads);
+
+#endif
@@ -0,0 +1,187 @@
+#include <exception>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+
+#include "script.hpp"
+
+using std::exception;
+using std::map;
+using std::ostringstream;
+using std::set;
+using std::shared_lock;
+using std::shared_mutex;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::unique_lock;
+using std::vector;
+
+namespace
+{
+    constexpr auto answer = "= ";
+    constexpr auto error = "! ";
+}
+
+Statement_effects analyze_statement(Token_range tokens)
+{
+    Statement_effects effects;
+
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        if (tokens[i].kind != Token_type::identifier)
+        {
+            continue;
+        }
+        if (i == 0 && tokens[i].name == Parser::var_declaration_key)
+        {
+            continue;
+        }
+
+        effects.reads.insert(tokens[i].name);
+
+        const bool declared = (i == 1 &&
+                               tokens[0].name == Parser::var_declaration_key);
+        const bool assigned = (i + 1 < tokens.size() &&
+                               tokens[i + 1].op == '=');
+        if (declared || assigned)
+        {
+            effects.writes.insert(tokens[i].name);
+        }
+    }
+
+    return effects;
+}
+
+Task_graph build_dependencies(const vector<Statement_effects> &effects)
+{
+    Task_graph graph{effects.size()};
+
+    // for each variable: the statement that wrote it last, and the
+    // statements that have read it since
+    map<string, size_t> last_writer;
+    map<string, vector<size_t>> readers;
+
+    for (size_t i = 0; i < effects.size(); ++i)
+    {
+        set<size_t> predecessors;
+
+        for (const auto &name : effects[i].reads)
+        {
+            const auto w = last_writer.find(name);
+            if (w != last_writer.end())
+            {
+                predecessors.insert(w->second);
+            }
+
+            if (effects[i].writes.count(name) == 0)
+            {
+                readers[name].push_back(i);
+            }
+        }
+
+        for (const auto &name : effects[i].writes)
+        {
+            for (const auto r : readers[name])
+            {
+                predecessors.insert(r);
+            }
+            readers[name].clear();
+            last_writer[name] = i;
+        }
+
+        for (const auto p : predecessors)
+        {
+            graph.add_edge(p, i);
+        }
+    }
+
+    return graph;
+}
+
+vector<string> run_script(Parser &calc, const vector<string_view> &statements,
+                          Variable_store &variables_table, size_t threads)
+{
+    const auto n = statements.size();
+
+    // one array for the tokens of all statements rather than one each
+    const auto tokens = tokenize_batch(statements);
+
+    vector<Statement_effects> effects(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        effects[i] = analyze_statement(tokens.line(i));
+    }
+
+    vector<string> results(n);
+    shared_mutex table_mutex;
+
+    /**
+     * A statement is evaluated against a private table holding only the
+     * variables it may touch. The dependency graph guarantees that no
+     * statement running at the same time writes any of them, so copying
+     * them in before and the writes back after is indistinguishable from
+     * evaluating against variables_table directly.
+     */
+    auto evaluate_statement = [&](size_t i)
+    {
+        if (tokens.errors[i].code != Token_errc::none)
+        {
+            results[i] = error + string{tokens.errors[i].what()};
+            return;
+        }
+
+        map<string, Primary> local_table;
+        {
+            shared_lock<shared_mutex> lock{table_mutex};
+            for (const auto &name : effects[i].reads)
+            {
+                if (auto v = variables_table.get(name))
+                {
+                    local_table.emplace(name, std::move(*v));
+                }
+            }
+        }
+
+        ostringstream result;
+        try
+        {
+            const auto r = calc.try_evaluate(tokens.line(i), local_table);
+            if (r)
+            {
+                result << answer << r.value();
+            }
+            else
+            {
+                result << error << r.error().message(tokens.line(i));
+            }
+        }
+        catch (exception &ex)
+        {
+            result << error << ex.what();
+        }
+
+        // a failed statement may still have assigned to variables before
+        // failing, e.g., "(x = 1) + 1 / 0", so always write back
+        {
+            unique_lock<shared_mutex> lock{table_mutex};
+            for (const auto &name : effects[i].writes)
+            {
+                const auto v = local_table.find(name);
+                if (v == local_table.end())
+                {
+                    continue;
+                }
+
+                variables_table.set(name, v->second);
+            }
+        }
+
+        results[i] = result.str();
+    };
+
+    run_task_graph(build_dependencies(effects), evaluate_statement, threads);
+
+    return results;
+}
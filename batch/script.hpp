@@ -0,0 +1,63 @@
+#ifndef A2100_PCALC_SCRIPT
+#define A2100_PCALC_SCRIPT 1
+#pragma once
+
+/**
+ * This library provides:
+ * - Statement_effects UDT describing which variables a statement touches
+ * - analyze_statement() and build_dependencies() to turn a script into a
+ *   Task_graph
+ * - run_script(), which evaluates independent statements of a script
+ *   concurrently
+ */
+
+#include <cstddef>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "batch/scheduler.hpp"
+#include "parser/parser.hpp"
+#include "token/token.hpp"
+
+/**
+ * The variables a statement may look up (reads) and the variables it may
+ * create or change (writes).
+ *
+ * The analysis is conservative: every identifier other than the leading
+ * "let" counts as a read, even if it turns out to be a unit, and every
+ * identifier directly followed by "=" counts as a write. Writes are also
+ * reads, since both declaration and assignment check whether the variable
+ * already exists.
+ */
+struct Statement_effects
+{
+    std::set<std::string> reads;
+    std::set<std::string> writes;
+};
+
+Statement_effects analyze_statement(Token_range tokens);
+
+/**
+ * Order statements the way sequential execution would wherever it matters:
+ * a statement runs after the last earlier statement writing any variable it
+ * reads (or writes), and a statement writing a variable runs after every
+ * earlier statement reading it since that variable was last written.
+ */
+Task_graph build_dependencies(const std::vector<Statement_effects> &effects);
+
+/**
+ * Evaluate each of statements with calc against variables_table, running
+ * statements that don't depend on each other concurrently on up to threads
+ * threads.
+ *
+ * Return one line per statement, "= <result>" or "! <error>". Both the
+ * returned lines and the final contents of variables_table are identical to
+ * evaluating the statements one after another.
+ */
+std::vector<std::string> run_script(
+    Parser &calc, const std::vector<std::string_view> &statements,
+    Variable_store &variables_table, std::size_t threads);
+
+#endif
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.hpp"
+#include "exceptions.hpp"
+
+using std::int64_t;
+using std::pair;
+using std::size_t;
+using std::uint64_t;
+using std::uint8_t;
+using std::unique_ptr;
+
+namespace
+{
+    template <class T>
+    T *at(void *base, unsigned offset)
+    {
+        return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+    }
+
+    // the kernel reads the tail we write and writes the head we read (and
+    // the other way around for the completion queue), so these accesses
+    // must be ordered with respect to the entries themselves
+    unsigned load_acquire(const unsigned *p)
+    {
+        return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    }
+
+    void store_release(unsigned *p, unsigned v)
+    {
+        __atomic_store_n(p, v, __ATOMIC_RELEASE);
+    }
+}
+
+unique_ptr<Uring> Uring::create(unsigned entries)
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    const auto fd = static_cast<int>(
+        ::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    unique_ptr<Uring> ring{new Uring};
+    ring->ring_fd = fd;
+
+    // offset -1 (read or write at the current position) needs this
+    if (!(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+        return nullptr;
+    }
+
+    ring->sq_ring_size = params.sq_off.array +
+                         params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes +
+                         params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->sq_ring_size = ring->cq_ring_size =
+            std::max(ring->sq_ring_size, ring->cq_ring_size);
+    }
+
+    ring->sq_ring = ::mmap(nullptr, ring->sq_ring_size,
+                           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+    {
+        ring->sq_ring = nullptr;
+        return nullptr;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else
+    {
+        ring->cq_ring = ::mmap(nullptr, ring->cq_ring_size,
+                               PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE,
+                               fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED)
+        {
+            ring->cq_ring = nullptr;
+            return nullptr;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = ::mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = nullptr;
+        return nullptr;
+    }
+
+    ring->sq_head = at<unsigned>(ring->sq_ring, params.sq_off.head);
+    ring->sq_tail = at<unsigned>(ring->sq_ring, params.sq_off.tail);
+    ring->sq_mask = at<unsigned>(ring->sq_ring, params.sq_off.ring_mask);
+    ring->sq_array = at<unsigned>(ring->sq_ring, params.sq_off.array);
+    ring->cq_head = at<unsigned>(ring->cq_ring, params.cq_off.head);
+    ring->cq_tail = at<unsigned>(ring->cq_ring, params.cq_off.tail);
+    ring->cq_mask = at<unsigned>(ring->cq_ring, params.cq_off.ring_mask);
+    ring->cqes = at<void>(ring->cq_ring, params.cq_off.cqes);
+
+    return ring;
+}
+
+Uring::~Uring()
+{
+    if (sqes)
+    {
+        ::munmap(sqes, sqes_size);
+    }
+    if (cq_ring && cq_ring != sq_ring)
+    {
+        ::munmap(cq_ring, cq_ring_size);
+    }
+    if (sq_ring)
+    {
+        ::munmap(sq_ring, sq_ring_size);
+    }
+    if (ring_fd >= 0)
+    {
+        ::close(ring_fd);
+    }
+}
+
+void Uring::read(int fd, char *buf, size_t len, int64_t offset, uint64_t tag)
+{
+    queue(IORING_OP_READ, fd, buf, len, offset, tag);
+}
+
+void Uring::write(int fd, const char *buf, size_t len, int64_t offset,
+                  uint64_t tag)
+{
+    queue(IORING_OP_WRITE, fd, buf, len, offset, tag);
+}
+
+void Uring::queue(uint8_t opcode, int fd, const void *buf, size_t len,
+                  int64_t offset, uint64_t tag)
+{
+    const auto tail = *sq_tail;
+    if (tail - load_acquire(sq_head) > *sq_mask)
+    {
+        // callers never keep more requests in flight than the ring holds
+        throw File_error{"io_uring submission queue is full."};
+    }
+
+    const auto index = tail & *sq_mask;
+    auto &sqe = static_cast<io_uring_sqe *>(sqes)[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(buf);
+    sqe.len = static_cast<unsigned>(len);
+    sqe.off = static_cast<uint64_t>(offset);
+    sqe.user_data = tag;
+
+    sq_array[index] = index;
+    store_release(sq_tail, tail + 1);
+    ++to_submit;
+}
+
+void Uring::submit()
+{
+    while (to_submit > 0)
+    {
+        const auto done = ::syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                                    0, 0, nullptr, 0);
+        if (done < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw File_error{"io_uring submission failed."};
+        }
+        to_submit -= static_cast<unsigned>(done);
+    }
+}
+
+pair<uint64_t, int> Uring::wait()
+{
+    submit();
+
+    auto head = *cq_head;
+    while (head == load_acquire(cq_tail))
+    {
+        const auto r = ::syscall(__NR_io_uring_enter, ring_fd, 0, 1,
+                                 IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (r < 0 && errno != EINTR)
+        {
+            throw File_error{"Waiting for io_uring completion failed."};
+        }
+    }
+
+    const auto &cqe = static_cast<io_uring_cqe *>(cqes)[head & *cq_mask];
+    const pair<uint64_t, int> completion{cqe.user_data, cqe.res};
+    store_release(cq_head, head + 1);
+
+    return completion;
+}
@@ -0,0 +1,88 @@
+#ifndef A2100_PCALC_URING
+#define A2100_PCALC_URING 1
+#pragma once
+
+/**
+ * This library provides:
+ * - Uring UDT, a minimal wrapper around a Linux io_uring instance, used by
+ *   Async_reader and Async_writer
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/**
+ * A submission queue and completion queue shared with the kernel. Only what
+ * the batch I/O needs is supported: reads and writes on file descriptors.
+ *
+ * The rings are driven through the raw system calls, so no library beyond
+ * the kernel headers is needed.
+ */
+class Uring
+{
+public:
+    /**
+     * Return a ring with room for entries requests in flight, or null if
+     * io_uring isn't available (old kernel, disabled by seccomp, ...).
+     */
+    static std::unique_ptr<Uring> create(unsigned entries);
+
+    Uring(const Uring &other) = delete;
+    Uring &operator=(const Uring &other) = delete;
+    ~Uring();
+
+    /**
+     * Queue a read of up to len bytes from fd at offset into buf. An offset
+     * of -1 reads from (and advances) the current file position. tag is
+     * handed back on completion.
+     */
+    void read(int fd, char *buf, std::size_t len, std::int64_t offset,
+              std::uint64_t tag);
+
+    /**
+     * Queue a write of len bytes from buf to fd at offset. As with read(),
+     * an offset of -1 means the current file position.
+     */
+    void write(int fd, const char *buf, std::size_t len, std::int64_t offset,
+               std::uint64_t tag);
+
+    /**
+     * Hand all queued requests to the kernel.
+     */
+    void submit();
+
+    /**
+     * Submit queued requests, wait until one request completes and return
+     * its tag and result: the number of bytes transferred or -errno.
+     */
+    std::pair<std::uint64_t, int> wait();
+
+private:
+    Uring() = default;
+
+    void queue(std::uint8_t opcode, int fd, const void *buf, std::size_t len,
+               std::int64_t offset, std::uint64_t tag);
+
+    int ring_fd = -1;
+    unsigned to_submit = 0;
+
+    void *sq_ring = nullptr;
+    std::size_t sq_ring_size = 0;
+    void *cq_ring = nullptr;
+    std::size_t cq_ring_size = 0;
+    void *sqes = nullptr;
+    std::size_t sqes_size = 0;
+
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    void *cqes = nullptr;
+};
+
+#endif
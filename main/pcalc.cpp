@@ -2,13 +2,34 @@
  * pcalc, or Power Calculator, is a feature-heavy command-line calculator.
  */
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <cstdlib>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 
+#include <csignal>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "batch/async_io.hpp"
+#include "batch/check.hpp"
+#include "batch/coalescer.hpp"
+#include "batch/exceptions.hpp"
+#include "batch/lines.hpp"
+#include "batch/mapped_file.hpp"
+#include "batch/pipeline.hpp"
+#include "batch/script.hpp"
 #include "parser/parser.hpp"
 #include "parser/exceptions.hpp"
+#include "server/client.hpp"
+#include "server/exceptions.hpp"
+#include "server/server.hpp"
 #include "token/exceptions.hpp"
 
 using std::cerr;
@@ -18,18 +39,81 @@ using std::exception;
 using std::exit;
 using std::getline;
 using std::string;
+using std::string_view;
+using std::unique_ptr;
+using std::vector;
 
 void calculate(Parser &calc);
 
+int run_batch(Parser &calc, const char *path, bool stats);
+
+int run_script_file(Parser &calc, const char *path);
+
+int run_check(Parser &calc, const char *path);
+
+int run_server(Parser &calc, const char *where);
+
+int evaluate_once(string expr, const char *session);
+
 void add_units_to_parser(Parser &calc);
 
-int main()
+int main(int argc, char *argv[])
 {
-    cout << "Welcome to Power Calculator!\n";
+    // one-shot calls don't need units of their own if a daemon answers them
+    if (argc > 2 && string{argv[1]} == "-e")
+    {
+        if (argc == 3)
+        {
+            return evaluate_once(argv[2], nullptr);
+        }
+        if (argc == 5 && string{argv[3]} == "--session")
+        {
+            return evaluate_once(argv[2], argv[4]);
+        }
+    }
 
     Parser calc;
     add_units_to_parser(calc);
 
+    if (argc > 1)
+    {
+        const string mode = argv[1];
+        if (mode == "--batch")
+        {
+            const auto stats = argc > 2 && string{argv[2]} == "--stats";
+            const auto rest = 2 + stats;
+            if (argc <= rest + 1)
+            {
+                return run_batch(calc, argc == rest + 1 ? argv[rest] : nullptr,
+                                 stats);
+            }
+        }
+        if (mode == "--script" && argc <= 3)
+        {
+            return run_script_file(calc, argc == 3 ? argv[2] : nullptr);
+        }
+        if (mode == "--check" && argc <= 3)
+        {
+            return run_check(calc, argc == 3 ? argv[2] : nullptr);
+        }
+        if (mode == "--serve" && argc == 3)
+        {
+            return run_server(calc, argv[2]);
+        }
+        if (mode == "--daemon" && argc == 2)
+        {
+            return run_server(calc, nullptr);
+        }
+
+        cerr << "usage: pcalc [--batch [--stats] [file] | --script [file] | "
+                "--check [file] |\n"
+                "              --serve <socket path | port> | --daemon |\n"
+                "              -e <expression> [--session <name>]]\n";
+        return EXIT_FAILURE;
+    }
+
+    cout << "Welcome to Power Calculator!\n";
+
     while (true)
     {
         calculate(calc);
@@ -71,6 +155,278 @@ void calculate(Parser &calc)
     }
 }
 
+/**
+ * Evaluate every line of the file at path (or of the standard input if path
+ * is null) and print one result or error per line, without any prompts.
+ *
+ * Regular files are memory-mapped and tokenized in place. Anything else is
+ * read ahead asynchronously, and the output is written asynchronously too.
+ * Repeated pure lines are evaluated once; with stats, how often that
+ * happened is printed to the standard error at the end.
+ */
+int run_batch(Parser &calc, const char *path, bool stats)
+{
+    Coalescer coalescer{calc};
+    const auto report = [stats, &coalescer]()
+    {
+        if (stats)
+        {
+            cerr << coalescer.counters() << "\n";
+        }
+    };
+
+    try
+    {
+        Async_writer out{STDOUT_FILENO};
+
+        if (path)
+        {
+            try
+            {
+                Mapped_file file{path};
+                run_pipeline(calc,
+                             split_lines(file.contents(),
+                                         std::thread::hardware_concurrency()),
+                             out, 64, &coalescer);
+                report();
+                return EXIT_SUCCESS;
+            }
+            catch (File_error &)
+            {
+                // not a regular file, e.g., a named pipe; read it as a stream
+            }
+        }
+
+        const auto fd = path ? ::open(path, O_RDONLY | O_CLOEXEC)
+                             : STDIN_FILENO;
+        if (fd < 0)
+        {
+            cerr << "! Can't open " << path << "\n";
+            return EXIT_FAILURE;
+        }
+
+        Async_reader in{fd};
+        run_pipeline(calc, in, out, 64, &coalescer);
+        if (path)
+        {
+            ::close(fd);
+        }
+    }
+    catch (File_error &ex)
+    {
+        cerr << "! " << ex.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    report();
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Like run_batch(), but read the whole script first and evaluate statements
+ * that don't share variables concurrently.
+ */
+int run_script_file(Parser &calc, const char *path)
+{
+    const auto threads = std::thread::hardware_concurrency();
+    Variable_store variables_table;
+
+    if (path)
+    {
+        try
+        {
+            Mapped_file file{path};
+            const auto results = run_script(
+                calc, split_lines(file.contents(), threads),
+                variables_table, threads);
+            for (const auto &r : results)
+            {
+                cout << r << "\n";
+            }
+
+            return EXIT_SUCCESS;
+        }
+        catch (File_error &ex)
+        {
+            cerr << "! " << ex.what() << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    vector<string> lines;
+    for (string line; getline(cin, line);)
+    {
+        lines.push_back(line);
+    }
+
+    const auto results = run_script(
+        calc, vector<string_view>(lines.begin(), lines.end()),
+        variables_table, threads);
+    for (const auto &r : results)
+    {
+        cout << r << "\n";
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Report every syntax and unit error in the file at path (or the standard
+ * input if path is null) as "<line>:<column>: <message>", without
+ * evaluating anything. Fail if there was any error.
+ */
+int run_check(Parser &calc, const char *path)
+{
+    if (path)
+    {
+        try
+        {
+            Mapped_file file{path};
+            const auto errors =
+                check_lines(calc, split_lines(file.contents(), 1), cout);
+            return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        catch (File_error &ex)
+        {
+            cerr << "! " << ex.what() << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    vector<string> lines;
+    for (string line; getline(cin, line);)
+    {
+        lines.push_back(line);
+    }
+
+    const auto errors = check_lines(
+        calc, vector<string_view>(lines.begin(), lines.end()), cout);
+    return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+namespace
+{
+    Server *running_server = nullptr;
+
+    void stop_server(int)
+    {
+        running_server->stop();
+    }
+}
+
+/**
+ * Serve evaluation requests until interrupted. where is either a TCP port
+ * on 127.0.0.1 (if it's all digits) or the path of a Unix domain socket; if
+ * it's null, listen on default_socket_path().
+ */
+int run_server(Parser &calc, const char *where)
+{
+    Server_options options;
+    options.threads = std::thread::hardware_concurrency();
+
+    // one client's request mustn't hold up a loop thread for long
+    calc.limits.max_tokens = 1 << 16;
+    calc.limits.max_depth = 256;
+    calc.limits.max_steps = 1 << 20;
+    calc.limits.max_time = std::chrono::milliseconds(100);
+
+    try
+    {
+        const string address = where ? where : default_socket_path();
+        if (!address.empty() && address.size() <= 5 &&
+            address.find_first_not_of("0123456789") == string::npos)
+        {
+            options.tcp_port = std::stoi(address);
+        }
+        else
+        {
+            options.unix_path = address;
+        }
+
+        Server server{calc, options};
+        running_server = &server;
+        std::signal(SIGINT, stop_server);
+        std::signal(SIGTERM, stop_server);
+        server.run();
+        running_server = nullptr;
+    }
+    catch (Server_error &ex)
+    {
+        cerr << "! " << ex.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Print the value of expr, or an error, the way a batch would without the
+ * "= " in front of the result. Ask the daemon listening on
+ * default_socket_path() if there is one, so that neither units nor a Parser
+ * have to be set up; evaluate in-process otherwise.
+ *
+ * If session isn't null, evaluate in the daemon's session of that name.
+ * Without a daemon, a session has no earlier variables.
+ */
+int evaluate_once(string expr, const char *session)
+{
+    // a request is one line; any other whitespace means the same
+    std::replace(expr.begin(), expr.end(), '\n', ' ');
+
+    unique_ptr<Client> client;
+    try
+    {
+        client = Client::connect(default_socket_path());
+    }
+    catch (Server_error &)
+    {
+        // without a private directory to listen in, there is no daemon
+    }
+
+    if (client)
+    {
+        vector<string> lines;
+        if (session)
+        {
+            string name = session;
+            std::replace(name.begin(), name.end(), '\n', ' ');
+            lines.push_back(":session " + name);
+        }
+        lines.push_back(expr);
+
+        try
+        {
+            const auto answer = client->ask(lines).back();
+            if (answer.compare(0, 2, "= ") == 0)
+            {
+                cout << answer.substr(2) << "\n";
+                return EXIT_SUCCESS;
+            }
+
+            cerr << answer << "\n";
+            return EXIT_FAILURE;
+        }
+        catch (Server_error &)
+        {
+            // the daemon went away; evaluate without it
+        }
+    }
+
+    Parser calc;
+    add_units_to_parser(calc);
+    try
+    {
+        cout << calc.evaluate(expr) << "\n";
+    }
+    catch (exception &ex)
+    {
+        cerr << "! " << ex.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
 void add_units_to_parser(Parser &calc)
 {
     calc.unit_system.add_new_unit(
@@ -39,4 +39,24 @@ private:
     std::string what_err;
 };
 
+/**
+ * An evaluation needed more than the Evaluation_limits of its Parser allow.
+ */
+class Limit_exceeded : public std::exception
+{
+public:
+    Limit_exceeded(std::string s = "")
+        : what_err{s}
+    {
+    }
+
+    const char *what() const noexcept
+    {
+        return what_err.c_str();
+    }
+
+private:
+    std::string what_err;
+};
+
 #endif
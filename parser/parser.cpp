@@ -1,208 +1,1805 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <iterator>
+#include <memory_resource>
+#include <set>
+
 #include "parser.hpp"
 #include "exceptions.hpp"
 #include "parser/parser_helpers.hpp"
 #include "primary/primary.hpp"
+#include "primary/exceptions.hpp"
+#include "token/exceptions.hpp"
+
+using std::map;
+using std::set;
+
+namespace
+{
+    /**
+     * A Token_range seen through the interface of Token_buffer, so that
+     * both can be evaluated by the same code. has(i) says whether there's a
+     * token i, max_size() how many there can be, and failure() why there are
+     * no more if they ended early; see Token_stream.
+     */
+    class Token_list
+    {
+    public:
+        explicit Token_list(Token_range tokens)
+            : tokens{tokens}
+        {
+        }
+
+        std::size_t size() const
+        {
+            return tokens.size();
+        }
+
+        Token_type kind(std::size_t i) const
+        {
+            return tokens[i].kind;
+        }
+
+        char op(std::size_t i) const
+        {
+            return tokens[i].op;
+        }
+
+        double val(std::size_t i) const
+        {
+            return tokens[i].val;
+        }
+
+        const string &name(std::size_t i) const
+        {
+            return tokens[i].name;
+        }
+
+        std::size_t offset(std::size_t i) const
+        {
+            return tokens[i].offset;
+        }
+
+        std::size_t length(std::size_t i) const
+        {
+            return tokens[i].length;
+        }
+
+        bool has(std::size_t i) const
+        {
+            return i < tokens.size();
+        }
+
+        std::size_t max_size() const
+        {
+            return tokens.size();
+        }
+
+        const Evaluation_error *failure() const
+        {
+            return nullptr;
+        }
+
+        bool is_declaration_key(std::size_t i) const
+        {
+            return tokens[i].name == Parser::var_declaration_key;
+        }
+
+    private:
+        Token_range tokens;
+    };
+
+    /**
+     * A Token_buffer seen through the same interface. Its names are views
+     * into the buffer.
+     */
+    class Buffer_tokens
+    {
+    public:
+        explicit Buffer_tokens(const Token_buffer &tokens)
+            : tokens{tokens}
+        {
+        }
+
+        std::size_t size() const
+        {
+            return tokens.size();
+        }
+
+        Token_type kind(std::size_t i) const
+        {
+            return tokens.kind(i);
+        }
+
+        char op(std::size_t i) const
+        {
+            return tokens.op(i);
+        }
+
+        double val(std::size_t i) const
+        {
+            return tokens.val(i);
+        }
+
+        std::string_view name(std::size_t i) const
+        {
+            return tokens.name(i);
+        }
+
+        std::size_t offset(std::size_t i) const
+        {
+            return tokens.offset(i);
+        }
+
+        std::size_t length(std::size_t i) const
+        {
+            return tokens.length(i);
+        }
+
+        bool has(std::size_t i) const
+        {
+            return i < tokens.size();
+        }
+
+        std::size_t max_size() const
+        {
+            return tokens.size();
+        }
+
+        const Evaluation_error *failure() const
+        {
+            return nullptr;
+        }
+
+        bool is_declaration_key(std::size_t i) const
+        {
+            return tokens.name(i) == Parser::var_declaration_key;
+        }
+
+    private:
+        const Token_buffer &tokens;
+    };
+
+    /**
+     * What is left of the Evaluation_limits of one evaluation. Every token
+     * parsed and every instruction run takes a step; the clock is only read
+     * every clock_interval steps, since reading it costs more than a step.
+     */
+    class Evaluation_budget
+    {
+    public:
+        explicit Evaluation_budget(const Evaluation_limits &limits)
+            : limits{limits}
+        {
+            if (limits.max_time.count() > 0)
+            {
+                deadline = std::chrono::steady_clock::now() + limits.max_time;
+            }
+        }
+
+        /**
+         * Take a step. Return why not if there are none left or time is up,
+         * or nullptr.
+         */
+        const char *step()
+        {
+            ++steps;
+            if (limits.max_steps > 0 && steps > limits.max_steps)
+            {
+                return "Too many evaluation steps.";
+            }
+            if (limits.max_time.count() > 0 && steps % clock_interval == 0 &&
+                std::chrono::steady_clock::now() > deadline)
+            {
+                return "Evaluation took too long.";
+            }
+            return nullptr;
+        }
+
+    private:
+        static constexpr std::size_t clock_interval = 256;
+
+        Evaluation_limits limits;
+        std::size_t steps = 0;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    /**
+     * Return why tokens are too many or nest too deeply to be evaluated
+     * within limits, or nullptr. Both are known before evaluating anything.
+     */
+    template <class Tokens>
+    const char *check_size(const Tokens &tokens,
+                           const Evaluation_limits &limits)
+    {
+        if (limits.max_tokens > 0 && tokens.size() > limits.max_tokens)
+        {
+            return "Too many tokens.";
+        }
+
+        if (limits.max_depth == 0)
+        {
+            return nullptr;
+        }
+
+        std::size_t depth = 0;
+        for (std::size_t t = 0; t < tokens.size(); ++t)
+        {
+            if (tokens.kind(t) != Token_type::operator_type)
+            {
+                continue;
+            }
+            if (tokens.op(t) == '(' && ++depth > limits.max_depth)
+            {
+                return "Parentheses nested too deeply.";
+            }
+            if (tokens.op(t) == ')' && depth > 0)
+            {
+                --depth;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * An error about token t of tokens, or about their end if t is the end.
+     */
+    template <class Tokens>
+    Evaluation_error error_at(const Tokens &tokens, std::size_t t,
+                              Evaluation_errc code, const char *what)
+    {
+        Evaluation_error error;
+        error.code = code;
+        error.what = what;
+        error.token = t;
+        if (t < tokens.size())
+        {
+            error.span = {tokens.offset(t),
+                          tokens.offset(t) + tokens.length(t)};
+        }
+        else if (tokens.size() > 0)
+        {
+            const auto last = tokens.size() - 1;
+            const auto end = tokens.offset(last) + tokens.length(last);
+            error.span = {end, end};
+        }
+        return error;
+    }
+
+    /**
+     * The instructions of the stack machine that evaluates expressions.
+     */
+    enum class Opcode
+    {
+        number,   // push the number of the token
+        variable, // push the variable named by the token
+        unit,     // give the top value the unit named by the token
+        assign,   // store the top value in the variable named by the token
+        factorial,
+        negate,
+        affirm,
+        add,
+        subtract,
+        multiply,
+        divide,
+        modulo,
+        power,
+    };
+
+    struct Instruction
+    {
+        Opcode code;
+        // the index of the token it was compiled from
+        std::size_t token;
+    };
+
+    /**
+     * The instructions of a statement. Its memory resource is also used for
+     * the other scratch data of compiling and running it.
+     */
+    using Program = std::pmr::vector<Instruction>;
+
+    /**
+     * An operator waiting for its right operand while compiling.
+     */
+    struct Pending_operator
+    {
+        Opcode code;
+        int precedence;
+        std::size_t token;
+    };
+
+    /**
+     * Variables tables are maps, from names to Primaries or Dimensions, or
+     * Variable_stores. These read and write either kind; is_declared() also
+     * takes a set of names.
+     */
+    template <class Table>
+    bool is_declared(const Table &table,
+                     const typename Table::key_type &name)
+    {
+        return table.find(name) != table.end();
+    }
+
+    bool is_declared(const Variable_store &table, std::string_view name)
+    {
+        return table.contains(name);
+    }
+
+    const Primary *lookup(const map<string, Primary> &table,
+                          const string &name)
+    {
+        const auto var = table.find(name);
+        return var == table.end() ? nullptr : &var->second;
+    }
+
+    std::optional<Primary> lookup(const Variable_store &table,
+                                  std::string_view name)
+    {
+        return table.get(name);
+    }
+
+    template <class Value>
+    void store(map<string, Value> &table, const string &name,
+               const Value &value)
+    {
+        // Primary can't be assigned to
+        table.erase(name);
+        table.insert({name, value});
+    }
+
+    void store(Variable_store &table, std::string_view name,
+               const Primary &value)
+    {
+        table.set(name, value);
+    }
+
+    /**
+     * A name as table wants it. Names read from a Token_buffer are views,
+     * which maps, sets and the Unit_system need copied into strings; a
+     * Variable_store takes them as they are.
+     */
+    template <class Table>
+    const string &key(const Table &, const string &name)
+    {
+        return name;
+    }
+
+    template <class Table>
+    string key(const Table &, std::string_view name)
+    {
+        return string{name};
+    }
+
+    std::string_view key(const Variable_store &, std::string_view name)
+    {
+        return name;
+    }
+
+    bool is_binary(Opcode code)
+    {
+        return code >= Opcode::add;
+    }
+
+    /**
+     * Is the right operand of a binary operator evaluated before its left
+     * one? It is for all but ^, so that "b - (b = 1)" reads b after the
+     * assignment, and of two failing operands the right one's error is
+     * reported.
+     */
+    bool right_operand_first(Opcode code)
+    {
+        return code != Opcode::power;
+    }
+
+    /**
+     * Reorder program, in which each operator follows both of its operands,
+     * so that operands come in the order they are evaluated in. A binary
+     * operator for which right_operand_first() then finds its left operand
+     * on top of the stack and its right one below.
+     */
+    void put_in_evaluation_order(Program &program)
+    {
+        const auto n = program.size();
+        if (std::none_of(program.begin(), program.end(),
+                         [](const Instruction &i)
+                         {
+                             return is_binary(i.code) &&
+                                    right_operand_first(i.code);
+                         }))
+        {
+            return;
+        }
+
+        // where the right operand of each binary operator starts
+        const auto resource = program.get_allocator().resource();
+        std::pmr::vector<std::size_t> right_start(n, resource);
+        std::pmr::vector<std::size_t> starts{resource};
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const auto code = program[i].code;
+            if (code == Opcode::number || code == Opcode::variable)
+            {
+                starts.push_back(i);
+            }
+            else if (is_binary(code))
+            {
+                right_start[i] = starts.back();
+                starts.pop_back();
+            }
+        }
+
+        // 2 * i stands for the operand ending at instruction i, and
+        // 2 * i + 1 for instruction i itself once its operands are done
+        Program ordered{resource};
+        ordered.reserve(n);
+        std::pmr::vector<std::size_t> pending{resource};
+        pending.push_back(2 * (n - 1));
+        while (!pending.empty())
+        {
+            const auto p = pending.back();
+            pending.pop_back();
+            const auto i = p / 2;
+            const auto code = program[i].code;
+            if (p % 2 == 1 || code == Opcode::number ||
+                code == Opcode::variable)
+            {
+                ordered.push_back(program[i]);
+                continue;
+            }
+
+            pending.push_back(p + 1);
+            if (!is_binary(code))
+            {
+                pending.push_back(2 * (i - 1));
+                continue;
+            }
+            const auto left = 2 * (right_start[i] - 1);
+            const auto right = 2 * (i - 1);
+            // the operand pushed last is ordered first
+            pending.push_back(right_operand_first(code) ? left : right);
+            pending.push_back(right_operand_first(code) ? right : left);
+        }
+        program = std::move(ordered);
+    }
+
+    // precedences of pending operators; a binary operator applies the
+    // pending operators that bind at least as tightly before it is pushed
+    constexpr int parenthesis_precedence = -1;
+    constexpr int assignment_precedence = 0;
+    constexpr int sum_precedence = 1;
+    constexpr int product_precedence = 2;
+    constexpr int sign_precedence = 3;
+    constexpr int power_precedence = 4;
+
+    /**
+     * Translate the expression spanned by tokens [s:end) into
+     * program, with an explicit stack of pending operators instead of
+     * recursion. If assignable, it may be an Assignment; otherwise it's an
+     * Expression. Only parenthesized parts are then allowed to be
+     * assignments. Assigned variables must be declared in variables_table.
+     */
+    template <class Tokens, class Table>
+    Evaluation_error compile(const Tokens &tokens, std::size_t s,
+                             bool assignable, const Table &variables_table,
+                             Evaluation_budget &budget,
+                             Program &program)
+    {
+        program.reserve(tokens.max_size() - s);
+        std::pmr::vector<Pending_operator> pending{
+            program.get_allocator().resource()};
+
+        // apply pending operators that bind at least as tightly as an
+        // operator of precedence, or more tightly if it's right-associative
+        const auto apply_pending = [&](int precedence, bool right_associative)
+        {
+            while (!pending.empty() &&
+                   (pending.back().precedence > precedence ||
+                    (pending.back().precedence == precedence &&
+                     !right_associative)))
+            {
+                program.push_back({pending.back().code, pending.back().token});
+                pending.pop_back();
+            }
+        };
+
+        const auto syntax_error = [&tokens](std::size_t t, const char *what)
+        {
+            return error_at(tokens, t, Evaluation_errc::syntax_error, what);
+        };
+
+        bool expect_operand = true;
+        bool at_assignment = assignable;
+        for (auto t = s; tokens.has(t); ++t)
+        {
+            if (const auto why = budget.step())
+            {
+                return error_at(tokens, t, Evaluation_errc::limit_exceeded,
+                                why);
+            }
+
+            const bool may_assign = at_assignment;
+            at_assignment = false;
+            const auto kind = tokens.kind(t);
+            const auto op = tokens.op(t);
+
+            if (expect_operand)
+            {
+                if (kind == Token_type::number)
+                {
+                    program.push_back({Opcode::number, t});
+                    expect_operand = false;
+                    continue;
+                }
+
+                if (kind == Token_type::identifier)
+                {
+                    const auto next = t + 1;
+                    if (may_assign && tokens.has(next) &&
+                        tokens.kind(next) == Token_type::operator_type &&
+                        tokens.op(next) == '=')
+                    {
+                        if (!tokens.has(next + 1) ||
+                            tokens.op(next + 1) == ')')
+                        {
+                            if (const auto failure = tokens.failure())
+                            {
+                                return *failure;
+                            }
+                            return syntax_error(next,
+                                                "Not a valid assignment.");
+                        }
+                        if (!is_declared(variables_table,
+                                         key(variables_table, tokens.name(t))))
+                        {
+                            return error_at(tokens, t,
+                                            Evaluation_errc::runtime_error,
+                                            "Variable not defined.");
+                        }
+
+                        // assignments chain: "x = y = 4"
+                        pending.push_back(
+                            {Opcode::assign, assignment_precedence, t});
+                        at_assignment = true;
+                        t = next;
+                        continue;
+                    }
+
+                    program.push_back({Opcode::variable, t});
+                    expect_operand = false;
+                    continue;
+                }
+
+                switch (op)
+                {
+                case '-':
+                    pending.push_back({Opcode::negate, sign_precedence, t});
+                    break;
+                case '+':
+                    pending.push_back({Opcode::affirm, sign_precedence, t});
+                    break;
+                case '(':
+                    // only its precedence matters; it's never applied
+                    pending.push_back(
+                        {Opcode::number, parenthesis_precedence, t});
+                    at_assignment = true;
+                    break;
+                case '!':
+                    return syntax_error(t, "Argument for '!' not provided.");
+                case '=':
+                    return syntax_error(t, "Not a valid assignment.");
+                default:
+                    return syntax_error(t, "Primary expected.");
+                }
+                continue;
+            }
+
+            /**
+             * A primary is complete: what follows can extend it or be a
+             * binary operator.
+             */
+            if (kind == Token_type::identifier)
+            {
+                program.push_back({Opcode::unit, t});
+                continue;
+            }
+
+            if (kind == Token_type::number)
+            {
+                return syntax_error(t, "Only a primary was expected.");
+            }
+
+            switch (op)
+            {
+            case '!':
+                program.push_back({Opcode::factorial, t});
+                break;
+            case '+':
+            case '-':
+                apply_pending(sum_precedence, false);
+                pending.push_back(
+                    {op == '+' ? Opcode::add : Opcode::subtract,
+                     sum_precedence, t});
+                expect_operand = true;
+                break;
+            case '*':
+            case '/':
+            case '%':
+                apply_pending(product_precedence, false);
+                pending.push_back(
+                    {op == '*' ? Opcode::multiply
+                               : (op == '/' ? Opcode::divide
+                                            : Opcode::modulo),
+                     product_precedence, t});
+                expect_operand = true;
+                break;
+            case '^':
+                apply_pending(power_precedence, true);
+                pending.push_back({Opcode::power, power_precedence, t});
+                expect_operand = true;
+                break;
+            case ')':
+                apply_pending(parenthesis_precedence, true);
+                if (pending.empty())
+                {
+                    return syntax_error(t, "Missing '('.");
+                }
+                pending.pop_back();
+                break;
+            case '=':
+                return syntax_error(t, "Not a valid assignment.");
+            default:
+                return syntax_error(t, "Only a primary was expected.");
+            }
+        }
+
+        // the tokens ran out
+        if (const auto failure = tokens.failure())
+        {
+            return *failure;
+        }
+        const auto e = tokens.size();
+        if (expect_operand)
+        {
+            return syntax_error(e, "Primary expected.");
+        }
+
+        apply_pending(parenthesis_precedence, true);
+        if (!pending.empty())
+        {
+            return syntax_error(e, "Missing ')'.");
+        }
+
+        put_in_evaluation_order(program);
+        return {};
+    }
+
+    /**
+     * Run the instructions of program, compiled from tokens, on a stack of
+     * values and return the value left on it.
+     */
+    template <class Tokens, class Table>
+    Evaluation_result run(const Program &program, const Tokens &tokens,
+                          const Unit_system &unit_system,
+                          Table &variables_table,
+                          Evaluation_budget &budget)
+    {
+        std::pmr::vector<Primary> stack{program.get_allocator().resource()};
+
+        // Primary can't be assigned to, so results replace the operands
+        const auto replace_top = [&stack](Primary result, int operands)
+        {
+            for (; operands > 0; --operands)
+            {
+                stack.pop_back();
+            }
+            stack.push_back(std::move(result));
+        };
+
+        const auto error = [&tokens](const Instruction &i,
+                                     Evaluation_errc code, const char *what)
+        {
+            return error_at(tokens, i.token, code, what);
+        };
+
+        // operations on Primaries are checked first, so they don't throw
+        const auto failure = [&error](const Instruction &i,
+                                      const Primary_check &c)
+        {
+            switch (c.code)
+            {
+            case Primary_errc::division_by_zero:
+                return error(i, Evaluation_errc::division_by_zero, c.what);
+            case Primary_errc::invalid_operands:
+                return error(i, Evaluation_errc::invalid_operands, c.what);
+            default:
+                return error(i, Evaluation_errc::incompatible_units, c.what);
+            }
+        };
+
+        for (const auto &i : program)
+        {
+            if (const auto why = budget.step())
+            {
+                return error(i, Evaluation_errc::limit_exceeded, why);
+            }
+
+            switch (i.code)
+            {
+            case Opcode::number:
+                stack.emplace_back(tokens.val(i.token), unit_system);
+                break;
+            case Opcode::variable:
+            {
+                const auto &name = key(variables_table, tokens.name(i.token));
+                const auto var = lookup(variables_table, name);
+                if (!var)
+                {
+                    return error(i, Evaluation_errc::runtime_error,
+                                 "Variable not found.");
+                }
+                stack.push_back(*var);
+                break;
+            }
+            case Opcode::unit:
+            {
+                const auto &unit = key(unit_system, tokens.name(i.token));
+                if (!unit_system.has_unit(unit))
+                {
+                    return error(i, Evaluation_errc::unknown_unit,
+                                 "Not a known unit.");
+                }
+                replace_top(Primary(stack.back().get_value(), unit_system,
+                                    unit),
+                            1);
+                break;
+            }
+            case Opcode::assign:
+            {
+                const auto &name = key(variables_table, tokens.name(i.token));
+                store(variables_table, name, stack.back());
+                break;
+            }
+            case Opcode::factorial:
+                if (const auto c = stack.back().check_factorial(); !c)
+                {
+                    return failure(i, c);
+                }
+                replace_top(stack.back().factorial(), 1);
+                break;
+            case Opcode::negate:
+                replace_top(-stack.back(), 1);
+                break;
+            case Opcode::affirm:
+                replace_top(+stack.back(), 1);
+                break;
+            default:
+            {
+                const auto swapped = right_operand_first(i.code);
+                const auto &left = stack[stack.size() - (swapped ? 1 : 2)];
+                const auto &right = stack[stack.size() - (swapped ? 2 : 1)];
+                if (const auto c = left.check(tokens.op(i.token), right); !c)
+                {
+                    return failure(i, c);
+                }
+                switch (i.code)
+                {
+                case Opcode::add:
+                    replace_top(left + right, 2);
+                    break;
+                case Opcode::subtract:
+                    replace_top(left - right, 2);
+                    break;
+                case Opcode::multiply:
+                    replace_top(left * right, 2);
+                    break;
+                case Opcode::divide:
+                    replace_top(left / right, 2);
+                    break;
+                case Opcode::modulo:
+                    replace_top(left % right, 2);
+                    break;
+                default:
+                    replace_top(left ^ right, 2);
+                    break;
+                }
+            }
+            }
+        }
+
+        return stack.back();
+    }
+
+    /**
+     * Does program use no variables and no units? Then run_numbers() can
+     * evaluate it.
+     */
+    bool is_unitless(const Program &program)
+    {
+        for (const auto &i : program)
+        {
+            if (i.code == Opcode::variable || i.code == Opcode::unit ||
+                i.code == Opcode::assign)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Like run(), for a program for which is_unitless(): the values are
+     * bare doubles, computed the way Primary computes them, and only the
+     * result is made a Primary.
+     */
+    template <class Tokens>
+    Evaluation_result run_numbers(const Program &program,
+                                  const Tokens &tokens,
+                                  const Unit_system &unit_system,
+                                  Evaluation_budget &budget)
+    {
+        std::pmr::vector<double> stack{program.get_allocator().resource()};
+        stack.reserve(program.size());
+
+        const auto error = [&tokens](const Instruction &i,
+                                     Evaluation_errc code, const char *what)
+        {
+            return error_at(tokens, i.token, code, what);
+        };
+
+        for (const auto &i : program)
+        {
+            if (const auto why = budget.step())
+            {
+                return error(i, Evaluation_errc::limit_exceeded, why);
+            }
+
+            switch (i.code)
+            {
+            case Opcode::number:
+                stack.push_back(tokens.val(i.token));
+                break;
+            case Opcode::negate:
+                stack.back() = -stack.back();
+                break;
+            case Opcode::affirm:
+                break;
+            default:
+            {
+                const auto unary = i.code == Opcode::factorial;
+                const auto op = tokens.op(i.token);
+                auto right = unary ? 0 : stack.back();
+                if (!unary)
+                {
+                    stack.pop_back();
+                    if (right_operand_first(i.code))
+                    {
+                        std::swap(right, stack.back());
+                    }
+                }
+                auto &left = stack.back();
+                if (const auto c = check_values(op, left, right); !c)
+                {
+                    return error(i,
+                                 c.code == Primary_errc::division_by_zero
+                                     ? Evaluation_errc::division_by_zero
+                                     : Evaluation_errc::invalid_operands,
+                                 c.what);
+                }
+                left = compute_values(op, left, right);
+            }
+            }
+        }
+
+        return Primary{stack.back(), unit_system};
+    }
+
+    /**
+     * The Evaluation_error for a bad token found after good ones.
+     */
+    Evaluation_error token_failure(const Token_error &error, std::size_t good)
+    {
+        Evaluation_error failure;
+        failure.code = error.code == Token_errc::bad_number
+                           ? Evaluation_errc::bad_number
+                           : Evaluation_errc::unknown_token;
+        failure.span = {error.offset, error.offset + error.length};
+        failure.token = good;
+        failure.what = error.what();
+        return failure;
+    }
+
+    /**
+     * The tokens of an expression read from a Token_buffer as they are
+     * needed, so that they are scanned and parsed in one pass. A bad token,
+     * or tokens beyond the limits, end the stream and become its failure().
+     * An error found before the end is settle()d against the rest, so that
+     * errors are the same as for an expression tokenized first.
+     */
+    class Token_stream
+    {
+    public:
+        Token_stream(Token_buffer &tokens, const Evaluation_limits &limits)
+            : tokens{tokens}, limits{limits}
+        {
+        }
+
+        /**
+         * Is there a token i? Read up to it if needed.
+         */
+        bool has(std::size_t i) const
+        {
+            while (i >= tokens.size() && pull())
+            {
+            }
+            return i < tokens.size();
+        }
+
+        /**
+         * Why the tokens ended before the expression did, or nullptr.
+         */
+        const Evaluation_error *failure() const
+        {
+            return error.code == Evaluation_errc::none ? nullptr : &error;
+        }
+
+        /**
+         * The number of tokens read so far; all of them once has() is false.
+         */
+        std::size_t size() const
+        {
+            return tokens.size();
+        }
+
+        /**
+         * The most tokens there can be.
+         */
+        std::size_t max_size() const
+        {
+            return tokens.size() + tokens.unscanned();
+        }
+
+        Token_type kind(std::size_t i) const
+        {
+            return tokens.kind(i);
+        }
+
+        char op(std::size_t i) const
+        {
+            return tokens.op(i);
+        }
+
+        double val(std::size_t i) const
+        {
+            return tokens.val(i);
+        }
+
+        std::string_view name(std::size_t i) const
+        {
+            return tokens.name(i);
+        }
 
-Primary Parser::evaluate(const string &expr,
-                         std::map<std::string, Primary> &variables_table)
-{
-    auto tokens = tokenize(expr);
-    if (tokens.size() == 0)
+        std::size_t offset(std::size_t i) const
+        {
+            return tokens.offset(i);
+        }
+
+        std::size_t length(std::size_t i) const
+        {
+            return tokens.length(i);
+        }
+
+        bool is_declaration_key(std::size_t i) const
+        {
+            return tokens.name(i) == Parser::var_declaration_key;
+        }
+
+        /**
+         * The error to report for early, an error found before the end of
+         * the tokens: a bad token further on wins over it, and so do the
+         * limits, as when the whole expression is tokenized first.
+         */
+        Evaluation_error settle(const Evaluation_error &early) const
+        {
+            while (pull())
+            {
+            }
+            if (error.code == Evaluation_errc::limit_exceeded)
+            {
+                Token_error bad;
+                while (tokens.pull(bad))
+                {
+                }
+                if (bad.code != Token_errc::none)
+                {
+                    error = token_failure(bad, tokens.size());
+                }
+            }
+            return failure() ? *failure() : early;
+        }
+
+    private:
+        /**
+         * Read one more token, checking the limits that check_size() checks
+         * for the others.
+         */
+        bool pull() const
+        {
+            if (ended)
+            {
+                return false;
+            }
+
+            Token_error bad;
+            if (!tokens.pull(bad))
+            {
+                ended = true;
+                if (bad.code != Token_errc::none)
+                {
+                    error = token_failure(bad, tokens.size());
+                }
+                return false;
+            }
+
+            const char *why = nullptr;
+            if (limits.max_tokens > 0 && tokens.size() > limits.max_tokens)
+            {
+                why = "Too many tokens.";
+            }
+            const auto last = tokens.size() - 1;
+            if (limits.max_depth > 0 &&
+                tokens.kind(last) == Token_type::operator_type)
+            {
+                if (tokens.op(last) == '(' && ++depth > limits.max_depth)
+                {
+                    why = "Parentheses nested too deeply.";
+                }
+                if (tokens.op(last) == ')' && depth > 0)
+                {
+                    --depth;
+                }
+            }
+            if (why)
+            {
+                // reported where the other tokens report it
+                ended = true;
+                error = error_at(*this, 0, Evaluation_errc::limit_exceeded,
+                                 why);
+            }
+            return true;
+        }
+
+        Token_buffer &tokens;
+        const Evaluation_limits &limits;
+        mutable bool ended = false;
+        mutable std::size_t depth = 0;
+        mutable Evaluation_error error;
+    };
+
+    /**
+     * A Token_stream checks its size as it's read.
+     */
+    const char *check_size(const Token_stream &, const Evaluation_limits &)
     {
-        throw Syntax_error{"Empty expression."};
+        return nullptr;
     }
 
-    if (is_variable_declaration(tokens))
+    /**
+     * The error to report for early, found while parsing tokens. Tokens
+     * read all at once have been checked for bad tokens already.
+     */
+    template <class Tokens>
+    Evaluation_error settle(const Tokens &, const Evaluation_error &early)
+    {
+        return early;
+    }
+
+    Evaluation_error settle(const Token_stream &tokens,
+                            const Evaluation_error &early)
+    {
+        return tokens.settle(early);
+    }
+
+    /**
+     * What check_units() returns: the units of an expression or an
+     * Evaluation_error, like Evaluation_result.
+     */
+    class Checked_units
+    {
+    public:
+        Checked_units(const Dimension &units)
+            : units{units}
+        {
+        }
+
+        Checked_units(const Evaluation_error &error)
+            : failure{error}
+        {
+        }
+
+        explicit operator bool() const
+        {
+            return failure.code == Evaluation_errc::none;
+        }
+
+        const Dimension &value() const
+        {
+            return units;
+        }
+
+        const Evaluation_error &error() const
+        {
+            return failure;
+        }
+
+    private:
+        Dimension units;
+        Evaluation_error failure;
+    };
+
+    /**
+     * Like run(), but work out only the units of the values, which are taken
+     * from and assigned to dimensions.
+     */
+    template <class Tokens>
+    Checked_units check_units(const Program &program, const Tokens &tokens,
+                              const Unit_system &unit_system,
+                              map<string, Dimension> &dimensions,
+                              Evaluation_budget &budget)
+    {
+        std::pmr::vector<Dimension> stack{
+            program.get_allocator().resource()};
+
+        const auto error = [&tokens](const Instruction &i,
+                                     Evaluation_errc code, const char *what)
+        {
+            return error_at(tokens, i.token, code, what);
+        };
+
+        for (const auto &i : program)
+        {
+            if (const auto why = budget.step())
+            {
+                return error(i, Evaluation_errc::limit_exceeded, why);
+            }
+
+            switch (i.code)
+            {
+            case Opcode::number:
+                stack.emplace_back();
+                break;
+            case Opcode::variable:
+            {
+                const auto &name = key(dimensions, tokens.name(i.token));
+                auto var = dimensions.find(name);
+                if (var == dimensions.end())
+                {
+                    return error(i, Evaluation_errc::runtime_error,
+                                 "Variable not found.");
+                }
+                stack.push_back(var->second);
+                break;
+            }
+            case Opcode::unit:
+            {
+                const auto &unit = key(unit_system, tokens.name(i.token));
+                if (!unit_system.has_unit(unit))
+                {
+                    return error(i, Evaluation_errc::unknown_unit,
+                                 "Not a known unit.");
+                }
+                stack.back() = Dimension{unit_system, unit};
+                break;
+            }
+            case Opcode::assign:
+            {
+                const auto &name = key(dimensions, tokens.name(i.token));
+                dimensions[name] = stack.back();
+                break;
+            }
+            case Opcode::factorial:
+                stack.back() = Dimension{};
+                break;
+            case Opcode::negate:
+            case Opcode::affirm:
+                break;
+            default:
+            {
+                auto right = std::move(stack.back());
+                stack.pop_back();
+                if (right_operand_first(i.code))
+                {
+                    std::swap(right, stack.back());
+                }
+                auto &left = stack.back();
+                if (const auto c = left.check(tokens.op(i.token), right); !c)
+                {
+                    return error(i, Evaluation_errc::incompatible_units,
+                                 c.what);
+                }
+                left = left.combine(tokens.op(i.token), right);
+            }
+            }
+        }
+
+        return stack.back();
+    }
+
+    /**
+     * Memory for the scratch data of statements: their instructions, the
+     * operators pending while compiling them and the stacks they run on.
+     * It's handed out by bumping a pointer, never given back piece by piece,
+     * and all released at once when a statement is done. Each thread has
+     * one, with a first block of its own that's reused by every statement,
+     * so most statements get their scratch data without allocating.
+     */
+    struct Evaluation_arena
+    {
+        Evaluation_arena()
+            : memory{first_block.data(), first_block.size()}
+        {
+        }
+
+        std::array<std::byte, 16 << 10> first_block;
+        std::pmr::monotonic_buffer_resource memory;
+        // the scopes using the arena
+        int users = 0;
+    };
+
+    /**
+     * The arena of this thread, for the lifetime of the scope. It's
+     * released when the outermost scope ends, so a scope inside another
+     * doesn't release memory that's still in use.
+     */
+    class Arena_scope
+    {
+    public:
+        Arena_scope()
+            : arena{thread_arena()}
+        {
+            ++arena.users;
+        }
+
+        Arena_scope(const Arena_scope &other) = delete;
+        Arena_scope &operator=(const Arena_scope &other) = delete;
+
+        ~Arena_scope()
+        {
+            if (--arena.users == 0)
+            {
+                arena.memory.release();
+            }
+        }
+
+        std::pmr::memory_resource *resource()
+        {
+            return &arena.memory;
+        }
+
+    private:
+        static Evaluation_arena &thread_arena()
+        {
+            thread_local Evaluation_arena arena;
+            return arena;
+        }
+
+        Evaluation_arena &arena;
+    };
+
+    /**
+     * Evaluate the statement tokens against table, whose values are those
+     * of Result, with run(program, budget). Variable declarations are done
+     * here; the rest is compiled and passed to run. This is shared by
+     * evaluating and checking.
+     */
+    template <class Result, class Tokens, class Table, class Run>
+    Result statement(const Tokens &tokens, Table &table,
+                     const Evaluation_limits &limits, Run run)
+    {
+        if (!tokens.has(0))
+        {
+            if (const auto failure = tokens.failure())
+            {
+                return *failure;
+            }
+            return error_at(tokens, 0, Evaluation_errc::syntax_error,
+                            "Empty expression.");
+        }
+
+        if (const auto why = check_size(tokens, limits))
+        {
+            return error_at(tokens, 0, Evaluation_errc::limit_exceeded, why);
+        }
+        Evaluation_budget budget{limits};
+        // program is destroyed before the memory it's in is released
+        Arena_scope arena;
+        Program program{arena.resource()};
+
+        if (!is_variable_declaration(tokens))
+        {
+            const auto error = compile(tokens, 0, true, table, budget,
+                                       program);
+            if (error.code != Evaluation_errc::none)
+            {
+                return settle(tokens, error);
+            }
+            return run(program, budget);
+        }
+
+        if (!is_valid_variable_declaration_syntax(tokens))
+        {
+            if (const auto failure = tokens.failure())
+            {
+                return *failure;
+            }
+            return settle(tokens,
+                          error_at(tokens, 0, Evaluation_errc::syntax_error,
+                                   "Invalid variable declaration syntax."));
+        }
+
+        const auto &var_name = key(table, tokens.name(1));
+        if (is_declared(table, var_name))
+        {
+            return settle(tokens,
+                          error_at(tokens, 1, Evaluation_errc::runtime_error,
+                                   "Redeclaration of variable."));
+        }
+
+        const auto error = compile(tokens, 3, false, table, budget, program);
+        if (error.code != Evaluation_errc::none)
+        {
+            return settle(tokens, error);
+        }
+        auto result = run(program, budget);
+        if (result)
+        {
+            store(table, var_name, result.value());
+        }
+
+        return result;
+    }
+
+    template <class Tokens, class Table>
+    Evaluation_result evaluate_tokens(const Tokens &tokens,
+                                      const Unit_system &unit_system,
+                                      const Evaluation_limits &limits,
+                                      Table &variables_table)
+    {
+        return statement<Evaluation_result>(
+            tokens, variables_table, limits,
+            [&](const Program &program, Evaluation_budget &budget)
+            {
+                // most expressions are plain arithmetic
+                if (is_unitless(program))
+                {
+                    return run_numbers(program, tokens, unit_system, budget);
+                }
+                return run(program, tokens, unit_system, variables_table,
+                           budget);
+            });
+    }
+
+    template <class Tokens>
+    Evaluation_error check_tokens(const Tokens &tokens,
+                                  const Unit_system &unit_system,
+                                  const Evaluation_limits &limits,
+                                  map<string, Dimension> &dimensions)
+    {
+        const auto result = statement<Checked_units>(
+            tokens, dimensions, limits,
+            [&](const Program &program, Evaluation_budget &budget)
+            {
+                return check_units(program, tokens, unit_system, dimensions,
+                                   budget);
+            });
+
+        return result ? Evaluation_error{} : result.error();
+    }
+
+    /**
+     * The tokens of expressions given as text. Each thread has its own, so
+     * that a thread evaluating one line after another reuses its memory.
+     */
+    Token_buffer &thread_buffer()
     {
-        return variable_declaration(
-            tokens.begin(), tokens.end(), variables_table);
+        thread_local Token_buffer tokens;
+        return tokens;
     }
 
-    return assignment(tokens.begin(), tokens.end(), variables_table);
+    [[noreturn]] void raise_with(Evaluation_errc code, const string &what)
+    {
+        switch (code)
+        {
+        case Evaluation_errc::unknown_token:
+            throw Unknown_token{what};
+        case Evaluation_errc::bad_number:
+            throw Bad_number{what};
+        case Evaluation_errc::runtime_error:
+            throw Runtime_error{what};
+        case Evaluation_errc::limit_exceeded:
+            throw Limit_exceeded{what};
+        case Evaluation_errc::incompatible_units:
+            throw Incompatible_units{what};
+        case Evaluation_errc::unknown_unit:
+            throw Unknown_unit{what};
+        case Evaluation_errc::division_by_zero:
+            throw Division_by_zero{what};
+        case Evaluation_errc::invalid_operands:
+            throw Invalid_operands{what};
+        default:
+            throw Syntax_error{what};
+        }
+    }
 }
 
-Primary Parser::variable_declaration(const Token_iter &s, const Token_iter &e,
-                                     std::map<std::string, Primary> &variables_table)
+string Evaluation_error::message(std::string_view source) const
 {
-    if (!is_valid_variable_declaration_syntax(s, e))
+    if (code == Evaluation_errc::unknown_unit && span.end <= source.size())
     {
-        throw Syntax_error{"Invalid variable declaration syntax."};
+        return string{source.substr(span.begin, span.end - span.begin)} +
+               " is not a known unit.";
     }
 
-    auto var_name_iter = s + 1;
-    auto var_name = var_name_iter->name;
-    if (variables_table.find(var_name) != variables_table.end())
+    return what;
+}
+
+string Evaluation_error::message(Token_range tokens) const
+{
+    if (code == Evaluation_errc::unknown_unit && token < tokens.size())
     {
-        throw Runtime_error{"Redeclaration of variable."};
+        return tokens[token].name + " is not a known unit.";
     }
 
-    auto exp_iter = s + 3;
-    auto val = expression(exp_iter, e, variables_table);
-    variables_table.insert({var_name, val});
+    return what;
+}
 
-    return val;
+void Evaluation_error::raise(Token_range tokens) const
+{
+    raise_with(code, message(tokens));
 }
 
-Primary Parser::assignment(const Token_iter &s, const Token_iter &e,
-                           std::map<std::string, Primary> &variables_table)
+void Evaluation_error::raise(std::string_view source) const
 {
-    auto i = find_forward(s, e, '=');
+    raise_with(code, message(source));
+}
 
-    if (i == e)
+Primary Parser::evaluate(const string &expr,
+                         std::map<std::string, Primary> &variables_table)
+{
+    auto result = try_evaluate(expr, variables_table);
+    if (!result)
     {
-        return expression(s, e, variables_table);
+        result.error().raise(expr);
     }
 
-    if (!is_valid_variable_assignment_syntax(s, e, i))
+    return result.value();
+}
+
+Primary Parser::evaluate(Token_range tokens,
+                         std::map<std::string, Primary> &variables_table)
+{
+    auto result = try_evaluate(tokens, variables_table);
+    if (!result)
     {
-        throw Syntax_error{"Not a valid assignment."};
+        result.error().raise(tokens);
     }
 
-    auto var = variables_table.find(s->name);
-    if (var == variables_table.end())
+    return result.value();
+}
+
+Evaluation_result Parser::try_evaluate(
+    std::string_view expr,
+    std::map<std::string, Primary> &variables_table)
+{
+    auto &tokens = thread_buffer();
+    tokens.start(expr);
+    return evaluate_tokens(Token_stream{tokens, limits}, unit_system,
+                           limits, variables_table);
+}
+
+Evaluation_result Parser::try_evaluate(
+    Token_range tokens,
+    std::map<std::string, Primary> &variables_table)
+{
+    return evaluate_tokens(Token_list{tokens}, unit_system, limits,
+                           variables_table);
+}
+
+Evaluation_result Parser::try_evaluate(
+    const Token_buffer &tokens,
+    std::map<std::string, Primary> &variables_table)
+{
+    return evaluate_tokens(Buffer_tokens{tokens},
+                           unit_system, limits, variables_table);
+}
+
+Primary Parser::evaluate(const string &expr, Variable_store &variables)
+{
+    auto result = try_evaluate(expr, variables);
+    if (!result)
     {
-        throw Runtime_error{"Variable not defined."};
+        result.error().raise(expr);
     }
 
-    const auto val = assignment(i + 1, e, variables_table);
-    variables_table.erase(s->name);
-    variables_table.insert({s->name, val});
-
-    return val;
+    return result.value();
 }
 
-Primary Parser::expression(const Token_iter &s, const Token_iter &e,
-                           std::map<std::string, Primary> &variables_table)
+Primary Parser::evaluate(Token_range tokens, Variable_store &variables)
 {
-    auto i = reverse_search(s, e, {'+', '-'});
-    if (i.first != s)
+    auto result = try_evaluate(tokens, variables);
+    if (!result)
     {
-        switch (i.second)
-        {
-        case '+':
-            return expression(s, i.first, variables_table) +
-                   term(i.first + 1, e, variables_table);
-        case '-':
-            return expression(s, i.first, variables_table) -
-                   term(i.first + 1, e, variables_table);
-        }
+        result.error().raise(tokens);
     }
 
-    return term(s, e, variables_table);
+    return result.value();
+}
+
+Evaluation_result Parser::try_evaluate(std::string_view expr,
+                                       Variable_store &variables)
+{
+    auto &tokens = thread_buffer();
+    tokens.start(expr);
+    return evaluate_tokens(Token_stream{tokens, limits}, unit_system,
+                           limits, variables);
+}
+
+Evaluation_result Parser::try_evaluate(Token_range tokens,
+                                       Variable_store &variables)
+{
+    return evaluate_tokens(Token_list{tokens}, unit_system, limits,
+                           variables);
+}
+
+Evaluation_result Parser::try_evaluate(const Token_buffer &tokens,
+                                       Variable_store &variables)
+{
+    return evaluate_tokens(Buffer_tokens{tokens},
+                           unit_system, limits, variables);
+}
+
+Evaluation_error Parser::check(std::string_view expr,
+                               std::map<std::string, Dimension> &dimensions)
+{
+    auto &tokens = thread_buffer();
+    tokens.start(expr);
+    return check_tokens(Token_stream{tokens, limits}, unit_system,
+                        limits, dimensions);
+}
+
+Evaluation_error Parser::check(Token_range tokens,
+                               std::map<std::string, Dimension> &dimensions)
+{
+    return check_tokens(Token_list{tokens}, unit_system, limits, dimensions);
 }
 
-Primary Parser::term(const Token_iter &s, const Token_iter &e,
-                     std::map<std::string, Primary> &variables_table)
+Evaluation_error Numeric_program::run(const vector<double> &arguments,
+                                      double &value) const
 {
-    auto i = reverse_search(s, e, {'*', '/', '%'});
-    if (i.first != s)
+    // most expressions fit without allocating
+    double small_stack[32];
+    vector<double> large_stack;
+    auto stack = small_stack;
+    if (max_stack > std::size(small_stack))
+    {
+        large_stack.resize(max_stack);
+        stack = large_stack.data();
+    }
+
+    std::size_t top = 0;
+    for (const auto &i : code)
     {
-        switch (i.second)
+        switch (i.code)
         {
-        case '*':
-            return term(s, i.first, variables_table) *
-                   exponent(i.first + 1, e, variables_table);
-        case '/':
-        case '%':
+        case Opcode::number:
+            stack[top++] = i.number;
+            break;
+        case Opcode::argument:
+            stack[top++] = arguments[i.index];
+            break;
+        case Opcode::negate:
+            stack[top - 1] = -stack[top - 1];
+            break;
+        default:
         {
-            auto divisor = exponent(i.first + 1, e, variables_table);
-            auto t = term(s, i.first, variables_table);
-
-            if (i.second == '/')
+            const auto unary = i.code == Opcode::factorial;
+            if (!unary && i.code != Opcode::power)
             {
-                return t / divisor;
+                // the left operand was evaluated last
+                std::swap(stack[top - 2], stack[top - 1]);
             }
-            else
+            auto &left = stack[top - 1 - !unary];
+            const auto right = unary ? 0 : stack[top - 1];
+            if (const auto c = check_values(i.op, left, right); !c)
             {
-                return t % divisor;
+                Evaluation_error error;
+                error.code = c.code == Primary_errc::division_by_zero
+                                 ? Evaluation_errc::division_by_zero
+                                 : Evaluation_errc::invalid_operands;
+                error.span = i.span;
+                error.token = i.token;
+                error.what = c.what;
+                return error;
             }
+
+            const auto converted = i.index == no_index
+                                       ? left
+                                       : conversions[i.index].apply(left);
+            left = compute_values(i.op, converted, right);
+            top -= !unary;
         }
         }
     }
 
-    return exponent(s, e, variables_table);
+    value = stack[0];
+    return {};
 }
 
-Primary Parser::exponent(const Token_iter &s, const Token_iter &e,
-                         std::map<std::string, Primary> &variables_table)
+Evaluation_error Parser::compile(const vector<Token> &expression,
+                                 const vector<string> &parameters,
+                                 Numeric_program &program)
 {
-    switch (s->op)
+    using Numeric_opcode = Numeric_program::Opcode;
+
+    const Token_list tokens{expression};
+
+    program = Numeric_program{};
+    if (tokens.size() == 0)
     {
-    case '-':
-        return -exponent(s + 1, e, variables_table);
-    case '+':
-        return +exponent(s + 1, e, variables_table);
+        return error_at(tokens, tokens.size(), Evaluation_errc::syntax_error,
+                        "Empty expression.");
     }
-
-    auto exp_pos = find_forward(s, e, '^');
-    if (exp_pos != e)
+    if (const auto why = check_size(tokens, limits))
     {
-        auto base = primary(s, exp_pos, variables_table);
-        auto exp = exponent(exp_pos + 1, e, variables_table);
-
-        return base ^ exp;
+        return error_at(tokens, 0,
+                        Evaluation_errc::limit_exceeded, why);
     }
 
-    return primary(s, e, variables_table);
-}
-
-Primary Parser::primary(const Token_iter &s, const Token_iter &e,
-                        std::map<std::string, Primary> &variables_table)
-{
-    if ((e - 1)->op == '!')
+    // assignments and declarations change variables as they are evaluated
+    for (std::size_t t = 0; t < tokens.size(); ++t)
     {
-        if (s == (e - 1))
+        if (tokens.kind(t) == Token_type::operator_type && tokens.op(t) == '=')
         {
-            throw Syntax_error{"Argument for '!' not provided."};
+            return {};
         }
-
-        auto arg = primary(s, e - 1, variables_table);
-        return arg.factorial();
+    }
+    if (is_variable_declaration(tokens))
+    {
+        return {};
     }
 
-    /**
-     * A primary followed by a unit.
-     */
-    if ((e - 1)->kind == Token_type::identifier && s != (e - 1))
+    Evaluation_budget budget{limits};
+    Program instructions;
+    const set<string> names(parameters.begin(), parameters.end());
+    const auto error = ::compile(tokens, 0, true, names, budget,
+                                 instructions);
+    if (error.code == Evaluation_errc::limit_exceeded ||
+        (limits.max_steps > 0 &&
+         tokens.size() + instructions.size() > limits.max_steps))
+    {
+        // evaluating reports it
+        return {};
+    }
+    if (error.code != Evaluation_errc::none)
     {
-        return Primary(primary(s, e - 1, variables_table).get_value(),
-                       unit_system, (e - 1)->name);
+        return error;
     }
 
-    if (s->kind == Token_type::number || s->kind == Token_type::identifier)
+    // binding a parameter twice leaves the last argument
+    map<string, std::uint32_t> argument_of;
+    for (std::size_t n = 0; n < parameters.size(); ++n)
     {
-        /**
-         * A primary that is a number, should only be a number. It can't be
-         * followed by anything else.
-         */
-        if ((s + 1) != e)
+        argument_of[parameters[n]] = static_cast<std::uint32_t>(n);
+    }
+    for (const auto &i : instructions)
+    {
+        if (i.code == Opcode::variable &&
+            argument_of.find(tokens.name(i.token)) == argument_of.end())
         {
-            throw Syntax_error{"Only a primary was expected."};
+            return {};
         }
+    }
+
+    Numeric_program compiled;
+    vector<Dimension> units;
+    for (const auto &i : instructions)
+    {
+        const auto t = i.token;
+        const auto emit = [&compiled, t, &tokens](Numeric_opcode code,
+                                                  std::uint32_t index,
+                                                  double number)
+        {
+            const auto offset = tokens.offset(t);
+            compiled.code.push_back({code, tokens.op(t), index, number,
+                                     static_cast<std::uint32_t>(t),
+                                     {offset, offset + tokens.length(t)}});
+        };
 
-        if (s->kind == Token_type::identifier)
+        switch (i.code)
         {
-            auto var = variables_table.find(s->name);
-            if (var == variables_table.end())
+        case Opcode::number:
+            units.emplace_back();
+            emit(Numeric_opcode::number, Numeric_program::no_index,
+                 tokens.val(i.token));
+            break;
+        case Opcode::variable:
+            units.emplace_back();
+            emit(Numeric_opcode::argument,
+                 argument_of[tokens.name(i.token)], 0);
+            break;
+        case Opcode::unit:
+            if (!unit_system.has_unit(tokens.name(i.token)))
             {
-                throw Runtime_error{"Variable not found."};
+                return error_at(tokens, t, Evaluation_errc::unknown_unit,
+                                "Not a known unit.");
+            }
+            units.back() = Dimension{unit_system, tokens.name(i.token)};
+            break;
+        case Opcode::factorial:
+            units.back() = Dimension{};
+            emit(Numeric_opcode::factorial, Numeric_program::no_index, 0);
+            break;
+        case Opcode::negate:
+            emit(Numeric_opcode::negate, Numeric_program::no_index, 0);
+            break;
+        case Opcode::affirm:
+        case Opcode::assign:
+            break;
+        default:
+        {
+            auto right = std::move(units.back());
+            units.pop_back();
+            if (right_operand_first(i.code))
+            {
+                std::swap(right, units.back());
+            }
+            auto &left = units.back();
+            const auto op = tokens.op(i.token);
+            if (const auto c = left.check(op, right); !c)
+            {
+                return error_at(tokens, t, Evaluation_errc::incompatible_units,
+                                c.what);
             }
 
-            return var->second;
-        }
-
-        return Primary(s->val, unit_system);
-    }
+            auto index = Numeric_program::no_index;
+            auto conversion = left.conversion(op, right, unit_system);
+            if (!conversion.is_identity())
+            {
+                index = static_cast<std::uint32_t>(
+                    compiled.conversions.size());
+                compiled.conversions.push_back(std::move(conversion));
+            }
+            left = left.combine(op, right);
 
-    if (s->op == '(')
-    {
-        if ((e - 1)->op != ')')
-        {
-            throw Syntax_error{"Missing ')'."};
+            switch (i.code)
+            {
+            case Opcode::add:
+                emit(Numeric_opcode::add, index, 0);
+                break;
+            case Opcode::subtract:
+                emit(Numeric_opcode::subtract, index, 0);
+                break;
+            case Opcode::multiply:
+                emit(Numeric_opcode::multiply, index, 0);
+                break;
+            case Opcode::divide:
+                emit(Numeric_opcode::divide, index, 0);
+                break;
+            case Opcode::modulo:
+                emit(Numeric_opcode::modulo, index, 0);
+                break;
+            default:
+                emit(Numeric_opcode::power, index, 0);
+                break;
+            }
         }
-
-        return assignment(s + 1, e - 1, variables_table);
+        }
+        compiled.max_stack = std::max(compiled.max_stack, units.size());
     }
 
-    throw Syntax_error{"Primary expected."};
+    compiled.result_units = units.back().get_units();
+    program = std::move(compiled);
+    return {};
 }
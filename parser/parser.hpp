@@ -5,16 +5,220 @@
 /**
  * This library provides:
  * - The Parser UDT to evaluate calculator expressions
+ * - The Evaluation_limits UDT to bound the work of an evaluation
+ * - The Evaluation_result and Evaluation_error UDTs, returned by
+ *   Parser::try_evaluate() instead of throwing
+ * - The Numeric_program UDT, an expression compiled by Parser::compile() to
+ *   run on bare numbers
  */
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 
+#include "parser/variable_store.hpp"
 #include "primary/primary.hpp"
 #include "token/token.hpp"
 
-using Token_iter = std::vector<Token>::const_iterator;
+/**
+ * Bounds on a single evaluation, so that pathological input can't tie up
+ * its caller. A bound of 0 means no bound. Going over a bound throws a
+ * Limit_exceeded (or is an Evaluation_errc::limit_exceeded error).
+ */
+struct Evaluation_limits
+{
+    std::size_t max_tokens = 0;
+    // nesting of parentheses
+    std::size_t max_depth = 0;
+    // tokens parsed plus operations performed
+    std::size_t max_steps = 0;
+    // wall-clock time, checked every few steps
+    std::chrono::microseconds max_time{0};
+};
+
+/**
+ * The kinds of errors evaluating an expression can run into. Each matches an
+ * exception thrown by Parser::evaluate().
+ */
+enum class Evaluation_errc
+{
+    none,
+    unknown_token,
+    bad_number,
+    syntax_error,
+    runtime_error,
+    limit_exceeded,
+    incompatible_units,
+    unknown_unit,
+    division_by_zero,
+    invalid_operands,
+};
+
+/**
+ * The characters [begin:end) of an expression.
+ */
+struct Source_span
+{
+    std::size_t begin = 0;
+    std::size_t end = 0;
+};
+
+/**
+ * Why an evaluation failed. Making one allocates nothing: what is a fixed
+ * description, and full messages are only formatted when asked for.
+ */
+struct Evaluation_error
+{
+    Evaluation_errc code = Evaluation_errc::none;
+    // the offending token, or an empty span at the end of the expression
+    // if it ended too early
+    Source_span span;
+    // the index of the offending token, or the number of tokens
+    std::size_t token = 0;
+    const char *what = "";
+
+    /**
+     * The message evaluate() would throw with. source is the expression,
+     * from which unknown units are named.
+     */
+    std::string message(std::string_view source) const;
+
+    /**
+     * The same, naming unknown units from the tokens of the expression.
+     */
+    std::string message(Token_range tokens) const;
+
+    /**
+     * Throw the exception evaluate() would throw for tokens.
+     */
+    [[noreturn]] void raise(Token_range tokens) const;
+
+    /**
+     * The same, for the expression source.
+     */
+    [[noreturn]] void raise(std::string_view source) const;
+};
+
+/**
+ * What Parser::try_evaluate() returns: a value or an Evaluation_error.
+ */
+class Evaluation_result
+{
+public:
+    Evaluation_result(const Primary &value)
+        : result{value}
+    {
+    }
+
+    Evaluation_result(const Evaluation_error &error)
+        : failure{error}
+    {
+    }
+
+    bool has_value() const
+    {
+        return result.has_value();
+    }
+
+    explicit operator bool() const
+    {
+        return has_value();
+    }
+
+    /**
+     * Only meaningful if has_value().
+     */
+    const Primary &value() const
+    {
+        return *result;
+    }
+
+    const Evaluation_error &error() const
+    {
+        return failure;
+    }
+
+private:
+    std::optional<Primary> result;
+    Evaluation_error failure;
+};
+
+/**
+ * An expression whose parameters are unitless numbers and whose units were
+ * all worked out by Parser::compile(). It runs on bare doubles: every
+ * conversion between units was looked up when it was compiled, and only the
+ * result has units. Results are those of Parser::evaluate(), bit for bit.
+ */
+class Numeric_program
+{
+public:
+    /**
+     * Is there a program? Parser::compile() leaves it empty for
+     * expressions that have to be evaluated with their variables.
+     */
+    explicit operator bool() const
+    {
+        return !code.empty();
+    }
+
+    /**
+     * Evaluate with arguments, one per parameter, and store the result in
+     * value. Return the error if one depends on the values, such as division
+     * by zero.
+     */
+    Evaluation_error run(const std::vector<double> &arguments,
+                         double &value) const;
+
+    /**
+     * The units of the result, as Primary::get_units() gives them.
+     */
+    const std::string &units() const
+    {
+        return result_units;
+    }
+
+private:
+    friend class Parser;
+
+    enum class Opcode : std::uint8_t
+    {
+        number,   // push number
+        argument, // push the argument at index
+        negate,
+        factorial,
+        add,
+        subtract,
+        multiply,
+        divide,
+        modulo,
+        power,
+    };
+
+    struct Instruction
+    {
+        Opcode code;
+        // the operator, for check_values() and compute_values()
+        char op;
+        // the argument, or the conversion of a left operand if not no_index
+        std::uint32_t index;
+        double number;
+        // where errors are reported
+        std::uint32_t token;
+        Source_span span;
+    };
+
+    static constexpr std::uint32_t no_index = UINT32_MAX;
+
+    std::vector<Instruction> code;
+    std::vector<Unit_conversion> conversions;
+    std::size_t max_stack = 0;
+    std::string result_units;
+};
 
 /**
  * The Parser class provides an evaluate method that evaluates a given
@@ -70,6 +274,18 @@ using Token_iter = std::vector<Token>::const_iterator;
  *
  * Additionally, the associativity of ^ is from left-to-right. That's why, it's
  * Primary ^ Exponent instead of Exponent ^ Primary.
+ *
+ * -- How is it evaluated? --
+ *
+ * An expression is first translated, in one pass over its tokens, into
+ * instructions for a stack machine, and the instructions are then run. Both
+ * steps keep their stacks on the heap, so nesting is only limited by memory
+ * and time is linear in the number of tokens. All syntax errors are found
+ * before anything is evaluated. The right operand of a binary operator is
+ * evaluated before its left one, except for ^: with b = 4, "b - (b = 1)"
+ * is 0 and "b ^ (b = 1)" is 4.
+ * Instructions that use no variables and no units, which is most of them,
+ * are run on bare doubles with the same rules as Primary.
  */
 class Parser
 {
@@ -82,26 +298,116 @@ public:
     Primary evaluate(const std::string &expr,
                      std::map<std::string, Primary> &variables_table);
 
+    /**
+     * Evaluate an expression that has already been broken into tokens. This
+     * lets callers run tokenize() somewhere else, e.g., on another thread,
+     * or tokenize many lines at once with tokenize_batch().
+     */
+    Primary evaluate(Token_range tokens)
+    {
+        return evaluate(tokens, variables_table);
+    }
+
+    Primary evaluate(Token_range tokens,
+                     std::map<std::string, Primary> &variables_table);
+
+    /**
+     * Like evaluate(), but return errors instead of throwing them, which is
+     * much cheaper when many expressions are invalid. evaluate() wraps
+     * these.
+     */
+    Evaluation_result try_evaluate(std::string_view expr)
+    {
+        return try_evaluate(expr, variables_table);
+    }
+
+    Evaluation_result try_evaluate(
+        std::string_view expr,
+        std::map<std::string, Primary> &variables_table);
+
+    Evaluation_result try_evaluate(Token_range tokens)
+    {
+        return try_evaluate(tokens, variables_table);
+    }
+
+    Evaluation_result try_evaluate(
+        Token_range tokens,
+        std::map<std::string, Primary> &variables_table);
+
+    /**
+     * The same for tokens in a Token_buffer. Expressions given as text are
+     * tokenized into a buffer that each thread reuses.
+     */
+    Evaluation_result try_evaluate(const Token_buffer &tokens)
+    {
+        return try_evaluate(tokens, variables_table);
+    }
+
+    Evaluation_result try_evaluate(
+        const Token_buffer &tokens,
+        std::map<std::string, Primary> &variables_table);
+
+    /**
+     * The same against a Variable_store, for sessions with too many
+     * variables to keep in a map.
+     */
+    Primary evaluate(const std::string &expr, Variable_store &variables);
+    Primary evaluate(Token_range tokens, Variable_store &variables);
+    Evaluation_result try_evaluate(std::string_view expr,
+                                   Variable_store &variables);
+    Evaluation_result try_evaluate(Token_range tokens,
+                                   Variable_store &variables);
+    Evaluation_result try_evaluate(const Token_buffer &tokens,
+                                   Variable_store &variables);
+
+    /**
+     * Check an expression without evaluating it: its syntax, that its
+     * variables are declared and that its units are consistent. dimensions
+     * holds the units of the variables declared so far, and declarations
+     * and assignments update it. Return an error with code
+     * Evaluation_errc::none if nothing is wrong.
+     *
+     * Errors that depend on values, such as division by zero, aren't found.
+     */
+    Evaluation_error check(std::string_view expr,
+                           std::map<std::string, Dimension> &dimensions);
+
+    Evaluation_error check(Token_range tokens,
+                           std::map<std::string, Dimension> &dimensions);
+
+    /**
+     * Compile tokens into program, to be run with its parameters bound to
+     * unitless numbers in order. Every error that doesn't depend on the
+     * values, such as a syntax error or incompatible units, is returned
+     * here rather than on every run.
+     *
+     * Units can only be worked out ahead of time if the expression uses no
+     * variables other than parameters and assigns or declares none. Other
+     * expressions leave program empty and are evaluated as usual, with the
+     * parameters bound as variables.
+     */
+    Evaluation_error compile(const std::vector<Token> &tokens,
+                             const std::vector<std::string> &parameters,
+                             Numeric_program &program);
+
+    /**
+     * The variables used by the overloads of evaluate() without a table.
+     */
+    Variable_store &variables()
+    {
+        return variables_table;
+    }
+
     // the keyword used to introduce a new variable
     inline static const std::string var_declaration_key = "let";
 
     Unit_system unit_system;
 
+    // apply to every call of evaluate()
+    Evaluation_limits limits;
+
 private:
-    std::map<std::string, Primary> variables_table;
-
-    Primary variable_declaration(const Token_iter &s, const Token_iter &e,
-                                 std::map<std::string, Primary> &variables_table);
-    Primary assignment(const Token_iter &s, const Token_iter &e,
-                       std::map<std::string, Primary> &variables_table);
-    Primary expression(const Token_iter &s, const Token_iter &e,
-                       std::map<std::string, Primary> &variables_table);
-    Primary term(const Token_iter &s, const Token_iter &e,
-                 std::map<std::string, Primary> &variables_table);
-    Primary exponent(const Token_iter &s, const Token_iter &e,
-                     std::map<std::string, Primary> &variables_table);
-    Primary primary(const Token_iter &s, const Token_iter &e,
-                    std::map<std::string, Primary> &variables_table);
+    Variable_store variables_table;
 };
 
 #endif
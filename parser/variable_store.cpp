@@ -0,0 +1,168 @@
+#include <functional>
+#include <stdexcept>
+
+#include "variable_store.hpp"
+
+using std::optional;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+
+namespace
+{
+    // slots are at most this full, so that probes stay short
+    constexpr size_t max_load_numerator = 3;
+    constexpr size_t max_load_denominator = 4;
+    constexpr size_t min_slots = 16;
+
+    size_t hash_of(string_view name)
+    {
+        return std::hash<string_view>{}(name);
+    }
+
+    /**
+     * The number of slots that holds n variables.
+     */
+    size_t slots_for(size_t n)
+    {
+        auto slots = min_slots;
+        while (slots * max_load_numerator < n * max_load_denominator)
+        {
+            slots *= 2;
+        }
+        return slots;
+    }
+}
+
+Variable_store::Variable_store()
+    : offsets{0}, slots(min_slots)
+{
+}
+
+optional<Primary> Variable_store::get(string_view name) const
+{
+    const auto v = find(name);
+    if (v == no_variable)
+    {
+        return std::nullopt;
+    }
+
+    return unit_values[units[v]].with_value(values[v]);
+}
+
+void Variable_store::set(string_view name, const Primary &value)
+{
+    if (const auto v = find(name); v != no_variable)
+    {
+        values[v] = value.get_value();
+        units[v] = unit_of(value, units[v]);
+        return;
+    }
+
+    if (values.size() >= no_variable - 1 ||
+        names.size() + name.size() >= UINT32_MAX)
+    {
+        throw std::length_error{"Too many variables."};
+    }
+    if (slots.size() * max_load_numerator <
+        (values.size() + 1) * max_load_denominator)
+    {
+        rehash(values.size() + 1);
+    }
+
+    const auto unit = unit_of(value, last_unit);
+    const auto v = static_cast<uint32_t>(values.size());
+    values.push_back(value.get_value());
+    units.push_back(unit);
+    names.append(name);
+    offsets.push_back(static_cast<uint32_t>(names.size()));
+
+    const auto mask = slots.size() - 1;
+    for (auto s = hash_of(name) & mask;; s = (s + 1) & mask)
+    {
+        if (slots[s] == 0)
+        {
+            slots[s] = v + 1;
+            return;
+        }
+    }
+}
+
+void Variable_store::reserve(size_t n, size_t name_bytes)
+{
+    values.reserve(n);
+    units.reserve(n);
+    offsets.reserve(n + 1);
+    names.reserve(name_bytes);
+    if (slots_for(n) > slots.size())
+    {
+        rehash(n);
+    }
+}
+
+size_t Variable_store::memory_used() const
+{
+    return values.capacity() * sizeof(double) +
+           units.capacity() * sizeof(uint32_t) + names.capacity() +
+           offsets.capacity() * sizeof(uint32_t) +
+           slots.capacity() * sizeof(uint32_t);
+}
+
+uint32_t Variable_store::find(string_view name) const
+{
+    const auto mask = slots.size() - 1;
+    for (auto s = hash_of(name) & mask;; s = (s + 1) & mask)
+    {
+        if (slots[s] == 0)
+        {
+            return no_variable;
+        }
+        if (this->name(slots[s] - 1) == name)
+        {
+            return slots[s] - 1;
+        }
+    }
+}
+
+uint32_t Variable_store::unit_of(const Primary &value, uint32_t likely)
+{
+    for (const auto unit : {likely, last_unit})
+    {
+        if (unit < unit_values.size() &&
+            value.has_units_of(unit_values[unit]))
+        {
+            last_unit = unit;
+            return unit;
+        }
+    }
+
+    auto units = value.get_units();
+    const auto it = unit_numbers.find(units);
+    if (it != unit_numbers.end())
+    {
+        last_unit = it->second;
+        return it->second;
+    }
+
+    const auto unit = static_cast<uint32_t>(unit_values.size());
+    unit_values.push_back(value.with_value(0));
+    unit_numbers.emplace(std::move(units), unit);
+    last_unit = unit;
+    return unit;
+}
+
+void Variable_store::rehash(size_t capacity)
+{
+    slots.assign(slots_for(capacity), 0);
+    const auto mask = slots.size() - 1;
+    for (uint32_t v = 0; v < values.size(); ++v)
+    {
+        auto s = hash_of(name(v)) & mask;
+        while (slots[s] != 0)
+        {
+            s = (s + 1) & mask;
+        }
+        slots[s] = v + 1;
+    }
+}
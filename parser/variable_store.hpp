@@ -0,0 +1,129 @@
+#ifndef A2100_PCALC_VARIABLE_STORE
+#define A2100_PCALC_VARIABLE_STORE 1
+#pragma once
+
+/**
+ * This library provides the Variable_store UDT, a variables table for
+ * sessions with very many variables.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "primary/primary.hpp"
+
+/**
+ * Variables by name, like a std::map<std::string, Primary> but a small
+ * fraction of its size: a map spends a node, a string and a Primary with
+ * two maps of its own on each variable.
+ *
+ * Instead, the names are interned end to end in one string, the values are
+ * kept in an array of doubles, and the units are numbered, each distinct
+ * units being stored once as a Primary to copy from. Names are found
+ * through an open-addressing hash table of variable numbers. Apart from
+ * the characters of its name, a variable takes 16 bytes plus 5 to 11 bytes
+ * of hash table.
+ *
+ * Variables can't be removed. A Primary read back out has the unit system
+ * of the first Primary stored with the same units, so all the values of a
+ * store should share one unit system.
+ */
+class Variable_store
+{
+public:
+    Variable_store();
+
+    std::size_t size() const
+    {
+        return values.size();
+    }
+
+    bool empty() const
+    {
+        return values.empty();
+    }
+
+    bool contains(std::string_view name) const
+    {
+        return find(name) != no_variable;
+    }
+
+    /**
+     * The value of name, if it's a variable.
+     */
+    std::optional<Primary> get(std::string_view name) const;
+
+    /**
+     * Make value the value of name, adding name if it's new.
+     */
+    void set(std::string_view name, const Primary &value);
+
+    /**
+     * Make room for n variables in all, with names of name_bytes characters
+     * in all, so that loading that many doesn't grow the arrays as it goes.
+     */
+    void reserve(std::size_t n, std::size_t name_bytes = 0);
+
+    /**
+     * The bytes taken by the arrays of the store, not counting the Primaries
+     * kept for distinct units.
+     */
+    std::size_t memory_used() const;
+
+    /**
+     * The bytes of memory_used() reserved for the characters of names.
+     */
+    std::size_t name_capacity() const
+    {
+        return names.capacity();
+    }
+
+private:
+    static constexpr std::uint32_t no_variable = UINT32_MAX;
+
+    std::string_view name(std::uint32_t v) const
+    {
+        return std::string_view{names}.substr(
+            offsets[v], offsets[v + 1] - offsets[v]);
+    }
+
+    /**
+     * The number of the variable called name, or no_variable.
+     */
+    std::uint32_t find(std::string_view name) const;
+
+    /**
+     * The number of the units of value, numbering them if they're new.
+     * likely and the last units stored are checked first, without
+     * formatting the units of value.
+     */
+    std::uint32_t unit_of(const Primary &value, std::uint32_t likely);
+
+    /**
+     * Rebuild slots with room for capacity variables.
+     */
+    void rehash(std::size_t capacity);
+
+    std::vector<double> values;
+    std::vector<std::uint32_t> units;
+    // variable v is called names[offsets[v]:offsets[v + 1])
+    std::string names;
+    std::vector<std::uint32_t> offsets;
+
+    // a power of two in length; each holds a variable number plus one, or
+    // 0 if it's empty
+    std::vector<std::uint32_t> slots;
+
+    // what unit numbers stand for, by Primary::get_units()
+    std::vector<Primary> unit_values;
+    std::unordered_map<std::string, std::uint32_t> unit_numbers;
+    // the units of the last value stored, which the next one usually shares
+    std::uint32_t last_unit = 0;
+};
+
+#endif
@@ -12,13 +12,121 @@
 using namespace std::string_literals;
 
 using boost::uuids::random_generator;
-using std::find_if;
 using std::fmod;
 using std::less;
 using std::ostream;
 using std::string;
 using std::tgamma;
 
+namespace
+{
+    /**
+     * Throw the exception for an operation that failed c.
+     */
+    void raise_if_failed(const Primary_check &c)
+    {
+        switch (c.code)
+        {
+        case Primary_errc::none:
+            return;
+        case Primary_errc::incompatible_units:
+            throw Incompatible_units{c.what};
+        case Primary_errc::division_by_zero:
+            throw Division_by_zero{c.what};
+        case Primary_errc::invalid_operands:
+            throw Invalid_operands{c.what};
+        }
+    }
+
+    /**
+     * Can units (n1 / d1) op units (n2 / d2) be computed? Only +, - and %
+     * need both sides to measure the same quantities.
+     */
+    Primary_check check_compatible(
+        char op,
+        const std::map<Unit_type, std::pair<string, size_t>> &n1,
+        const std::map<Unit_type, std::pair<string, size_t>> &d1,
+        const std::map<Unit_type, std::pair<string, size_t>> &n2,
+        const std::map<Unit_type, std::pair<string, size_t>> &d2)
+    {
+        if ((op != '+' && op != '-' && op != '%') ||
+            (addition_compatible(n1, n2) && addition_compatible(d1, d2)))
+        {
+            return {};
+        }
+
+        switch (op)
+        {
+        case '+':
+            return {Primary_errc::incompatible_units,
+                    "Primaries measuring different quantities can't be added."};
+        case '-':
+            return {Primary_errc::incompatible_units,
+                    "Primaries measuring different quantities can't be subtracted."};
+        default:
+            return {Primary_errc::incompatible_units,
+                    "Primaries measuring different quantities can't be operated on by mod."};
+        }
+    }
+}
+
+Primary_check check_values(char op, double left, double right)
+{
+    switch (op)
+    {
+    case '/':
+        if (right == 0)
+        {
+            return {Primary_errc::division_by_zero,
+                    "Division by 0 is not allowed."};
+        }
+        break;
+    case '%':
+        if (right == 0)
+        {
+            return {Primary_errc::division_by_zero, "Can't take mod with 0."};
+        }
+        break;
+    case '^':
+        if (const auto error = power_error(left, right))
+        {
+            return {Primary_errc::invalid_operands, error};
+        }
+        break;
+    case '!':
+        if (left < 0)
+        {
+            return {Primary_errc::invalid_operands,
+                    "Factorial is not defined for negative values."};
+        }
+        break;
+    }
+
+    return {};
+}
+
+double compute_values(char op, double left, double right)
+{
+    switch (op)
+    {
+    case '+':
+        return left + right;
+    case '-':
+        return left - right;
+    case '*':
+        return left * right;
+    case '/':
+        // as Primary does it: multiplying by the inverse
+        return left * (1.0 / right);
+    case '%':
+        return fmod(left, right);
+    case '^':
+        return power(left, right);
+    default:
+        return tgamma(left + 1);
+    }
+}
+
 Unit_system::Unit_system()
     : tag(random_generator()())
 {
@@ -37,16 +145,14 @@ void Unit_system::add_new_unit(const Unit_information &new_unit_info)
 double Unit_system::convert(double v, const string &from, const string &to)
     const
 {
-    const auto from_iter = find_if(units.begin(), units.end(), [&from](const auto &e)
-                                   { return e.name == from; });
-    if (from_iter == units.end())
+    const auto from_iter = find(from);
+    if (!from_iter)
     {
         throw Unknown_unit(from + " is not a known unit.");
     }
 
-    const auto to_iter = find_if(units.begin(), units.end(), [&to](const auto &e)
-                                 { return e.name == to; });
-    if (to_iter == units.end())
+    const auto to_iter = find(to);
+    if (!to_iter)
     {
         throw Unknown_unit(to + " is not a known unit.");
     }
@@ -64,9 +170,8 @@ double Unit_system::convert(double v, const string &from, const string &to)
 
 Unit_type Unit_system::get_base(const string &unit) const
 {
-    const auto unit_iter = find_if(units.begin(), units.end(), [&unit](const auto &u)
-                                   { return u.name == unit; });
-    if (unit_iter == units.end())
+    const auto unit_iter = find(unit);
+    if (!unit_iter)
     {
         throw Unknown_unit(unit + " is not a known unit.");
     }
@@ -74,6 +179,17 @@ Unit_type Unit_system::get_base(const string &unit) const
     return unit_iter->base;
 }
 
+bool Unit_system::has_unit(const string &unit) const
+{
+    return find(unit) != nullptr;
+}
+
+const Unit_information *Unit_system::find(const string &unit) const
+{
+    const auto u = units.find(unit);
+    return u == units.end() ? nullptr : &*u;
+}
+
 bool Unit_system::operator==(const Unit_system &other) const
 {
     return this->tag == other.tag;
@@ -120,21 +236,96 @@ double Primary::get_value() const
     return value;
 }
 
-Primary Primary::operator+(const Primary &other) const
+Primary Primary::with_value(double v) const
+{
+    auto p = *this;
+    p.value = v;
+    return p;
+}
+
+bool Primary::has_units_of(const Primary &other) const
+{
+    return numerator_units == other.numerator_units &&
+           denominator_units == other.denominator_units;
+}
+
+string Primary::get_units() const
+{
+    const auto nunits = units_to_str(numerator_units);
+    const auto dunits = units_to_str(denominator_units);
+
+    if (dunits.size() == 0)
+    {
+        return nunits;
+    }
+
+    if (nunits.size() == 0)
+    {
+        return "/" + dunits;
+    }
+
+    return nunits + " / " + dunits;
+}
+
+Primary_check Primary::check(char op, const Primary &other) const
 {
     if (unit_system != other.unit_system)
     {
-        throw Incompatible_units{
-            "Primaries of different unit systems can't be added."};
+        switch (op)
+        {
+        case '+':
+            return {Primary_errc::incompatible_units,
+                    "Primaries of different unit systems can't be added."};
+        case '-':
+            return {Primary_errc::incompatible_units,
+                    "Primaries of different unit systems can't be subtracted."};
+        case '%':
+            return {Primary_errc::incompatible_units,
+                    "Primaries of different unit systems can't be operated on by mod."};
+        case '^':
+            return {Primary_errc::incompatible_units,
+                    "Primaries of different unit systems can't be operated on by exponentiation."};
+        default:
+            return {Primary_errc::incompatible_units,
+                    "Primaries of different unit systems can't be multiplied."};
+        }
+    }
+
+    // division by zero is found before incompatible units
+    if (op == '/' || op == '%')
+    {
+        if (const auto c = check_values(op, value, other.value); !c)
+        {
+            return c;
+        }
     }
 
-    if (!addition_compatible(numerator_units, other.numerator_units) ||
-        !addition_compatible(denominator_units, other.denominator_units))
+    if (const auto c = check_compatible(op, numerator_units,
+                                        denominator_units,
+                                        other.numerator_units,
+                                        other.denominator_units);
+        !c)
     {
-        throw Incompatible_units{
-            "Primaries measuring different quantities can't be added."};
+        return c;
     }
 
+    if (op == '^')
+    {
+        return check_values(op, value, other.value);
+    }
+
+    return {};
+}
+
+Primary_check Primary::check_factorial() const
+{
+    return check_values('!', value, 0);
+}
+
+Primary Primary::operator+(const Primary &other) const
+{
+    raise_if_failed(check('+', other));
+
     const auto nval = compound_convert(value, unit_system,
                                        numerator_units, other.numerator_units);
     const auto dval = compound_convert(1.0, unit_system,
@@ -148,18 +339,7 @@ Primary Primary::operator+(const Primary &other) const
 
 Primary Primary::operator-(const Primary &other) const
 {
-    if (unit_system != other.unit_system)
-    {
-        throw Incompatible_units{
-            "Primaries of different unit systems can't be subtracted."};
-    }
-
-    if (!addition_compatible(numerator_units, other.numerator_units) ||
-        !addition_compatible(denominator_units, other.denominator_units))
-    {
-        throw Incompatible_units{
-            "Primaries measuring different quantities can't be subtracted."};
-    }
+    raise_if_failed(check('-', other));
 
     const auto nval = compound_convert(value, unit_system,
                                        numerator_units, other.numerator_units);
@@ -174,11 +354,7 @@ Primary Primary::operator-(const Primary &other) const
 
 Primary Primary::operator*(const Primary &other) const
 {
-    if (unit_system != other.unit_system)
-    {
-        throw Incompatible_units{
-            "Primaries of different unit systems can't be multiplied."};
-    }
+    raise_if_failed(check('*', other));
 
     const auto units_of_other = get_combined_units(other.numerator_units,
                                                    other.denominator_units);
@@ -210,16 +386,7 @@ Primary Primary::operator*(const Primary &other) const
 
 Primary Primary::operator/(const Primary &other) const
 {
-    if (unit_system != other.unit_system)
-    {
-        throw Incompatible_units{
-            "Primaries of different unit systems can't be multiplied."};
-    }
-
-    if (other.get_value() == 0)
-    {
-        throw Division_by_zero{"Division by 0 is not allowed."};
-    }
+    raise_if_failed(check('/', other));
 
     return (*this) * Primary(1.0 / other.get_value(), unit_system,
                              to_units_list(other.denominator_units),
@@ -228,23 +395,7 @@ Primary Primary::operator/(const Primary &other) const
 
 Primary Primary::operator%(const Primary &other) const
 {
-    if (unit_system != other.unit_system)
-    {
-        throw Incompatible_units{
-            "Primaries of different unit systems can't be operated on by mod."};
-    }
-
-    if (other.get_value() == 0)
-    {
-        throw Division_by_zero{"Can't take mod with 0."};
-    }
-
-    if (!addition_compatible(numerator_units, other.numerator_units) ||
-        !addition_compatible(denominator_units, other.denominator_units))
-    {
-        throw Incompatible_units{
-            "Primaries measuring different quantities can't be operated on by mod."};
-    }
+    raise_if_failed(check('%', other));
 
     const auto nval = compound_convert(value, unit_system,
                                        numerator_units, other.numerator_units);
@@ -259,24 +410,17 @@ Primary Primary::operator%(const Primary &other) const
 
 Primary Primary::operator^(const Primary &other) const
 {
-    if (unit_system != other.unit_system)
-    {
-        throw Incompatible_units{
-            "Primaries of different unit systems can't be operated on by exponentiation."};
-    }
+    raise_if_failed(check('^', other));
 
-    return Primary(power(get_value(), other.get_value()), unit_system);
+    return Primary(compute_values('^', get_value(), other.get_value()),
+                   unit_system);
 }
 
 Primary Primary::factorial() const
 {
-    if (value < 0)
-    {
-        throw Invalid_operands{
-            "Factorial is not defined for negative values."};
-    }
+    raise_if_failed(check_factorial());
 
-    return Primary(tgamma(get_value() + 1), unit_system);
+    return Primary(compute_values('!', get_value(), 0), unit_system);
 }
 
 Primary Primary::operator+() const
@@ -313,3 +457,125 @@ ostream &operator<<(ostream &out, const Primary &self)
 
     return out << self.get_value() << " " << nunits << " / " << dunits;
 }
+
+Dimension::Dimension(const Unit_system &system, const string &unit)
+{
+    numerator_units[system.get_base(unit)] = {unit, 1};
+}
+
+Dimension::Dimension(const Primary &p)
+    : numerator_units{p.numerator_units},
+      denominator_units{p.denominator_units}
+{
+}
+
+Primary_check Dimension::check(char op, const Dimension &other) const
+{
+    return check_compatible(op, numerator_units, denominator_units,
+                            other.numerator_units, other.denominator_units);
+}
+
+Dimension Dimension::combine(char op, const Dimension &other) const
+{
+    switch (op)
+    {
+    case '+':
+    case '-':
+    case '%':
+        // converted to the units of other
+        return other;
+    case '*':
+    {
+        const auto new_numerator_units = units_union(numerator_units,
+                                                     other.numerator_units);
+        const auto new_denominator_units = units_union(denominator_units,
+                                                       other.denominator_units);
+
+        Dimension d;
+        d.numerator_units = units_difference(new_numerator_units,
+                                             new_denominator_units);
+        d.denominator_units = units_difference(new_denominator_units,
+                                               new_numerator_units);
+        return d;
+    }
+    case '/':
+    {
+        Dimension inverse;
+        inverse.numerator_units = other.denominator_units;
+        inverse.denominator_units = other.numerator_units;
+        return combine('*', inverse);
+    }
+    default:
+        // powers have no units
+        return {};
+    }
+}
+
+Unit_conversion Dimension::conversion(char op, const Dimension &other,
+                                      const Unit_system &system) const
+{
+    Unit_conversion c;
+    if (op == '^')
+    {
+        return c;
+    }
+    if (op == '/')
+    {
+        Dimension inverse;
+        inverse.numerator_units = other.denominator_units;
+        inverse.denominator_units = other.numerator_units;
+        return conversion('*', inverse, system);
+    }
+
+    auto n_to_units = other.numerator_units;
+    auto d_to_units = other.denominator_units;
+    if (op == '*')
+    {
+        const auto units_of_other = get_combined_units(
+            other.numerator_units, other.denominator_units);
+        n_to_units = fill_units(units_of_other, numerator_units);
+        d_to_units = fill_units(units_of_other, denominator_units);
+    }
+
+    // the steps of compound_convert()
+    const auto unit = [&system](const string &name)
+    {
+        return *system.find(name);
+    };
+    for (const auto &[base, unit_desc] : numerator_units)
+    {
+        const auto &from = unit(unit_desc.first);
+        const auto &to = unit(n_to_units.at(base).first);
+        for (size_t i = 0; i < unit_desc.second; ++i)
+        {
+            c.steps.push_back({from.a, from.x, to.a, to.x});
+        }
+    }
+    c.divisor = compound_convert(1.0, system, denominator_units, d_to_units);
+
+    return c;
+}
+
+string Dimension::get_units() const
+{
+    const auto nunits = units_to_str(numerator_units);
+    const auto dunits = units_to_str(denominator_units);
+
+    if (dunits.size() == 0)
+    {
+        return nunits;
+    }
+
+    if (nunits.size() == 0)
+    {
+        return "/" + dunits;
+    }
+
+    return nunits + " / " + dunits;
+}
+
+bool Dimension::operator==(const Dimension &other) const
+{
+    return numerator_units == other.numerator_units &&
+           denominator_units == other.denominator_units;
+}
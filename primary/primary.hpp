@@ -7,8 +7,14 @@
  * with an optional unit attached to it. Mathematical operations can be
  * performed on Primaries with compatible units. Compatibility between units
  * is determined by a unit system provided to each Primary.
+ *
+ * It also provides the Dimension UDT: the units of a Primary without its
+ * value, to work out the units of an expression without computing it, and
+ * the Unit_conversion UDT and check_values() and compute_values() to then
+ * compute it on bare values.
  */
 
+#include <functional>
 #include <string>
 #include <vector>
 #include <set>
@@ -51,6 +57,17 @@ struct Unit_information
     {
         return this->name < other.name;
     }
+
+    // to look units up by name
+    friend bool operator<(const Unit_information &u, const std::string &name)
+    {
+        return u.name < name;
+    }
+
+    friend bool operator<(const std::string &name, const Unit_information &u)
+    {
+        return name < u.name;
+    }
 };
 
 class Unit_system
@@ -67,14 +84,63 @@ public:
 
     Unit_type get_base(const std::string &u) const;
 
+    /**
+     * Is u a unit of this system? Unlike get_base(), doesn't throw.
+     */
+    bool has_unit(const std::string &u) const;
+
     bool operator==(const Unit_system &other) const;
     bool operator!=(const Unit_system &other) const;
 
 private:
-    std::set<Unit_information> units;
+    friend class Dimension;
+
+    /**
+     * The unit named u, or nullptr.
+     */
+    const Unit_information *find(const std::string &u) const;
+
+    std::set<Unit_information, std::less<>> units;
     const boost::uuids::uuid tag;
 };
 
+enum class Primary_errc
+{
+    none,
+    incompatible_units,
+    division_by_zero,
+    invalid_operands,
+};
+
+/**
+ * Whether an operation on Primaries can be done, as told by Primary::check()
+ * without throwing. If it can't, what is the message of the exception the
+ * operation throws.
+ */
+struct Primary_check
+{
+    Primary_errc code = Primary_errc::none;
+    const char *what = "";
+
+    explicit operator bool() const
+    {
+        return code == Primary_errc::none;
+    }
+};
+
+/**
+ * Primary's operations on bare values, for callers that have dealt with the
+ * units already. op is one of + - * / % ^, or ! for factorial (right is
+ * then unused).
+ *
+ * check_values() finds the errors Primary::check() and check_factorial()
+ * find, other than those about units. compute_values() returns what
+ * Primary's operators compute, bit for bit, once the left value has been
+ * converted by the Unit_conversion Dimension::conversion() gives.
+ */
+Primary_check check_values(char op, double left, double right);
+double compute_values(char op, double left, double right);
+
 /**
  * A numeric value optionally with a unit.
  *
@@ -105,15 +171,135 @@ public:
     Primary operator^(const Primary &other) const;
     Primary factorial() const;
 
+    /**
+     * Can this op other be computed? op is one of + - * / % ^.
+     */
+    Primary_check check(char op, const Primary &other) const;
+
+    /**
+     * Can factorial() be computed?
+     */
+    Primary_check check_factorial() const;
+
     friend std::ostream &operator<<(std::ostream &out, const Primary &self);
 
     double get_value() const;
 
+    /**
+     * The same units with value v.
+     */
+    Primary with_value(double v) const;
+
+    /**
+     * The units as printed after the value: "meter", "meter / second",
+     * "/second", or "" if there are none.
+     */
+    std::string get_units() const;
+
+    /**
+     * Does this have the same units as other? Cheaper than comparing
+     * get_units(), which formats them.
+     */
+    bool has_units_of(const Primary &other) const;
+
 private:
+    friend class Dimension;
+
     double value;
     const Unit_system &unit_system;
     std::map<Unit_type, std::pair<std::string, size_t>> numerator_units;
     std::map<Unit_type, std::pair<std::string, size_t>> denominator_units;
 };
 
+/**
+ * A conversion of a value between units, as Primary does it before an
+ * operation: a series of Unit_system::convert() steps whose units have been
+ * looked up, then a division by the converted denominator. Applying it
+ * gives the same value, bit for bit, as Primary.
+ */
+class Unit_conversion
+{
+public:
+    double apply(double v) const
+    {
+        for (const auto &s : steps)
+        {
+            v = ((s.from_a + v * s.from_x) - s.to_a) / s.to_x;
+        }
+        return v / divisor;
+    }
+
+    /**
+     * Does apply() return its argument unchanged?
+     */
+    bool is_identity() const
+    {
+        return steps.empty() && divisor == 1;
+    }
+
+private:
+    friend class Dimension;
+
+    struct Step
+    {
+        double from_a;
+        double from_x;
+        double to_a;
+        double to_x;
+    };
+
+    std::vector<Step> steps;
+    double divisor = 1;
+};
+
+/**
+ * The units of a Primary, and what Primary's operations do to them. Like
+ * Primary, a Dimension keeps the name of one unit per Unit_type, since the
+ * result of, e.g., adding kilometers to meters is in meters.
+ */
+class Dimension
+{
+public:
+    /**
+     * No units.
+     */
+    Dimension() = default;
+
+    /**
+     * Just unit, which must be a unit of system.
+     */
+    Dimension(const Unit_system &system, const std::string &unit);
+
+    explicit Dimension(const Primary &p);
+
+    /**
+     * Can this op other be computed as far as units go? op is one of
+     * + - * / % ^. Errors that depend on values aren't found.
+     */
+    Primary_check check(char op, const Dimension &other) const;
+
+    /**
+     * The units of this op other.
+     */
+    Dimension combine(char op, const Dimension &other) const;
+
+    /**
+     * How Primary converts its value before this op other, with the units
+     * looked up in system once and for all.
+     */
+    Unit_conversion conversion(char op, const Dimension &other,
+                               const Unit_system &system) const;
+
+    /**
+     * The same as Primary::get_units().
+     */
+    std::string get_units() const;
+
+    bool operator==(const Dimension &other) const;
+
+private:
+    std::map<Unit_type, std::pair<std::string, size_t>> numerator_units;
+    std::map<Unit_type, std::pair<std::string, size_t>> denominator_units;
+};
+
 #endif
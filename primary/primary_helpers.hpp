@@ -209,8 +209,7 @@ bool doubles_equal(double a, double b)
 }
 
 /**
- * Like std::pow but can take cube roots.
- * Also, throws Invalid_operands on uncomputable powers.
+ * Why base ^ exp can't be computed, or nullptr if it can.
  *
  * Rules for exponentiation:
  *  - base is -ve and exp is non-integer and exp != 1/3 -> error
@@ -218,24 +217,35 @@ bool doubles_equal(double a, double b)
  *  - base is 0 and exp is non-positive -> error
  *  - otherwise -> pow(base, exp)
  */
-double power(double base, double exp)
+const char *power_error(double base, double exp)
 {
-    if (base < 0)
+    if (base < 0 && !doubles_equal(exp, 1.0 / 3.0) &&
+        !doubles_equal((long long)(exp), exp))
     {
-        if (doubles_equal(exp, 1.0 / 3.0))
-        {
-            return std::cbrt(base);
-        }
-
-        if (!doubles_equal((long long)(exp), exp))
-        {
-            throw Invalid_operands{
-                "Can't compute fractional exponent of negative base."};
-        }
+        return "Can't compute fractional exponent of negative base.";
     }
     if (base == 0 && exp <= 0)
     {
-        throw Invalid_operands{"Undefined exponent."};
+        return "Undefined exponent.";
+    }
+
+    return nullptr;
+}
+
+/**
+ * Like std::pow but can take cube roots (see power_error()).
+ * Also, throws Invalid_operands on uncomputable powers.
+ */
+double power(double base, double exp)
+{
+    if (const auto error = power_error(base, exp))
+    {
+        throw Invalid_operands{error};
+    }
+
+    if (base < 0 && doubles_equal(exp, 1.0 / 3.0))
+    {
+        return std::cbrt(base);
     }
 
     return std::pow(base, exp);
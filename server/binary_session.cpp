@@ -0,0 +1,232 @@
+#include <exception>
+
+#include "binary_session.hpp"
+#include "exceptions.hpp"
+#include "protocol.hpp"
+
+using std::exception;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+using std::uint8_t;
+
+namespace
+{
+    // handle of an expression that failed to compile
+    constexpr uint32_t no_handle = UINT32_MAX;
+
+    void put_header(Frame_writer &w, Message_type type, Error_code error)
+    {
+        w.u8(static_cast<uint8_t>(type));
+        w.u8(static_cast<uint8_t>(error));
+    }
+}
+
+Unit_signatures::Unit_signatures()
+    : ids{{"", 0}}, units_of{""}
+{
+}
+
+uint32_t Unit_signatures::id_of(const string &units)
+{
+    lock_guard<mutex> guard{lock};
+    const auto [it, added] = ids.emplace(
+        units, static_cast<uint32_t>(units_of.size()));
+    if (added)
+    {
+        units_of.push_back(units);
+    }
+    return it->second;
+}
+
+bool Unit_signatures::find(uint32_t id, string &units) const
+{
+    lock_guard<mutex> guard{lock};
+    if (id >= units_of.size())
+    {
+        return false;
+    }
+    units = units_of[id];
+    return true;
+}
+
+uint32_t Binary_session::unit_id(const string &units)
+{
+    auto id = unit_ids.find(units);
+    if (id == unit_ids.end())
+    {
+        id = unit_ids.emplace(units, signatures.id_of(units)).first;
+    }
+    return id->second;
+}
+
+void Binary_session::answer(string_view payload,
+                            Variable_store &variables_table, string &out)
+{
+    const auto start = out.size();
+    out.append(4, '\0');
+    Frame_writer w{out};
+
+    try
+    {
+        for (Frame_reader r{payload}; !r.done();)
+        {
+            switch (static_cast<Message_type>(r.u8()))
+            {
+            case Message_type::compile:
+            {
+                Compiled c;
+                for (auto n = r.u16(); n > 0; --n)
+                {
+                    c.parameters.emplace_back(r.str16());
+                }
+                const auto expression = r.str32();
+
+                Token_error bad_token;
+                c.tokens = tokenize(expression, bad_token);
+                if (bad_token.code != Token_errc::none)
+                {
+                    put_header(w, Message_type::compile,
+                               bad_token.code == Token_errc::bad_number
+                                   ? Error_code::bad_number
+                                   : Error_code::unknown_token);
+                    w.u32(no_handle);
+                    break;
+                }
+
+                const auto error = calc.compile(c.tokens, c.parameters,
+                                                c.program);
+                if (error.code != Evaluation_errc::none)
+                {
+                    put_header(w, Message_type::compile,
+                               error_code_of(error.code));
+                    w.u32(no_handle);
+                    break;
+                }
+                if (c.program)
+                {
+                    c.unit = unit_id(c.program.units());
+                }
+
+                put_header(w, Message_type::compile, Error_code::none);
+                w.u32(static_cast<uint32_t>(compiled.size()));
+                compiled.push_back(std::move(c));
+                break;
+            }
+
+            case Message_type::evaluate:
+            {
+                const auto handle = r.u32();
+                const auto n = r.u16();
+                auto error = Error_code::none;
+                if (handle >= compiled.size())
+                {
+                    error = Error_code::unknown_handle;
+                }
+                else if (n != compiled[handle].parameters.size())
+                {
+                    error = Error_code::wrong_argument_count;
+                }
+
+                if (error != Error_code::none)
+                {
+                    for (auto i = 0; i < n; ++i)
+                    {
+                        r.f64();
+                    }
+                    put_header(w, Message_type::evaluate, error);
+                    w.u32(0);
+                    w.f64(0);
+                    break;
+                }
+
+                const auto &c = compiled[handle];
+                arguments.clear();
+                for (auto i = 0; i < n; ++i)
+                {
+                    arguments.push_back(r.f64());
+                }
+
+                if (c.program)
+                {
+                    double value;
+                    const auto error = c.program.run(arguments, value);
+                    put_header(w, Message_type::evaluate,
+                               error_code_of(error.code));
+                    w.u32(error.code == Evaluation_errc::none ? c.unit : 0);
+                    w.f64(error.code == Evaluation_errc::none ? value : 0);
+                    break;
+                }
+
+                // binding a parameter twice leaves the last argument
+                for (std::size_t i = 0; i < arguments.size(); ++i)
+                {
+                    variables_table.set(
+                        c.parameters[i],
+                        Primary{arguments[i], calc.unit_system});
+                }
+
+                try
+                {
+                    const auto evaluated = coalescer.try_evaluate(
+                        c.tokens, variables_table);
+                    if (!evaluated)
+                    {
+                        put_header(w, Message_type::evaluate,
+                                   error_code_of(evaluated.error().code));
+                        w.u32(0);
+                        w.f64(0);
+                        break;
+                    }
+
+                    const auto &result = evaluated.value();
+                    put_header(w, Message_type::evaluate, Error_code::none);
+                    w.u32(unit_id(result.get_units()));
+                    w.f64(result.get_value());
+                }
+                catch (exception &ex)
+                {
+                    put_header(w, Message_type::evaluate, error_code_of(ex));
+                    w.u32(0);
+                    w.f64(0);
+                }
+                break;
+            }
+
+            case Message_type::describe_unit:
+            {
+                string units;
+                if (signatures.find(r.u32(), units))
+                {
+                    put_header(w, Message_type::describe_unit,
+                               Error_code::none);
+                    w.str16(units);
+                }
+                else
+                {
+                    put_header(w, Message_type::describe_unit,
+                               Error_code::unknown_unit_signature);
+                    w.str16("");
+                }
+                break;
+            }
+
+            default:
+                throw Protocol_error{"Unknown message type."};
+            }
+        }
+    }
+    catch (Protocol_error &)
+    {
+        out.resize(start);
+        throw;
+    }
+
+    const auto length = static_cast<uint32_t>(out.size() - start - 4);
+    for (int i = 0; i < 4; ++i)
+    {
+        out[start + i] = static_cast<char>(length >> (8 * i));
+    }
+}
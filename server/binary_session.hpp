@@ -0,0 +1,88 @@
+#ifndef A2100_PCALC_BINARY_SESSION
+#define A2100_PCALC_BINARY_SESSION 1
+#pragma once
+
+/**
+ * This library provides the server side of the binary protocol:
+ * - Unit_signatures UDT, which numbers the units of results
+ * - Binary_session UDT, which answers frames of requests
+ */
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "batch/coalescer.hpp"
+#include "parser/parser.hpp"
+#include "token/token.hpp"
+
+/**
+ * Numbers for the units of results, shared by all connections of a Server
+ * so that a client sees the same number for the same units everywhere.
+ * Signature 0 is "no unit".
+ */
+class Unit_signatures
+{
+public:
+    Unit_signatures();
+
+    std::uint32_t id_of(const std::string &units);
+
+    /**
+     * Store the units with signature id in units and return true, or return
+     * false if there's no such signature.
+     */
+    bool find(std::uint32_t id, std::string &units) const;
+
+private:
+    mutable std::mutex lock;
+    std::unordered_map<std::string, std::uint32_t> ids;
+    std::vector<std::string> units_of;
+};
+
+/**
+ * The expressions a binary connection compiled. Handles are indices into
+ * them and only mean something on the connection that compiled them.
+ */
+class Binary_session
+{
+public:
+    Binary_session(Parser &calc, Unit_signatures &signatures,
+                   Coalescer &coalescer)
+        : calc{calc}, signatures{signatures}, coalescer{coalescer}
+    {
+    }
+
+    /**
+     * Answer the requests in payload, a frame without its length, against
+     * variables_table and append the response frame to out. Throw a
+     * Protocol_error, appending nothing, if payload is malformed.
+     */
+    void answer(std::string_view payload,
+                Variable_store &variables_table, std::string &out);
+
+private:
+    struct Compiled
+    {
+        std::vector<std::string> parameters;
+        std::vector<Token> tokens;
+        // if its units could be worked out when it was compiled
+        Numeric_program program;
+        std::uint32_t unit = 0;
+    };
+
+    std::uint32_t unit_id(const std::string &units);
+
+    Parser &calc;
+    Unit_signatures &signatures;
+    Coalescer &coalescer;
+    std::vector<Compiled> compiled;
+    std::vector<double> arguments;
+    // saves going through the shared signatures for every result
+    std::unordered_map<std::string, std::uint32_t> unit_ids;
+};
+
+#endif
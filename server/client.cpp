@@ -0,0 +1,239 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "client.hpp"
+#include "exceptions.hpp"
+
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::unique_ptr;
+using std::vector;
+
+namespace
+{
+    /**
+     * Create the directory dir, private to this user, unless it exists.
+     * Throw a Server_error if it exists but isn't private to this user, since
+     * others could then replace the socket in it.
+     */
+    void make_private_directory(const string &dir)
+    {
+        if (::mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST)
+        {
+            throw Server_error{"Could not create " + dir + ": " +
+                               std::strerror(errno)};
+        }
+
+        struct stat status;
+        if (::lstat(dir.c_str(), &status) < 0 || !S_ISDIR(status.st_mode) ||
+            status.st_uid != ::geteuid() || (status.st_mode & 077) != 0)
+        {
+            throw Server_error{dir + " isn't a directory private to this user."};
+        }
+    }
+}
+
+string default_socket_path()
+{
+    if (const auto runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+        runtime_dir && *runtime_dir)
+    {
+        return string{runtime_dir} + "/pcalc.sock";
+    }
+
+    const auto dir = "/tmp/pcalc-" + std::to_string(::geteuid());
+    make_private_directory(dir);
+    return dir + "/pcalc.sock";
+}
+
+bool is_peer_this_user(int fd)
+{
+    ucred peer;
+    socklen_t len = sizeof(peer);
+    return ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &len) == 0 &&
+           len == sizeof(peer) && peer.uid == ::geteuid();
+}
+
+unique_ptr<Client> Client::connect(const string &path)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        return nullptr;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    const auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    // a server run by someone else could read or forge every answer
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+        !is_peer_this_user(fd))
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    return unique_ptr<Client>{new Client{fd}};
+}
+
+Client::~Client()
+{
+    ::close(fd);
+}
+
+void Client::send_all(string_view data)
+{
+    for (size_t sent = 0; sent < data.size();)
+    {
+        const auto n = ::send(fd, data.data() + sent, data.size() - sent,
+                              MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw Server_error{"Lost connection to server."};
+        }
+        sent += static_cast<size_t>(n);
+    }
+}
+
+void Client::receive_some()
+{
+    char buf[4096];
+    while (true)
+    {
+        const auto n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            throw Server_error{"Lost connection to server."};
+        }
+
+        received.append(buf, n);
+        return;
+    }
+}
+
+vector<string> Client::ask(const vector<string> &lines)
+{
+    string request;
+    for (const auto &line : lines)
+    {
+        request += line;
+        request += '\n';
+    }
+    send_all(request);
+
+    vector<string> answers;
+    while (answers.size() < lines.size())
+    {
+        const auto newline = received.find('\n');
+        if (newline == string::npos)
+        {
+            receive_some();
+            continue;
+        }
+
+        answers.push_back(received.substr(0, newline));
+        received.erase(0, newline + 1);
+    }
+
+    return answers;
+}
+
+vector<Response> Client::ask(Request_frame &frame)
+{
+    if (!binary)
+    {
+        send_all(string_view{"", 1});
+        binary = true;
+    }
+    send_all(frame.bytes());
+
+    while (received.size() < 4)
+    {
+        receive_some();
+    }
+    const auto length = Frame_reader{received}.u32();
+    while (received.size() - 4 < length)
+    {
+        receive_some();
+    }
+
+    auto responses = decode_responses(string_view(received).substr(4, length));
+    received.erase(0, 4 + length);
+    return responses;
+}
+
+unique_ptr<Shm_client> Shm_client::connect(const string &path,
+                                           std::uint32_t capacity)
+{
+    auto socket = Client::connect(path);
+    if (!socket)
+    {
+        return nullptr;
+    }
+    auto channel = Shm_channel::create(capacity);
+
+    // announce the channel with a 1 byte carrying its descriptor
+    char hello = '\1';
+    iovec iov{&hello, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    std::memset(control, 0, sizeof(control));
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    const auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    const auto fd = channel->fd();
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+
+    if (::sendmsg(socket->fd, &msg, MSG_NOSIGNAL) != 1)
+    {
+        return nullptr;
+    }
+
+    channel->watch(socket->fd);
+    return unique_ptr<Shm_client>{
+        new Shm_client{std::move(socket), std::move(channel)}};
+}
+
+Shm_client::~Shm_client()
+{
+    channel->close();
+}
+
+vector<Response> Shm_client::ask(Request_frame &frame)
+{
+    channel->requests().push(string_view(frame.bytes()).substr(4));
+    if (!channel->responses().pop(response))
+    {
+        throw Server_error{"Lost connection to server."};
+    }
+
+    return decode_responses(response);
+}
@@ -0,0 +1,124 @@
+#ifndef A2100_PCALC_CLIENT
+#define A2100_PCALC_CLIENT 1
+#pragma once
+
+/**
+ * This library provides:
+ * - default_socket_path(), where the per-user daemon listens
+ * - is_peer_this_user(), to refuse local sockets of other users
+ * - Client UDT, which sends requests to a running Server
+ * - Shm_client UDT, which sends binary requests through shared memory
+ */
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "server/protocol.hpp"
+#include "server/shm_channel.hpp"
+
+/**
+ * Return $XDG_RUNTIME_DIR/pcalc.sock or, if XDG_RUNTIME_DIR isn't set,
+ * /tmp/pcalc-<uid>/pcalc.sock. That directory is created with mode 0700 if
+ * it's missing; throw a Server_error if it belongs to another user or
+ * others can write to it.
+ */
+std::string default_socket_path();
+
+/**
+ * Is the process at the other end of the Unix domain socket fd run by this
+ * user?
+ */
+bool is_peer_this_user(int fd);
+
+/**
+ * A connection to a Server listening on a Unix domain socket.
+ */
+class Client
+{
+public:
+    /**
+     * Connect to the server at path. Return null if no server is listening
+     * there, or if another user runs it.
+     */
+    static std::unique_ptr<Client> connect(const std::string &path);
+
+    Client(const Client &other) = delete;
+    Client &operator=(const Client &other) = delete;
+    ~Client();
+
+    /**
+     * Send lines (which must not contain '\n') all at once and return the
+     * server's answers, one per line, without their '\n'. Throw a
+     * Server_error if the connection breaks.
+     */
+    std::vector<std::string> ask(const std::vector<std::string> &lines);
+
+    /**
+     * Send the requests of frame and return the responses. The first call
+     * switches the connection to the binary protocol; ask() with lines of
+     * text can't be used after that. Throw a Server_error if the connection
+     * breaks.
+     */
+    std::vector<Response> ask(Request_frame &frame);
+
+private:
+    explicit Client(int fd)
+        : fd{fd}
+    {
+    }
+
+    void send_all(std::string_view data);
+
+    /**
+     * Receive more data into received.
+     */
+    void receive_some();
+
+    int fd;
+    bool binary = false;
+    std::string received;
+
+    friend class Shm_client;
+};
+
+/**
+ * A client on the same host as the Server, exchanging binary frames through
+ * a Shm_channel instead of the socket. The socket stays open so that each
+ * side notices when the other goes away.
+ */
+class Shm_client
+{
+public:
+    /**
+     * Connect to the server at path with rings of capacity bytes. Return
+     * null if no server is listening there.
+     */
+    static std::unique_ptr<Shm_client> connect(const std::string &path,
+                                               std::uint32_t capacity = 1
+                                                                        << 20);
+
+    Shm_client(const Shm_client &other) = delete;
+    Shm_client &operator=(const Shm_client &other) = delete;
+    ~Shm_client();
+
+    /**
+     * Like Client::ask(Request_frame &). Throw a Server_error if the server
+     * went away.
+     */
+    std::vector<Response> ask(Request_frame &frame);
+
+private:
+    Shm_client(std::unique_ptr<Client> socket,
+               std::unique_ptr<Shm_channel> channel)
+        : socket{std::move(socket)}, channel{std::move(channel)}
+    {
+    }
+
+    std::unique_ptr<Client> socket;
+    std::unique_ptr<Shm_channel> channel;
+    std::string response;
+};
+
+#endif
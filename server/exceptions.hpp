@@ -0,0 +1,42 @@
+#ifndef A2100_PCALC_SERVER_EXCEPTIONS
+#define A2100_PCALC_SERVER_EXCEPTIONS 1
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+class Server_error : public std::exception
+{
+public:
+    Server_error(const std::string &s = "")
+        : what_err{s}
+    {
+    }
+
+    const char *what() const noexcept
+    {
+        return what_err.c_str();
+    }
+
+private:
+    std::string what_err;
+};
+
+class Protocol_error : public std::exception
+{
+public:
+    Protocol_error(const std::string &s = "")
+        : what_err{s}
+    {
+    }
+
+    const char *what() const noexcept
+    {
+        return what_err.c_str();
+    }
+
+private:
+    std::string what_err;
+};
+
+#endif
@@ -0,0 +1,269 @@
+#include <cstring>
+
+#include "protocol.hpp"
+#include "exceptions.hpp"
+#include "parser/exceptions.hpp"
+#include "primary/exceptions.hpp"
+#include "token/exceptions.hpp"
+
+using std::exception;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::uint16_t;
+using std::uint32_t;
+using std::uint64_t;
+using std::uint8_t;
+using std::vector;
+
+Error_code error_code_of(const exception &ex)
+{
+    if (dynamic_cast<const Unknown_token *>(&ex))
+    {
+        return Error_code::unknown_token;
+    }
+    if (dynamic_cast<const Bad_number *>(&ex))
+    {
+        return Error_code::bad_number;
+    }
+    if (dynamic_cast<const Syntax_error *>(&ex))
+    {
+        return Error_code::syntax_error;
+    }
+    if (dynamic_cast<const Runtime_error *>(&ex))
+    {
+        return Error_code::runtime_error;
+    }
+    if (dynamic_cast<const Incompatible_units *>(&ex) ||
+        dynamic_cast<const Different_units_for_same_base *>(&ex))
+    {
+        return Error_code::incompatible_units;
+    }
+    if (dynamic_cast<const Unknown_unit *>(&ex))
+    {
+        return Error_code::unknown_unit;
+    }
+    if (dynamic_cast<const Division_by_zero *>(&ex))
+    {
+        return Error_code::division_by_zero;
+    }
+    if (dynamic_cast<const Invalid_operands *>(&ex))
+    {
+        return Error_code::invalid_operands;
+    }
+    if (dynamic_cast<const Limit_exceeded *>(&ex))
+    {
+        return Error_code::limit_exceeded;
+    }
+
+    return Error_code::internal_error;
+}
+
+Error_code error_code_of(Evaluation_errc code)
+{
+    switch (code)
+    {
+    case Evaluation_errc::none:
+        return Error_code::none;
+    case Evaluation_errc::unknown_token:
+        return Error_code::unknown_token;
+    case Evaluation_errc::bad_number:
+        return Error_code::bad_number;
+    case Evaluation_errc::syntax_error:
+        return Error_code::syntax_error;
+    case Evaluation_errc::runtime_error:
+        return Error_code::runtime_error;
+    case Evaluation_errc::limit_exceeded:
+        return Error_code::limit_exceeded;
+    case Evaluation_errc::incompatible_units:
+        return Error_code::incompatible_units;
+    case Evaluation_errc::unknown_unit:
+        return Error_code::unknown_unit;
+    case Evaluation_errc::division_by_zero:
+        return Error_code::division_by_zero;
+    case Evaluation_errc::invalid_operands:
+        return Error_code::invalid_operands;
+    }
+
+    return Error_code::internal_error;
+}
+
+void Frame_writer::u8(uint8_t v)
+{
+    out += static_cast<char>(v);
+}
+
+void Frame_writer::u16(uint16_t v)
+{
+    u8(static_cast<uint8_t>(v));
+    u8(static_cast<uint8_t>(v >> 8));
+}
+
+void Frame_writer::u32(uint32_t v)
+{
+    u16(static_cast<uint16_t>(v));
+    u16(static_cast<uint16_t>(v >> 16));
+}
+
+void Frame_writer::f64(double v)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    u32(static_cast<uint32_t>(bits));
+    u32(static_cast<uint32_t>(bits >> 32));
+}
+
+void Frame_writer::str16(string_view s)
+{
+    if (s.size() > UINT16_MAX)
+    {
+        throw Protocol_error{"String is too long."};
+    }
+    u16(static_cast<uint16_t>(s.size()));
+    out += s;
+}
+
+void Frame_writer::str32(string_view s)
+{
+    if (s.size() > UINT32_MAX)
+    {
+        throw Protocol_error{"String is too long."};
+    }
+    u32(static_cast<uint32_t>(s.size()));
+    out += s;
+}
+
+string_view Frame_reader::take(size_t n)
+{
+    if (n > in.size())
+    {
+        throw Protocol_error{"Truncated message."};
+    }
+
+    const auto taken = in.substr(0, n);
+    in.remove_prefix(n);
+    return taken;
+}
+
+uint8_t Frame_reader::u8()
+{
+    return static_cast<uint8_t>(take(1)[0]);
+}
+
+uint16_t Frame_reader::u16()
+{
+    const auto lo = u8();
+    return static_cast<uint16_t>(lo | u8() << 8);
+}
+
+uint32_t Frame_reader::u32()
+{
+    const uint32_t lo = u16();
+    return lo | static_cast<uint32_t>(u16()) << 16;
+}
+
+double Frame_reader::f64()
+{
+    const uint64_t lo = u32();
+    const auto bits = lo | static_cast<uint64_t>(u32()) << 32;
+    double v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+string_view Frame_reader::str16()
+{
+    return take(u16());
+}
+
+string_view Frame_reader::str32()
+{
+    return take(u32());
+}
+
+Request_frame::Request_frame()
+{
+    clear();
+}
+
+void Request_frame::compile(const vector<string> &parameters,
+                            string_view expression)
+{
+    Frame_writer w{frame};
+    w.u8(static_cast<uint8_t>(Message_type::compile));
+    w.u16(static_cast<uint16_t>(parameters.size()));
+    for (const auto &p : parameters)
+    {
+        w.str16(p);
+    }
+    w.str32(expression);
+    ++requests;
+}
+
+void Request_frame::evaluate(uint32_t handle, const vector<double> &arguments)
+{
+    Frame_writer w{frame};
+    w.u8(static_cast<uint8_t>(Message_type::evaluate));
+    w.u32(handle);
+    w.u16(static_cast<uint16_t>(arguments.size()));
+    for (const auto a : arguments)
+    {
+        w.f64(a);
+    }
+    ++requests;
+}
+
+void Request_frame::describe_unit(uint32_t unit)
+{
+    Frame_writer w{frame};
+    w.u8(static_cast<uint8_t>(Message_type::describe_unit));
+    w.u32(unit);
+    ++requests;
+}
+
+const string &Request_frame::bytes()
+{
+    // the length is filled in when the frame is sent
+    const auto length = static_cast<uint32_t>(frame.size() - 4);
+    for (int i = 0; i < 4; ++i)
+    {
+        frame[i] = static_cast<char>(length >> (8 * i));
+    }
+    return frame;
+}
+
+void Request_frame::clear()
+{
+    frame.assign(4, '\0');
+    requests = 0;
+}
+
+vector<Response> decode_responses(string_view payload)
+{
+    vector<Response> responses;
+    Frame_reader r{payload};
+    while (!r.done())
+    {
+        Response response;
+        response.type = static_cast<Message_type>(r.u8());
+        response.error = static_cast<Error_code>(r.u8());
+        switch (response.type)
+        {
+        case Message_type::compile:
+            response.handle = r.u32();
+            break;
+        case Message_type::evaluate:
+            response.unit = r.u32();
+            response.value = r.f64();
+            break;
+        case Message_type::describe_unit:
+            response.units = r.str16();
+            break;
+        default:
+            throw Protocol_error{"Unknown message type."};
+        }
+        responses.push_back(std::move(response));
+    }
+
+    return responses;
+}
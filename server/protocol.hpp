@@ -0,0 +1,188 @@
+#ifndef A2100_PCALC_PROTOCOL
+#define A2100_PCALC_PROTOCOL 1
+#pragma once
+
+/**
+ * This library provides the binary protocol spoken by Server and Client:
+ * - Message_type and Error_code enums
+ * - Request_frame UDT to build a frame of requests
+ * - Response UDT and decode_responses() to read a frame of responses
+ *
+ * A client switches a connection to the binary protocol by sending a single
+ * 0 byte before anything else. After that, both sides exchange frames: a
+ * 32-bit length followed by that many bytes of messages. All requests of a
+ * frame are answered in one response frame, in order.
+ *
+ * Integers and doubles are little-endian. Strings are a 16-bit length
+ * followed by their bytes, except expressions which have a 32-bit length.
+ *
+ * Requests:
+ * - compile: type, parameter count, parameter names, expression
+ * - evaluate: type, 32-bit handle, argument count, one double per argument
+ * - describe_unit: type, 32-bit unit signature
+ *
+ * Responses:
+ * - compile: type, error code, 32-bit handle
+ * - evaluate: type, error code, 32-bit unit signature, double value
+ * - describe_unit: type, error code, unit text
+ *
+ * A compiled expression is tokenized once; evaluating its handle binds the
+ * arguments, as unitless numbers, to the parameters in order and evaluates
+ * it against the variables of the connection. If it uses no other variables
+ * and assigns none, its units are worked out when it's compiled: errors
+ * such as incompatible units fail the compile request instead, and
+ * evaluating it runs on the bare arguments (see Parser::compile()) without
+ * binding them to variables. Unit signatures are numbers the server hands
+ * out for the units of results (0 means no unit); describe_unit turns one
+ * back into text such as "meter / second".
+ */
+
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parser/parser.hpp"
+
+enum class Message_type : std::uint8_t
+{
+    compile = 1,
+    evaluate = 2,
+    describe_unit = 3,
+};
+
+enum class Error_code : std::uint8_t
+{
+    none = 0,
+    unknown_token,
+    bad_number,
+    syntax_error,
+    runtime_error,
+    incompatible_units,
+    unknown_unit,
+    division_by_zero,
+    invalid_operands,
+    unknown_handle,
+    wrong_argument_count,
+    unknown_unit_signature,
+    internal_error,
+    limit_exceeded,
+};
+
+/**
+ * Return the Error_code for an exception thrown by tokenize(),
+ * Parser::evaluate() or Primary.
+ */
+Error_code error_code_of(const std::exception &ex);
+
+/**
+ * Return the Error_code for an error returned by Parser::try_evaluate().
+ */
+Error_code error_code_of(Evaluation_errc code);
+
+/**
+ * A frame of requests, ready to be sent.
+ */
+class Request_frame
+{
+public:
+    Request_frame();
+
+    void compile(const std::vector<std::string> &parameters,
+                 std::string_view expression);
+    void evaluate(std::uint32_t handle, const std::vector<double> &arguments);
+    void describe_unit(std::uint32_t unit);
+
+    /**
+     * The number of requests in the frame.
+     */
+    std::size_t size() const
+    {
+        return requests;
+    }
+
+    /**
+     * The frame including its length.
+     */
+    const std::string &bytes();
+
+    void clear();
+
+private:
+    std::string frame;
+    std::size_t requests = 0;
+};
+
+/**
+ * One decoded response. Which fields are meaningful depends on type.
+ */
+struct Response
+{
+    Message_type type;
+    Error_code error = Error_code::none;
+    std::uint32_t handle = 0; // compile
+    std::uint32_t unit = 0;   // evaluate
+    double value = 0;         // evaluate
+    std::string units;        // describe_unit
+};
+
+/**
+ * Decode the messages of a response frame (without its length). Throw a
+ * Protocol_error if the frame is malformed.
+ */
+std::vector<Response> decode_responses(std::string_view payload);
+
+/**
+ * Appends little-endian values to a string.
+ */
+class Frame_writer
+{
+public:
+    explicit Frame_writer(std::string &out)
+        : out{out}
+    {
+    }
+
+    void u8(std::uint8_t v);
+    void u16(std::uint16_t v);
+    void u32(std::uint32_t v);
+    void f64(double v);
+    void str16(std::string_view s);
+    void str32(std::string_view s);
+
+private:
+    std::string &out;
+};
+
+/**
+ * Reads little-endian values from a frame, throwing a Protocol_error when
+ * reading past its end.
+ */
+class Frame_reader
+{
+public:
+    explicit Frame_reader(std::string_view in)
+        : in{in}
+    {
+    }
+
+    bool done() const
+    {
+        return in.empty();
+    }
+
+    std::uint8_t u8();
+    std::uint16_t u16();
+    std::uint32_t u32();
+    double f64();
+    std::string_view str16();
+    std::string_view str32();
+
+private:
+    std::string_view take(std::size_t n);
+
+    std::string_view in;
+};
+
+#endif
@@ -0,0 +1,894 @@
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.hpp"
+#include "binary_session.hpp"
+#include "client.hpp"
+#include "exceptions.hpp"
+#include "protocol.hpp"
+#include "shm_channel.hpp"
+#include "batch/lines.hpp"
+#include "token/token.hpp"
+
+using std::exception;
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::ostringstream;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::thread;
+using std::unique_ptr;
+using std::unordered_map;
+using std::vector;
+
+namespace
+{
+    constexpr auto answer = "= ";
+    constexpr auto error = "! ";
+
+    // stop reading from a client that has this much unanswered input or
+    // unread output until it catches up
+    constexpr size_t max_pending = 1 << 22;
+    constexpr size_t read_size = 1 << 16;
+
+    // a line starting with this switches the connection to a named session
+    constexpr string_view session_command = ":session";
+    // a line asking for the Coalescing_counters of the server
+    constexpr string_view stats_command = ":stats";
+}
+
+/**
+ * Variables of one session. A named session may be used by connections on
+ * different event loops at once, so evaluation holds lock.
+ */
+struct Session
+{
+    mutex lock;
+    Variable_store variables_table;
+};
+
+/**
+ * The named sessions of a Server, which live as long as the Server.
+ */
+class Session_registry
+{
+public:
+    shared_ptr<Session> find_or_create(const string &name)
+    {
+        lock_guard<mutex> guard{lock};
+        auto &session = sessions[name];
+        if (!session)
+        {
+            session = std::make_shared<Session>();
+        }
+        return session;
+    }
+
+private:
+    mutex lock;
+    map<string, shared_ptr<Session>> sessions;
+};
+
+namespace
+{
+    /**
+     * Answers binary requests arriving through a Shm_channel on a thread of
+     * its own, so that a waiting client sees its response as soon as it is
+     * written.
+     */
+    class Shm_responder
+    {
+    public:
+        Shm_responder(unique_ptr<Shm_channel> channel,
+                      unique_ptr<Binary_session> binary,
+                      shared_ptr<Session> session)
+            : channel{std::move(channel)}, binary{std::move(binary)},
+              responder{[this, session]()
+                        { respond(*session); }}
+        {
+        }
+
+        ~Shm_responder()
+        {
+            channel->close();
+            responder.join();
+        }
+
+    private:
+        void respond(Session &session)
+        {
+            string request;
+            string response;
+            try
+            {
+                while (channel->requests().pop(request))
+                {
+                    response.clear();
+                    {
+                        lock_guard<mutex> guard{session.lock};
+                        binary->answer(request, session.variables_table,
+                                       response);
+                    }
+                    // the ring keeps the length of each message itself
+                    channel->responses().push(string_view(response).substr(4));
+                }
+            }
+            catch (exception &)
+            {
+                // a malformed request or a closed channel: nothing more to
+                // answer
+            }
+            channel->close();
+        }
+
+        unique_ptr<Shm_channel> channel;
+        unique_ptr<Binary_session> binary;
+        thread responder;
+    };
+
+    /**
+     * A client and its session. Lines are evaluated against the session in
+     * the order they arrive.
+     */
+    struct Connection
+    {
+        enum class Protocol
+        {
+            unknown, // nothing received yet
+            text,
+            binary,
+            shared_memory,
+        };
+
+        ~Connection()
+        {
+            if (passed_fd >= 0)
+            {
+                ::close(passed_fd);
+            }
+        }
+
+        int fd;
+        string in;
+        // the text protocol's lines are tokenized straight out of in
+        Chunk_tokenizer lines;
+        string out;
+        size_t sent = 0; // bytes of out already written
+        shared_ptr<Session> session = std::make_shared<Session>();
+        Protocol protocol = Protocol::unknown;
+        unique_ptr<Binary_session> binary;
+        int passed_fd = -1; // a descriptor sent along with the data
+        unique_ptr<Shm_responder> shm;
+    };
+
+    /**
+     * What an event loop needs to answer requests.
+     */
+    struct Loop_context
+    {
+        Parser &calc;
+        Session_registry &sessions;
+        Unit_signatures &signatures;
+        Coalescer &coalescer;
+        ostringstream formatted;
+    };
+
+    // addresses used as epoll tags for the descriptors that aren't
+    // connections
+    char listen_tag;
+    char stop_tag;
+
+    void throw_errno(const string &what)
+    {
+        throw Server_error{what + ": " + std::strerror(errno)};
+    }
+
+    void set_nonblocking(int fd)
+    {
+        const auto flags = ::fcntl(fd, F_GETFL);
+        if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        {
+            throw_errno("Could not make socket nonblocking");
+        }
+    }
+
+    int listen_unix(const string &path)
+    {
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+        {
+            throw Server_error{"Socket path is too long: " + path};
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        const auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            throw_errno("Could not create socket");
+        }
+
+        auto bound = ::bind(fd, reinterpret_cast<sockaddr *>(&addr),
+                            sizeof(addr)) == 0;
+        if (!bound && errno == EADDRINUSE)
+        {
+            // a socket file left behind by a server that is gone can be
+            // replaced, one that still accepts connections can't
+            const auto probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            const auto alive =
+                probe >= 0 &&
+                ::connect(probe, reinterpret_cast<sockaddr *>(&addr),
+                          sizeof(addr)) == 0;
+            if (probe >= 0)
+            {
+                ::close(probe);
+            }
+            if (!alive)
+            {
+                ::unlink(path.c_str());
+                bound = ::bind(fd, reinterpret_cast<sockaddr *>(&addr),
+                               sizeof(addr)) == 0;
+            }
+            else
+            {
+                errno = EADDRINUSE;
+            }
+        }
+        if (!bound || ::listen(fd, SOMAXCONN) < 0)
+        {
+            const auto saved = errno;
+            ::close(fd);
+            errno = saved;
+            throw_errno("Could not listen on " + path);
+        }
+
+        return fd;
+    }
+
+    int listen_tcp(int port, int &bound_port)
+    {
+        if (port < 0 || port > 65535)
+        {
+            throw Server_error{"Invalid port: " + std::to_string(port)};
+        }
+
+        const auto fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            throw_errno("Could not create socket");
+        }
+
+        const int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+
+        socklen_t len = sizeof(addr);
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+            ::listen(fd, SOMAXCONN) < 0 ||
+            ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) < 0)
+        {
+            const auto saved = errno;
+            ::close(fd);
+            errno = saved;
+            throw_errno("Could not listen on port " + std::to_string(port));
+        }
+
+        bound_port = ntohs(addr.sin_port);
+        return fd;
+    }
+
+    /**
+     * Handle ":session <name>": make the named session, created on first
+     * use, the session of c.
+     */
+    void switch_session(Loop_context &context, Connection &c,
+                        string_view line)
+    {
+        line.remove_prefix(session_command.size());
+        const auto begin = line.find_first_not_of(" \t");
+        const auto end = line.find_last_not_of(" \t");
+        if (begin == string_view::npos)
+        {
+            c.out += string{error} + "Session name expected.\n";
+            return;
+        }
+
+        const string name{line.substr(begin, end - begin + 1)};
+        c.session = context.sessions.find_or_create(name);
+        c.out += string{answer} + "session " + name + "\n";
+    }
+
+    /**
+     * Evaluate the tokens of a line, or report its bad token, against the
+     * session of c and append the response to c.out.
+     */
+    void answer_tokens(Loop_context &context, Connection &c,
+                       const vector<Token> &tokens,
+                       const Token_error &bad_token)
+    {
+        auto &formatted = context.formatted;
+        formatted.str("");
+        try
+        {
+            if (bad_token.code != Token_errc::none)
+            {
+                formatted << error << bad_token.what() << "\n";
+            }
+            else
+            {
+                lock_guard<mutex> guard{c.session->lock};
+                const auto result = context.coalescer.try_evaluate(
+                    tokens, c.session->variables_table);
+                if (result)
+                {
+                    formatted << answer << result.value() << "\n";
+                }
+                else
+                {
+                    formatted << error << result.error().message(tokens)
+                              << "\n";
+                }
+            }
+        }
+        catch (exception &ex)
+        {
+            formatted << error << ex.what() << "\n";
+        }
+        c.out += formatted.str();
+    }
+
+    /**
+     * Answer the command line, which starts with ':'.
+     */
+    void answer_command(Loop_context &context, Connection &c,
+                        string_view line)
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+        if (line.substr(0, session_command.size()) == session_command)
+        {
+            switch_session(context, c, line);
+            return;
+        }
+
+        if (line == stats_command)
+        {
+            auto &formatted = context.formatted;
+            formatted.str("");
+            formatted << answer << context.coalescer.counters() << "\n";
+            c.out += formatted.str();
+            return;
+        }
+
+        // not a command after all, and ':' is no token
+        Token_error bad_token;
+        const auto tokens = tokenize(line, bad_token);
+        answer_tokens(context, c, tokens, bad_token);
+    }
+
+    /**
+     * Answer the line c.lines is done with and start on the next.
+     */
+    void answer_tokenized_line(Loop_context &context, Connection &c)
+    {
+        answer_tokens(context, c, c.lines.tokens(), c.lines.error());
+        c.lines.next_line();
+    }
+
+    /**
+     * Answer every complete line in c.in, unless c has too much output
+     * waiting already. Expressions are tokenized as they arrive, so only
+     * commands, which are short, wait in c.in for the rest of their line.
+     */
+    void answer_lines(Loop_context &context, Connection &c)
+    {
+        const string_view in{c.in};
+        size_t p = 0;
+        while (p < in.size() && c.out.size() - c.sent < max_pending)
+        {
+            const auto rest = in.substr(p);
+            if (c.lines.line_size() == 0 && rest[0] == ':')
+            {
+                const auto newline =
+                    find_newline(rest.data(), rest.data() + rest.size());
+                if (newline == rest.data() + rest.size())
+                {
+                    break;
+                }
+                answer_command(context, c,
+                               rest.substr(0, newline - rest.data()));
+                p += newline - rest.data() + 1;
+                continue;
+            }
+
+            p += c.lines.feed(rest);
+            if (!c.lines.line_done())
+            {
+                break;
+            }
+            answer_tokenized_line(context, c);
+        }
+        c.in.erase(0, p);
+    }
+
+    /**
+     * Answer the last line of a client that shut down its end, which has no
+     * '\n'.
+     */
+    void answer_last_line(Loop_context &context, Connection &c)
+    {
+        if (!c.in.empty())
+        {
+            if (find_newline(c.in.data(), c.in.data() + c.in.size()) !=
+                c.in.data() + c.in.size())
+            {
+                // complete lines are still waiting for room
+                return;
+            }
+            if (c.lines.line_size() == 0 && c.in[0] == ':')
+            {
+                answer_command(context, c, c.in);
+                c.in.clear();
+                return;
+            }
+            c.lines.feed(c.in);
+            c.in.clear();
+        }
+
+        if (c.lines.line_size() > 0)
+        {
+            c.lines.finish();
+            answer_tokenized_line(context, c);
+        }
+    }
+
+    /**
+     * Answer every complete frame in c.in, unless c has too much output
+     * waiting already. Return false if c sent something that isn't a frame
+     * of requests.
+     */
+    bool answer_frames(Connection &c)
+    {
+        size_t p = 0;
+        while (c.out.size() - c.sent < max_pending && c.in.size() - p >= 4)
+        {
+            const auto length = Frame_reader{string_view(c.in).substr(p, 4)}
+                                    .u32();
+            if (length > max_pending - 4)
+            {
+                return false;
+            }
+            if (c.in.size() - p - 4 < length)
+            {
+                break;
+            }
+
+            try
+            {
+                lock_guard<mutex> guard{c.session->lock};
+                c.binary->answer(string_view(c.in).substr(p + 4, length),
+                                 c.session->variables_table, c.out);
+            }
+            catch (Protocol_error &)
+            {
+                return false;
+            }
+            p += 4 + length;
+        }
+
+        c.in.erase(0, p);
+        return true;
+    }
+
+    /**
+     * Answer what c sent, in whichever protocol it speaks. Return false if
+     * c has to be closed.
+     */
+    bool answer_requests(Loop_context &context, Connection &c)
+    {
+        if (c.protocol == Connection::Protocol::unknown && !c.in.empty())
+        {
+            // no text request starts with a 0 or 1 byte
+            if (c.in[0] == '\0')
+            {
+                c.protocol = Connection::Protocol::binary;
+                c.binary = std::make_unique<Binary_session>(
+                    context.calc, context.signatures, context.coalescer);
+                c.in.erase(0, 1);
+            }
+            else if (c.in[0] == '\1')
+            {
+                // the 1 byte comes with the descriptor of a Shm_channel
+                if (c.passed_fd < 0)
+                {
+                    return false;
+                }
+                c.protocol = Connection::Protocol::shared_memory;
+                try
+                {
+                    auto channel = Shm_channel::attach(c.passed_fd);
+                    c.passed_fd = -1;
+                    c.shm = std::make_unique<Shm_responder>(
+                        std::move(channel),
+                        std::make_unique<Binary_session>(
+                            context.calc, context.signatures,
+                            context.coalescer),
+                        c.session);
+                }
+                catch (Protocol_error &)
+                {
+                    c.passed_fd = -1;
+                    return false;
+                }
+            }
+            else
+            {
+                c.protocol = Connection::Protocol::text;
+            }
+        }
+
+        switch (c.protocol)
+        {
+        case Connection::Protocol::binary:
+            return answer_frames(c);
+        case Connection::Protocol::shared_memory:
+            // the socket only tells whether the client is still there
+            c.in.clear();
+            return true;
+        default:
+            break;
+        }
+
+        answer_lines(context, c);
+        // a line's tokens take more room than its text
+        if (c.lines.line_size() >= max_pending ||
+            c.lines.tokens().size() * sizeof(Token) >= max_pending ||
+            (c.in.size() >= max_pending &&
+             find_newline(c.in.data(), c.in.data() + c.in.size()) ==
+                 c.in.data() + c.in.size()))
+        {
+            // a single line that doesn't fit: no way to answer it
+            c.out += string{error} + "Line is too long.\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Write as much of c.out as the socket takes. Return false if the
+     * connection is broken.
+     */
+    bool flush(Connection &c)
+    {
+        while (c.sent < c.out.size())
+        {
+            const auto n = ::send(c.fd, c.out.data() + c.sent,
+                                  c.out.size() - c.sent, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            c.sent += static_cast<size_t>(n);
+        }
+
+        c.out.clear();
+        c.sent = 0;
+        return true;
+    }
+
+    /**
+     * recv() for c, keeping a descriptor passed along with the data.
+     */
+    ssize_t receive(Connection &c, char *buf, size_t len)
+    {
+        iovec iov{buf, len};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        const auto n = ::recvmsg(c.fd, &msg, MSG_CMSG_CLOEXEC);
+        for (auto cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg;
+             cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SCM_RIGHTS)
+            {
+                int fd;
+                std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+                if (c.passed_fd >= 0)
+                {
+                    ::close(c.passed_fd);
+                }
+                c.passed_fd = fd;
+            }
+        }
+
+        return n;
+    }
+
+    /**
+     * Read everything available from c, answer it and send the answers.
+     * Return false if the connection should be closed.
+     */
+    bool serve(Loop_context &context, Connection &c)
+    {
+        auto open = true;
+        auto readable = true;
+        while (true)
+        {
+            // epoll is edge triggered: keep reading until the socket is
+            // drained, or stop while the client is too far behind
+            while (readable && c.in.size() < max_pending &&
+                   c.out.size() - c.sent < max_pending)
+            {
+                const auto old_size = c.in.size();
+                c.in.resize(old_size + read_size);
+                const auto n = receive(c, &c.in[old_size], read_size);
+                c.in.resize(old_size + (n > 0 ? n : 0));
+                if (n > 0)
+                {
+                    continue;
+                }
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                readable = false;
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                {
+                    open = false;
+                }
+            }
+
+            const auto in_before = c.in.size();
+            const auto valid = answer_requests(context, c);
+            if (!flush(c) || !valid)
+            {
+                return false;
+            }
+
+            // go around again only if answering made room for more input
+            // that is still waiting in the socket
+            const auto progressed = c.in.size() < in_before;
+            if (!readable || !progressed || c.out.size() - c.sent >= max_pending)
+            {
+                break;
+            }
+        }
+
+        if (open)
+        {
+            return true;
+        }
+
+        // a client that shut down its end still gets the answers to what it
+        // sent, including a last line without '\n'
+        if (c.protocol == Connection::Protocol::text &&
+            c.out.size() - c.sent < max_pending)
+        {
+            answer_last_line(context, c);
+        }
+        if (!flush(c))
+        {
+            return false;
+        }
+
+        // stay around while answers wait to be written; EPOLLOUT brings us
+        // back, and answering goes on once they are. Anything else left in
+        // c.in is an incomplete request that will never be finished.
+        return c.sent < c.out.size();
+    }
+}
+
+Server::Server(Parser &calc, const Server_options &options)
+    : calc{calc}, options{options}, sessions{new Session_registry},
+      signatures{new Unit_signatures}, coalescer{new Coalescer{calc}}
+{
+    if (this->options.threads == 0)
+    {
+        this->options.threads = 1;
+    }
+
+    if (!options.unix_path.empty())
+    {
+        listen_fd = listen_unix(options.unix_path);
+    }
+    else
+    {
+        listen_fd = listen_tcp(options.tcp_port, bound_port);
+    }
+    set_nonblocking(listen_fd);
+
+    stop_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stop_fd < 0)
+    {
+        const auto saved = errno;
+        ::close(listen_fd);
+        errno = saved;
+        throw_errno("Could not create eventfd");
+    }
+}
+
+Server::~Server()
+{
+    ::close(stop_fd);
+    ::close(listen_fd);
+    if (!options.unix_path.empty())
+    {
+        ::unlink(options.unix_path.c_str());
+    }
+}
+
+void Server::run()
+{
+    vector<thread> loops;
+    for (size_t i = 1; i < options.threads; ++i)
+    {
+        loops.emplace_back([this]()
+                           { event_loop(); });
+    }
+    event_loop();
+    for (auto &t : loops)
+    {
+        t.join();
+    }
+}
+
+Coalescing_counters Server::counters() const
+{
+    return coalescer->counters();
+}
+
+void Server::stop()
+{
+    const std::uint64_t one = 1;
+    // the counter is never read, so every event loop keeps seeing it set
+    [[maybe_unused]] const auto n = ::write(stop_fd, &one, sizeof(one));
+}
+
+void Server::event_loop()
+{
+    const auto epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+    {
+        throw_errno("Could not create epoll instance");
+    }
+
+    epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    // every loop waits on the listening socket; EPOLLEXCLUSIVE wakes only
+    // one of them per incoming connection
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = &listen_tag;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &stop_tag;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev);
+
+    unordered_map<Connection *, unique_ptr<Connection>> connections;
+    auto close_connection = [&connections](Connection *c)
+    {
+        ::close(c->fd);
+        connections.erase(c);
+    };
+
+    Loop_context context{calc, *sessions, *signatures, *coalescer, {}};
+    epoll_event events[64];
+    for (auto running = true; running;)
+    {
+        const auto n = ::epoll_wait(epoll_fd, events, 64, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            const auto tag = events[i].data.ptr;
+            if (tag == &stop_tag)
+            {
+                running = false;
+            }
+            else if (tag == &listen_tag)
+            {
+                while (true)
+                {
+                    const auto fd = ::accept4(listen_fd, nullptr, nullptr,
+                                              SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd < 0)
+                    {
+                        if (errno == EINTR || errno == ECONNABORTED)
+                        {
+                            continue;
+                        }
+                        break;
+                    }
+
+                    // the variables of a session are private to the user
+                    // running the server
+                    if (!options.unix_path.empty() && !is_peer_this_user(fd))
+                    {
+                        ::close(fd);
+                        continue;
+                    }
+
+                    const int on = 1;
+                    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on,
+                                 sizeof(on));
+
+                    auto c = std::make_unique<Connection>();
+                    c->fd = fd;
+                    epoll_event cev;
+                    std::memset(&cev, 0, sizeof(cev));
+                    cev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                    cev.data.ptr = c.get();
+                    if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &cev) < 0)
+                    {
+                        ::close(fd);
+                        continue;
+                    }
+                    connections.emplace(c.get(), std::move(c));
+                }
+            }
+            else
+            {
+                const auto c = static_cast<Connection *>(tag);
+                if ((events[i].events & EPOLLERR) ||
+                    !serve(context, *c))
+                {
+                    close_connection(c);
+                }
+            }
+        }
+    }
+
+    for (auto &entry : connections)
+    {
+        ::close(entry.second->fd);
+    }
+    ::close(epoll_fd);
+}
@@ -0,0 +1,105 @@
+#ifndef A2100_PCALC_SERVER
+#define A2100_PCALC_SERVER 1
+#pragma once
+
+/**
+ * This library provides:
+ * - Server_options UDT to choose where and how a Server listens
+ * - Server UDT, which evaluates expressions sent over local sockets
+ */
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "batch/coalescer.hpp"
+#include "parser/parser.hpp"
+
+struct Server_options
+{
+    // listen on this Unix domain socket, to processes of the same user...
+    std::string unix_path;
+    // ...or, if unix_path is empty, on this TCP port of 127.0.0.1 (0 picks
+    // any free port)
+    int tcp_port = 0;
+    // number of event loops, each on its own thread
+    std::size_t threads = 1;
+};
+
+class Session_registry;
+class Unit_signatures;
+
+/**
+ * Serves many concurrent connections with epoll event loops.
+ *
+ * Each connection is a session with its own variables; all sessions share
+ * the unit system of calc. Requests and responses are framed one per line:
+ * every line received is evaluated and answered with "= <result>" or
+ * "! <error>", in order. A client may send many lines without waiting for
+ * the answers.
+ *
+ * The line ":session <name>" (answered with "= session <name>") switches a
+ * connection to the named session instead. Named sessions outlive the
+ * connections using them, so variables declared in them persist until the
+ * server stops.
+ *
+ * A connection whose first byte is 0 speaks the binary protocol described
+ * in protocol.hpp instead of lines of text. A connection whose first byte is
+ * 1, sent along with the descriptor of a Shm_channel, exchanges the same
+ * frames through that channel; a thread is dedicated to it for as long as
+ * the connection stays open.
+ *
+ * Requests from all connections go through one Coalescer, so identical pure
+ * requests arriving together are evaluated once.
+ */
+class Server
+{
+public:
+    /**
+     * Start listening. Throw a Server_error if that isn't possible.
+     */
+    Server(Parser &calc, const Server_options &options);
+    Server(const Server &other) = delete;
+    Server &operator=(const Server &other) = delete;
+    ~Server();
+
+    /**
+     * Serve connections until stop() is called. The calling thread runs one
+     * of the event loops.
+     */
+    void run();
+
+    /**
+     * Make run() return. Can be called from any thread or from a signal
+     * handler.
+     */
+    void stop();
+
+    /**
+     * How much work coalescing requests saved so far. Text clients can ask
+     * for the same with the line ":stats".
+     */
+    Coalescing_counters counters() const;
+
+    /**
+     * The TCP port listened on, or 0 for a Unix domain socket.
+     */
+    int port() const
+    {
+        return bound_port;
+    }
+
+private:
+    void event_loop();
+
+    Parser &calc;
+    Server_options options;
+    int listen_fd = -1;
+    int stop_fd = -1;
+    int bound_port = 0;
+    std::unique_ptr<Session_registry> sessions;
+    std::unique_ptr<Unit_signatures> signatures;
+    std::unique_ptr<Coalescer> coalescer;
+};
+
+#endif
@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "shm_channel.hpp"
+#include "exceptions.hpp"
+
+using std::atomic;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+using std::uint64_t;
+using std::unique_ptr;
+
+namespace
+{
+    constexpr uint32_t magic = 0x70636c63; // "pclc"
+    // how often a sleeping side checks whether its peer is still there
+    constexpr long peer_check_ns = 50'000'000;
+
+    /**
+     * The start of a channel's memory; the request data and then the
+     * response data follow at data_offset.
+     */
+    struct Shm_layout
+    {
+        uint32_t magic;
+        uint32_t capacity;
+        atomic<uint32_t> closed;
+        Shm_ring_control requests;
+        Shm_ring_control responses;
+    };
+
+    constexpr size_t data_offset = (sizeof(Shm_layout) + 63) / 64 * 64;
+
+    // a channel's memory can't change size once made, so that the other
+    // process can't make the mapping fault under us
+    constexpr int size_seals = F_SEAL_SHRINK | F_SEAL_GROW;
+
+    // the futexes live in memory shared between processes, so they can't
+    // use the private variants
+    void futex_wait(atomic<uint32_t> &word, uint32_t expected)
+    {
+        const timespec timeout{0, peer_check_ns};
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT,
+                  expected, &timeout, nullptr, 0);
+    }
+
+    void futex_wake(atomic<uint32_t> &word)
+    {
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE,
+                  INT_MAX, nullptr, nullptr, 0);
+    }
+
+    void pause()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    /**
+     * Whether the socket peer is still connected (or there's no socket to
+     * watch).
+     */
+    bool peer_alive(int peer)
+    {
+        if (peer < 0)
+        {
+            return true;
+        }
+
+        pollfd p{peer, POLLRDHUP, 0};
+        return ::poll(&p, 1, 0) == 0;
+    }
+
+    /**
+     * Wait until ready() holds and return true, or return false once closed
+     * is set or peer hangs up. Spin first; then announce the wait through
+     * sleeping and sleep on signal, which the other side bumps after making
+     * progress.
+     */
+    template <class Ready>
+    bool wait_until(Ready ready, atomic<uint32_t> &signal,
+                    atomic<uint32_t> &sleeping,
+                    const atomic<uint32_t> &closed, int peer)
+    {
+        // on a single core, spinning only delays the side we wait for
+        static const int spins =
+            std::thread::hardware_concurrency() > 1 ? 1 << 12 : 0;
+        for (int i = 0; i < spins; ++i)
+        {
+            if (ready())
+            {
+                return true;
+            }
+            if (closed.load(std::memory_order_relaxed))
+            {
+                return false;
+            }
+            pause();
+        }
+
+        while (true)
+        {
+            const auto seen = signal.load();
+            sleeping.store(1);
+            // the other side stores its progress before it checks sleeping,
+            // and we store sleeping before checking progress: one of us
+            // sees the other
+            const auto is_ready = ready();
+            if (is_ready || closed.load() || !peer_alive(peer))
+            {
+                sleeping.store(0);
+                return is_ready;
+            }
+            futex_wait(signal, seen);
+            sleeping.store(0);
+        }
+    }
+
+    void notify(atomic<uint32_t> &signal, atomic<uint32_t> &sleeping)
+    {
+        if (sleeping.load())
+        {
+            signal.fetch_add(1);
+            futex_wake(signal);
+        }
+    }
+}
+
+Shm_ring::Shm_ring(Shm_ring_control &control, char *data, uint32_t capacity,
+                   const atomic<uint32_t> &closed)
+    : control{control}, data{data}, capacity{capacity}, closed{closed}
+{
+}
+
+void Shm_ring::copy_in(uint64_t at, const void *from, size_t n)
+{
+    const auto offset = static_cast<size_t>(at & (capacity - 1));
+    const auto first = std::min(n, capacity - offset);
+    std::memcpy(data + offset, from, first);
+    std::memcpy(data, static_cast<const char *>(from) + first, n - first);
+}
+
+void Shm_ring::copy_out(uint64_t at, void *to, size_t n) const
+{
+    const auto offset = static_cast<size_t>(at & (capacity - 1));
+    const auto first = std::min(n, capacity - offset);
+    std::memcpy(to, data + offset, first);
+    std::memcpy(static_cast<char *>(to) + first, data, n - first);
+}
+
+void Shm_ring::push(string_view message)
+{
+    const auto needed = sizeof(uint32_t) + message.size();
+    if (needed > capacity)
+    {
+        throw Protocol_error{"Message doesn't fit in the ring."};
+    }
+
+    if (closed.load())
+    {
+        throw Server_error{"Channel closed."};
+    }
+
+    const auto tail = control.tail.load(std::memory_order_relaxed);
+    const auto has_room = [this, tail, needed]()
+    {
+        return tail + needed - control.head.load() <= capacity;
+    };
+    if (!wait_until(has_room, control.space_signal,
+                    control.producer_sleeping, closed, peer))
+    {
+        throw Server_error{"Channel closed."};
+    }
+
+    const auto length = static_cast<uint32_t>(message.size());
+    copy_in(tail, &length, sizeof(length));
+    copy_in(tail + sizeof(length), message.data(), message.size());
+    control.tail.store(tail + needed);
+
+    notify(control.data_signal, control.consumer_sleeping);
+}
+
+bool Shm_ring::pop(string &message)
+{
+    const auto head = control.head.load(std::memory_order_relaxed);
+    const auto has_message = [this, head]()
+    {
+        return control.tail.load() != head;
+    };
+    if (!wait_until(has_message, control.data_signal,
+                    control.consumer_sleeping, closed, peer))
+    {
+        return false;
+    }
+
+    // the other process may be broken or hostile: check before copying
+    const auto available = control.tail.load() - head;
+    uint32_t length;
+    if (available < sizeof(length) || available > capacity)
+    {
+        throw Protocol_error{"Corrupted ring."};
+    }
+    copy_out(head, &length, sizeof(length));
+    if (length > available - sizeof(length))
+    {
+        throw Protocol_error{"Corrupted ring."};
+    }
+
+    message.resize(length);
+    copy_out(head + sizeof(length), &message[0], length);
+    control.head.store(head + sizeof(length) + length);
+
+    notify(control.space_signal, control.producer_sleeping);
+    return true;
+}
+
+void Shm_ring::wake_all()
+{
+    control.data_signal.fetch_add(1);
+    futex_wake(control.data_signal);
+    control.space_signal.fetch_add(1);
+    futex_wake(control.space_signal);
+}
+
+Shm_channel::Shm_channel(int fd, void *memory, size_t size)
+    : memory_fd{fd}, memory{memory}, size{size}
+{
+    auto &layout = *static_cast<Shm_layout *>(memory);
+    const auto data = static_cast<char *>(memory) + data_offset;
+    request_ring = std::make_unique<Shm_ring>(
+        layout.requests, data, layout.capacity, layout.closed);
+    response_ring = std::make_unique<Shm_ring>(
+        layout.responses, data + layout.capacity, layout.capacity,
+        layout.closed);
+}
+
+unique_ptr<Shm_channel> Shm_channel::create(uint32_t capacity)
+{
+    if (capacity < 64 || (capacity & (capacity - 1)) != 0)
+    {
+        throw Protocol_error{"Ring capacity must be a power of two."};
+    }
+
+    const auto fd = ::memfd_create("pcalc-channel",
+                                   MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    const auto size = data_offset + 2 * static_cast<size_t>(capacity);
+    if (fd < 0 || ::ftruncate(fd, static_cast<off_t>(size)) < 0 ||
+        ::fcntl(fd, F_ADD_SEALS, size_seals | F_SEAL_SEAL) < 0)
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        throw Server_error{"Could not create shared memory."};
+    }
+
+    const auto memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED)
+    {
+        ::close(fd);
+        throw Server_error{"Could not map shared memory."};
+    }
+
+    const auto layout = new (memory) Shm_layout{};
+    layout->magic = magic;
+    layout->capacity = capacity;
+
+    return unique_ptr<Shm_channel>{new Shm_channel{fd, memory, size}};
+}
+
+unique_ptr<Shm_channel> Shm_channel::attach(int fd)
+{
+    // the size checked below must stay what it is
+    const auto seals = ::fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & size_seals) != size_seals)
+    {
+        ::close(fd);
+        throw Protocol_error{"Channel memory isn't sealed."};
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(data_offset))
+    {
+        ::close(fd);
+        throw Protocol_error{"Not a channel."};
+    }
+
+    const auto size = static_cast<size_t>(st.st_size);
+    const auto memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED)
+    {
+        ::close(fd);
+        throw Protocol_error{"Not a channel."};
+    }
+
+    const auto layout = static_cast<Shm_layout *>(memory);
+    const auto capacity = layout->capacity;
+    if (layout->magic != magic || capacity < 64 ||
+        (capacity & (capacity - 1)) != 0 ||
+        size < data_offset + 2 * static_cast<size_t>(capacity))
+    {
+        ::munmap(memory, size);
+        ::close(fd);
+        throw Protocol_error{"Not a channel."};
+    }
+
+    return unique_ptr<Shm_channel>{new Shm_channel{fd, memory, size}};
+}
+
+Shm_channel::~Shm_channel()
+{
+    request_ring.reset();
+    response_ring.reset();
+    ::munmap(memory, size);
+    ::close(memory_fd);
+}
+
+void Shm_channel::watch(int socket)
+{
+    request_ring->watch(socket);
+    response_ring->watch(socket);
+}
+
+void Shm_channel::close()
+{
+    static_cast<Shm_layout *>(memory)->closed.store(1);
+    request_ring->wake_all();
+    response_ring->wake_all();
+}
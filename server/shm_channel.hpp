@@ -0,0 +1,153 @@
+#ifndef A2100_PCALC_SHM_CHANNEL
+#define A2100_PCALC_SHM_CHANNEL 1
+#pragma once
+
+/**
+ * This library provides:
+ * - Shm_ring UDT, a single-producer single-consumer queue of messages in
+ *   memory shared between two processes
+ * - Shm_channel UDT, a pair of such rings: requests one way, responses the
+ *   other
+ *
+ * Waiting sides spin for a little while and then sleep on a futex. A side
+ * only makes a system call to wake the other if the other is asleep, so a
+ * busy channel runs without any.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/**
+ * Positions and wakeup words of one ring, laid out in shared memory. head
+ * and tail count bytes ever consumed and produced.
+ */
+struct Shm_ring_control
+{
+    alignas(64) std::atomic<std::uint64_t> head;
+    alignas(64) std::atomic<std::uint64_t> tail;
+    // bumped to wake a consumer waiting for messages
+    alignas(64) std::atomic<std::uint32_t> data_signal;
+    std::atomic<std::uint32_t> consumer_sleeping;
+    // bumped to wake a producer waiting for room
+    alignas(64) std::atomic<std::uint32_t> space_signal;
+    std::atomic<std::uint32_t> producer_sleeping;
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+                  std::atomic<std::uint32_t>::is_always_lock_free,
+              "shared memory atomics must not need locks");
+
+/**
+ * A view of one ring. Messages are a 32-bit length followed by the bytes,
+ * wrapping around the end of the data.
+ */
+class Shm_ring
+{
+public:
+    Shm_ring(Shm_ring_control &control, char *data, std::uint32_t capacity,
+             const std::atomic<std::uint32_t> &closed);
+
+    /**
+     * Append message, waiting for room if needed. Throw a Server_error if
+     * the channel is closed or the watched peer is gone, or a Protocol_error
+     * if message can never fit.
+     */
+    void push(std::string_view message);
+
+    /**
+     * Wait for the next message and move it into message. Return false if
+     * the channel was closed or the watched peer is gone. Throw a
+     * Protocol_error if the other side corrupted the ring.
+     */
+    bool pop(std::string &message);
+
+    /**
+     * Wake both sides of the ring, e.g., after closing the channel.
+     */
+    void wake_all();
+
+    /**
+     * See Shm_channel::watch().
+     */
+    void watch(int socket)
+    {
+        peer = socket;
+    }
+
+private:
+    void copy_in(std::uint64_t at, const void *from, std::size_t n);
+    void copy_out(std::uint64_t at, void *to, std::size_t n) const;
+
+    Shm_ring_control &control;
+    char *data;
+    std::uint32_t capacity;
+    const std::atomic<std::uint32_t> &closed;
+    int peer = -1;
+};
+
+/**
+ * A shared memory region with a request ring and a response ring. The
+ * client creates it and passes its file descriptor to the server, which
+ * attaches to it.
+ */
+class Shm_channel
+{
+public:
+    /**
+     * Create a channel with rings of capacity bytes (a power of two). Its
+     * memory is sealed against resizing.
+     */
+    static std::unique_ptr<Shm_channel> create(std::uint32_t capacity);
+
+    /**
+     * Map the channel behind fd, which is then owned by the channel. Throw a
+     * Protocol_error if fd isn't a channel, or if its memory could still
+     * be resized by whoever made it.
+     */
+    static std::unique_ptr<Shm_channel> attach(int fd);
+
+    Shm_channel(const Shm_channel &other) = delete;
+    Shm_channel &operator=(const Shm_channel &other) = delete;
+    ~Shm_channel();
+
+    int fd() const
+    {
+        return memory_fd;
+    }
+
+    Shm_ring &requests()
+    {
+        return *request_ring;
+    }
+
+    Shm_ring &responses()
+    {
+        return *response_ring;
+    }
+
+    /**
+     * Also stop waiting once the other end of socket hangs up, for a side
+     * whose peer can die without closing the channel.
+     */
+    void watch(int socket);
+
+    /**
+     * Make both sides stop waiting: pop() returns false and push() throws.
+     */
+    void close();
+
+private:
+    Shm_channel(int fd, void *memory, std::size_t size);
+
+    int memory_fd;
+    void *memory;
+    std::size_t size;
+    std::unique_ptr<Shm_ring> request_ring;
+    std::unique_ptr<Shm_ring> response_ring;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include <gtest/gtest.h>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "parser/parser.hpp"
+#include "primary/primary.hpp"
+#include "token/token.hpp"
+
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace
+{
+    // made by the test binary so far
+    size_t allocations = 0;
+
+    /**
+     * The number of allocations call() makes.
+     */
+    template <class Call>
+    size_t allocations_of(Call call)
+    {
+        const auto before = allocations;
+        call();
+        return allocations - before;
+    }
+}
+
+/**
+ * Every allocation of the test binary goes through these, so that tests
+ * can count the allocations a call makes. Hot paths that are meant to run
+ * without allocating once warmed up fail here if they start to.
+ *
+ * None of them are inlined, so that the compiler doesn't see free() called
+ * on memory from operator new and warn about it.
+ */
+[[gnu::noinline]] void *operator new(size_t size)
+{
+    ++allocations;
+    if (const auto p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+[[gnu::noinline]] void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+TEST(AllocationTest, Counting)
+{
+    vector<int> v;
+    EXPECT_EQ(allocations_of([&v]() { v.resize(100); }), 1u);
+    EXPECT_EQ(allocations_of([&v]() { v.assign(50, 1); }), 0u);
+}
+
+TEST(AllocationTest, CompiledPrograms)
+{
+    Parser calc;
+    calc.unit_system.add_new_unit(
+        Unit_information{"meter", Unit_type::length, 0, 1});
+    calc.unit_system.add_new_unit(
+        Unit_information{"foot", Unit_type::length, 0, 0.3048});
+
+    for (const string expr : {"(x + 1) * y / 2 - x ^ 2 % 3 + y!",
+                              "x meter + y foot", "(x / y) foot - 1 meter"})
+    {
+        Numeric_program program;
+        ASSERT_EQ(calc.compile(tokenize(expr), {"x", "y"}, program).code,
+                  Evaluation_errc::none)
+            << expr;
+        ASSERT_TRUE(program) << expr;
+
+        const vector<double> arguments{3, 4};
+        double value;
+        EXPECT_EQ(allocations_of(
+                      [&]()
+                      {
+                          for (int i = 0; i < 100; ++i)
+                          {
+                              program.run(arguments, value);
+                          }
+                      }),
+                  0u)
+            << expr;
+    }
+}
+
+TEST(AllocationTest, EvaluatingText)
+{
+    Parser calc;
+    calc.evaluate("let x = 2");
+
+    // unitless expressions and errors, once the thread's buffers have grown
+    for (const string expr : {"1 + 2 * 3", "(4 - 1) ^ 2 / 7 % 3", "-5! + +1",
+                              "1 + * 2", "2 $ 3", "(1 + 2", "1 / 0"})
+    {
+        calc.try_evaluate(expr);
+        EXPECT_EQ(allocations_of([&]() { calc.try_evaluate(expr); }), 0u)
+            << expr;
+    }
+    EXPECT_EQ(allocations_of([&]() { calc.evaluate("6 * 7"); }), 0u);
+}
+
+TEST(AllocationTest, TokenBuffer)
+{
+    Token_buffer buffer;
+    Token_error error;
+
+    const vector<string> expressions{"let distance = 12.5e3 * (a + b_2)",
+                                     "1", "x ^ 2 % 7", "width*height / 2"};
+    for (const auto &expr : expressions)
+    {
+        buffer.assign(expr, error);
+    }
+
+    EXPECT_EQ(allocations_of(
+                  [&]()
+                  {
+                      for (const auto &expr : expressions)
+                      {
+                          buffer.assign(expr, error);
+                      }
+                  }),
+              0u);
+}
+
+TEST(AllocationTest, UnitlessPrimaries)
+{
+    Unit_system units;
+    const Primary a{6, units};
+    const Primary b{4, units};
+
+    EXPECT_EQ(allocations_of(
+                  [&]()
+                  {
+                      a + b;
+                      a - b;
+                      a * b;
+                      a / b;
+                      a % b;
+                      a ^ b;
+                      -a;
+                      +a;
+                      b.factorial();
+                  }),
+              0u);
+}
+
+TEST(AllocationTest, VariableStore)
+{
+    Unit_system units;
+    units.add_new_unit(
+        Unit_information{"kilometer", Unit_type::length, 0, 1000});
+    units.add_new_unit(Unit_information{"second", Unit_type::time, 0, 1});
+    // too long to format without allocating
+    const Primary speed{2, units, {"kilometer"}, {"second"}};
+    const Primary faster{4, units, {"kilometer"}, {"second"}};
+    const Primary number{3, units};
+
+    vector<string> names;
+    for (auto i = 0; i < 100; ++i)
+    {
+        names.push_back("a_long_variable_name_" + std::to_string(i));
+    }
+
+    Variable_store store;
+    store.reserve(names.size(), names.size() * names[0].size() * 2);
+    store.set(names[0], number);
+    store.set(names[1], speed);
+
+    // once reserved, storing values of the units of the variable or of the
+    // last value stored doesn't allocate
+    EXPECT_EQ(allocations_of(
+                  [&]()
+                  {
+                      for (const auto &name : names)
+                      {
+                          store.set(name, speed);
+                      }
+                      for (const auto &name : names)
+                      {
+                          store.set(name, faster);
+                      }
+                  }),
+              0u);
+}
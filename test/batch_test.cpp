@@ -0,0 +1,649 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch/async_io.hpp"
+#include "batch/check.hpp"
+#include "batch/coalescer.hpp"
+#include "batch/lines.hpp"
+#include "batch/mapped_file.hpp"
+#include "batch/exceptions.hpp"
+#include "batch/ring_buffer.hpp"
+#include "batch/pipeline.hpp"
+#include "batch/scheduler.hpp"
+#include "batch/script.hpp"
+#include "parser/exceptions.hpp"
+#include "parser/parser.hpp"
+#include "primary/exceptions.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using std::atomic;
+using std::istringstream;
+using std::map;
+using std::ostringstream;
+using std::set;
+using std::string;
+using std::string_view;
+using std::thread;
+using std::vector;
+
+TEST(RingBufferTest, KeepsOrderAcrossThreads)
+{
+    Ring_buffer<int> ring{4};
+
+    thread producer{[&ring]()
+                    {
+                        for (int i = 0; i < 10000; ++i)
+                        {
+                            ring.push(i);
+                        }
+                        ring.close();
+                    }};
+
+    int expected = 0;
+    while (auto v = ring.pop())
+    {
+        EXPECT_EQ(*v, expected);
+        ++expected;
+    }
+    producer.join();
+
+    EXPECT_EQ(expected, 10000);
+}
+
+TEST(RingBufferTest, DrainsAfterClose)
+{
+    Ring_buffer<string> ring{2};
+
+    ring.push("a");
+    ring.push("b");
+    ring.close();
+
+    EXPECT_EQ(*ring.pop(), "a");
+    EXPECT_EQ(*ring.pop(), "b");
+    EXPECT_FALSE(ring.pop().has_value());
+}
+
+TEST(RingBufferTest, SleepsWhileIdle)
+{
+    Ring_buffer<int> ring{1};
+
+    // both sides wait: the consumer for data, then the producer for room
+    const auto cpu_before = std::clock();
+    thread consumer{[&ring]()
+                    {
+                        EXPECT_EQ(*ring.pop(), 1);
+                        std::this_thread::sleep_for(
+                            std::chrono::milliseconds(300));
+                        EXPECT_EQ(*ring.pop(), 2);
+                        EXPECT_EQ(*ring.pop(), 3);
+                        EXPECT_FALSE(ring.pop().has_value());
+                    }};
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    ring.push(1);
+    ring.push(2);
+    ring.push(3);
+    ring.close();
+    consumer.join();
+
+    const auto cpu = double(std::clock() - cpu_before) / CLOCKS_PER_SEC;
+    EXPECT_LT(cpu, 0.1);
+}
+
+TEST(RingBufferTest, NeedsRoom)
+{
+    EXPECT_THROW(Ring_buffer<int>{0}, Pipeline_error);
+
+    Parser calc;
+    istringstream in{"1 + 1\n"};
+    ostringstream out;
+    EXPECT_THROW(run_pipeline(calc, in, out, 0), Pipeline_error);
+}
+
+TEST(PipelineTest, StatefulScript)
+{
+    Parser calc;
+    istringstream in{"let x = 2\n"
+                     "x = x * 21\n"
+                     "x + y\n"
+                     "4 $ 2\n"
+                     "\n"
+                     "x / 4\n"};
+    ostringstream out;
+
+    run_pipeline(calc, in, out, 2);
+
+    EXPECT_EQ(out.str(), "= 2\n"
+                         "= 42\n"
+                         "! Variable not found.\n"
+                         "! Unknown token.\n"
+                         "! Empty expression.\n"
+                         "= 10.5\n");
+}
+
+TEST(PipelineTest, MatchesSequentialEvaluation)
+{
+    Parser pipelined;
+    Parser sequential;
+
+    string script = "let acc = 0\n";
+    for (int i = 1; i <= 500; ++i)
+    {
+        script += "acc = acc + " + std::to_string(i) + " % 7\n";
+    }
+
+    istringstream in{script};
+    ostringstream out;
+    run_pipeline(pipelined, in, out, 8);
+
+    ostringstream expected;
+    istringstream lines{script};
+    for (string line; std::getline(lines, line);)
+    {
+        expected << "= " << sequential.evaluate(line) << "\n";
+    }
+
+    EXPECT_EQ(out.str(), expected.str());
+}
+
+TEST(SchedulerTest, RespectsDependencies)
+{
+    // a diamond repeated many times: i -> i+1, i -> i+2, i+1 -> i+3, ...
+    const size_t n = 2000;
+    Task_graph graph{n};
+    for (size_t i = 0; i + 2 < n; ++i)
+    {
+        graph.add_edge(i, i + 2);
+    }
+
+    vector<atomic<bool>> done(n);
+    atomic<size_t> violations{0};
+    run_task_graph(
+        graph, [&](size_t i)
+        {
+            if (i >= 2 && !done[i - 2])
+            {
+                ++violations;
+            }
+            done[i] = true; },
+        4);
+
+    EXPECT_EQ(violations, 0);
+    for (const auto &d : done)
+    {
+        EXPECT_TRUE(d);
+    }
+}
+
+TEST(SchedulerTest, IdleWorkersSleep)
+{
+    // a long task, then one that waits for it
+    Task_graph graph{2};
+    graph.add_edge(0, 1);
+
+    const auto cpu_before = std::clock();
+    vector<size_t> order;
+    run_task_graph(
+        graph, [&](size_t i)
+        {
+            if (i == 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            }
+            order.push_back(i); },
+        4);
+
+    const auto cpu = double(std::clock() - cpu_before) / CLOCKS_PER_SEC;
+    EXPECT_EQ(order, (vector<size_t>{0, 1}));
+    EXPECT_LT(cpu, 0.1);
+}
+
+TEST(ScriptTest, AnalyzeStatement)
+{
+    const auto decl = analyze_statement(tokenize("let x = y * 2 meter"));
+    EXPECT_EQ(decl.writes, (set<string>{"x"}));
+    EXPECT_EQ(decl.reads, (set<string>{"x", "y", "meter"}));
+
+    const auto chain = analyze_statement(tokenize("a = b = (c = d) + e"));
+    EXPECT_EQ(chain.writes, (set<string>{"a", "b", "c"}));
+    EXPECT_EQ(chain.reads, (set<string>{"a", "b", "c", "d", "e"}));
+
+    const auto pure = analyze_statement(tokenize("4 * (2 + 1)"));
+    EXPECT_TRUE(pure.reads.empty());
+    EXPECT_TRUE(pure.writes.empty());
+}
+
+TEST(ScriptTest, BuildDependencies)
+{
+    const auto graph = build_dependencies({
+        analyze_statement(tokenize("let a = 1")), // 0
+        analyze_statement(tokenize("let b = 2")), // 1
+        analyze_statement(tokenize("a + b")),     // 2: after 0 and 1
+        analyze_statement(tokenize("a = 5")),     // 3: after 0 and 2
+        analyze_statement(tokenize("b * 2")),     // 4: after 1
+    });
+
+    EXPECT_TRUE(graph.successors[0] == (vector<size_t>{2, 3}));
+    EXPECT_TRUE(graph.successors[1] == (vector<size_t>{2, 4}));
+    EXPECT_TRUE(graph.successors[2] == (vector<size_t>{3}));
+    EXPECT_TRUE(graph.successors[3].empty());
+    EXPECT_TRUE(graph.successors[4].empty());
+}
+
+TEST(ScriptTest, MatchesSequentialEvaluation)
+{
+    vector<string> script;
+    for (int i = 0; i < 300; ++i)
+    {
+        const auto v = "v" + std::to_string(i);
+        script.push_back("let " + v + " = " + std::to_string(i));
+        if (i >= 3)
+        {
+            const auto u = "v" + std::to_string(i / 3);
+            script.push_back(v + " = " + v + " + " + u + " % 7");
+            script.push_back(u + " = " + u + " * 2 - " + v);
+        }
+    }
+    script.push_back("v1 = 1 / 0");
+    script.push_back("let v2 = 3");
+    script.push_back("(v4 = 42) + undefined");
+    script.push_back("v4 + v1");
+    script.push_back("4 $ 2");
+    script.push_back("");
+
+    Parser sequential;
+    map<string, Primary> sequential_table;
+    vector<string> expected;
+    for (const auto &line : script)
+    {
+        ostringstream out;
+        try
+        {
+            const auto value = sequential.evaluate(line, sequential_table);
+            out << "= " << value;
+        }
+        catch (std::exception &ex)
+        {
+            out << "! " << ex.what();
+        }
+        expected.push_back(out.str());
+    }
+
+    Parser parallel;
+    Variable_store parallel_table;
+    const vector<std::string_view> statements(script.begin(), script.end());
+    EXPECT_EQ(run_script(parallel, statements, parallel_table, 4), expected);
+
+    ASSERT_EQ(parallel_table.size(), sequential_table.size());
+    for (const auto &[name, value] : sequential_table)
+    {
+        const auto parallel_value = parallel_table.get(name);
+        ASSERT_TRUE(parallel_value);
+        EXPECT_DOUBLE_EQ(parallel_value->get_value(), value.get_value());
+    }
+}
+
+TEST(LinesTest, FindNewline)
+{
+    const string text = string(100, 'x') + "\n" + string(5, 'y') + "\n";
+    const auto begin = text.data();
+    const auto end = text.data() + text.size();
+
+    EXPECT_EQ(find_newline(begin, end), begin + 100);
+    EXPECT_EQ(find_newline(begin + 101, end), begin + 106);
+    EXPECT_EQ(find_newline(begin + 107, end), end);
+    EXPECT_EQ(find_newline(begin, begin + 50), begin + 50);
+}
+
+TEST(LinesTest, SplitLikeGetline)
+{
+    EXPECT_TRUE(split_lines("", 4).empty());
+    EXPECT_EQ(split_lines("a", 4), (vector<string_view>{"a"}));
+    EXPECT_EQ(split_lines("a\n", 4), (vector<string_view>{"a"}));
+    EXPECT_EQ(split_lines("a\n\nb", 4), (vector<string_view>{"a", "", "b"}));
+    EXPECT_EQ(split_lines("\n\n", 4), (vector<string_view>{"", ""}));
+}
+
+TEST(LinesTest, SplitAcrossThreads)
+{
+    // large enough to be split into several chunks
+    string text;
+    vector<string> expected;
+    for (int i = 0; text.size() < (5u << 20); ++i)
+    {
+        expected.push_back(string(i % 97, 'a' + i % 26));
+        text += expected.back() + "\n";
+    }
+
+    const auto lines = split_lines(text, 4);
+    ASSERT_EQ(lines.size(), expected.size());
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        EXPECT_EQ(lines[i], expected[i]);
+    }
+}
+
+TEST(MappedFileTest, MapsContents)
+{
+    const string path = testing::TempDir() + "mapped_file_test.txt";
+    std::ofstream{path} << "let x = 4\nx / 0\nx ^ 2\n";
+
+    Mapped_file file{path};
+    ostringstream out;
+    Parser calc;
+    run_pipeline(calc, split_lines(file.contents(), 2), out);
+    std::remove(path.c_str());
+
+    EXPECT_EQ(out.str(), "= 4\n! Division by 0 is not allowed.\n= 16\n");
+    EXPECT_THROW(Mapped_file{path}, File_error);
+}
+
+namespace
+{
+    string read_file(const string &path)
+    {
+        std::ifstream in{path};
+        return string{std::istreambuf_iterator<char>{in}, {}};
+    }
+}
+
+TEST(AsyncIoTest, ReadsRegularFileInBlocks)
+{
+    const string path = testing::TempDir() + "async_reader_test.txt";
+    string text;
+    vector<string> expected;
+    for (int i = 0; i < 200; ++i)
+    {
+        expected.push_back(string(i % 23, 'a' + i % 26));
+        text += expected.back() + "\n";
+    }
+    text += "no newline at end";
+    expected.push_back("no newline at end");
+    std::ofstream{path} << text;
+
+    const auto fd = ::open(path.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    {
+        // tiny blocks, so that lines span several of them
+        Async_reader in{fd, 7, 3};
+        vector<string> lines;
+        for (string_view line; in.next_line(line);)
+        {
+            lines.emplace_back(line);
+        }
+        EXPECT_EQ(lines, expected);
+    }
+    ::close(fd);
+    std::remove(path.c_str());
+}
+
+TEST(AsyncIoTest, ReadsPipe)
+{
+    int fds[2];
+    ASSERT_EQ(::pipe(fds), 0);
+
+    thread producer{[fd = fds[1]]()
+                    {
+                        for (int i = 0; i < 1000; ++i)
+                        {
+                            const auto line = std::to_string(i) + "\n";
+                            EXPECT_EQ(::write(fd, line.data(), line.size()),
+                                      static_cast<ssize_t>(line.size()));
+                        }
+                        ::close(fd);
+                    }};
+
+    Async_reader in{fds[0], 64, 4};
+    int expected = 0;
+    for (string_view line; in.next_line(line); ++expected)
+    {
+        EXPECT_EQ(line, std::to_string(expected));
+    }
+    EXPECT_EQ(expected, 1000);
+
+    producer.join();
+    ::close(fds[0]);
+}
+
+TEST(AsyncIoTest, WritesInOrder)
+{
+    const string path = testing::TempDir() + "async_writer_test.txt";
+    const auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+
+    string expected;
+    {
+        Async_writer out{fd, 16};
+        for (int i = 0; i < 1000; ++i)
+        {
+            const auto line = "line " + std::to_string(i) + "\n";
+            out.write(line);
+            expected += line;
+        }
+    }
+    ::close(fd);
+
+    EXPECT_EQ(read_file(path), expected);
+    std::remove(path.c_str());
+}
+
+TEST(AsyncIoTest, Pipeline)
+{
+    const string in_path = testing::TempDir() + "async_pipeline_in.txt";
+    const string out_path = testing::TempDir() + "async_pipeline_out.txt";
+    std::ofstream{in_path} << "let x = 3\nx!\nx / 0\n";
+
+    const auto in_fd = ::open(in_path.c_str(), O_RDONLY);
+    const auto out_fd = ::open(out_path.c_str(),
+                               O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(in_fd, 0);
+    ASSERT_GE(out_fd, 0);
+    {
+        Parser calc;
+        Async_reader in{in_fd};
+        Async_writer out{out_fd};
+        run_pipeline(calc, in, out);
+    }
+    ::close(in_fd);
+    ::close(out_fd);
+
+    EXPECT_EQ(read_file(out_path),
+              "= 3\n= 6\n! Division by 0 is not allowed.\n");
+    std::remove(in_path.c_str());
+    std::remove(out_path.c_str());
+}
+
+TEST(CoalescerTest, ReusesPureResults)
+{
+    Parser calc;
+    Coalescer coalescer{calc};
+    map<string, Primary> variables_table;
+
+    EXPECT_EQ(coalescer.evaluate(tokenize("2 + 3"), variables_table)
+                  .get_value(),
+              5);
+    EXPECT_EQ(coalescer.evaluate(tokenize("2+3"), variables_table)
+                  .get_value(),
+              5);
+    EXPECT_THROW(coalescer.evaluate(tokenize("1 / 0"), variables_table),
+                 Division_by_zero);
+    EXPECT_THROW(coalescer.evaluate(tokenize("1 / 0"), variables_table),
+                 Division_by_zero);
+    EXPECT_THROW(coalescer.evaluate(tokenize("x * 2"), variables_table),
+                 Runtime_error);
+
+    // once x exists, x * 2 depends on it
+    coalescer.evaluate(tokenize("let x = 4"), variables_table);
+    EXPECT_EQ(coalescer.evaluate(tokenize("x * 2"), variables_table)
+                  .get_value(),
+              8);
+    coalescer.evaluate(tokenize("x = 5"), variables_table);
+    EXPECT_EQ(coalescer.evaluate(tokenize("x * 2"), variables_table)
+                  .get_value(),
+              10);
+
+    const auto c = coalescer.counters();
+    EXPECT_EQ(c.requests, 9u);
+    EXPECT_EQ(c.pure, 5u);
+    EXPECT_EQ(c.reused, 2u);
+    EXPECT_EQ(c.coalesced, 0u);
+    // 2 + 3, 1 / 0, x * 2, let x = 4, x = 5
+    EXPECT_EQ(c.shapes, 5u);
+    EXPECT_EQ(c.shape_repeats, 4u);
+}
+
+TEST(CoalescerTest, SharesAcrossThreads)
+{
+    Parser calc;
+    Coalescer coalescer{calc};
+
+    vector<thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&coalescer, t]()
+                             {
+                                 map<string, Primary> variables_table;
+                                 for (int i = 0; i < 1000; ++i)
+                                 {
+                                     const auto r = coalescer.evaluate(
+                                         tokenize(std::to_string(i % 10) + "!"),
+                                         variables_table);
+                                     EXPECT_EQ(r.get_value(),
+                                               std::tgamma(i % 10 + 1));
+                                 }
+                             });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    const auto c = coalescer.counters();
+    EXPECT_EQ(c.requests, 4000u);
+    EXPECT_EQ(c.pure, 4000u);
+    EXPECT_EQ(c.coalesced + c.reused, 3990u);
+    EXPECT_EQ(c.shapes, 1u);
+}
+
+TEST(CoalescerTest, RunsRepeatedShapesCompiled)
+{
+    Parser coalesced;
+    Parser evaluated;
+    for (auto calc : {&coalesced, &evaluated})
+    {
+        calc->unit_system.add_new_unit(
+            Unit_information{"meter", Unit_type::length, 0, 1});
+        calc->unit_system.add_new_unit(
+            Unit_information{"kilometer", Unit_type::length, 0, 1000});
+    }
+    Coalescer coalescer{coalesced};
+    map<string, Primary> coalesced_table;
+    map<string, Primary> evaluated_table;
+
+    const auto answer = [](Evaluation_result r, const vector<Token> &tokens)
+    {
+        ostringstream out;
+        if (r)
+        {
+            out << "= " << r.value();
+        }
+        else
+        {
+            out << "! " << r.error().message(tokens);
+        }
+        return out.str();
+    };
+
+    for (int i = 0; i < 50; ++i)
+    {
+        const auto n = std::to_string(i % 7);
+        const auto m = std::to_string(i);
+        for (const auto &line :
+             {n + " kilometer + " + m + " meter",
+              "100 / " + n + " - " + m + " ^ 2", n + "! % " + m, "2 2 " + n})
+        {
+            const auto tokens = tokenize(line);
+            EXPECT_EQ(answer(coalescer.try_evaluate(tokens, coalesced_table),
+                             tokens),
+                      answer(evaluated.try_evaluate(tokens, evaluated_table),
+                             tokens))
+                << line;
+        }
+    }
+
+    // the first two requests of each shape are evaluated, and the shape
+    // with a syntax error doesn't compile
+    EXPECT_EQ(coalescer.counters().shapes, 4u);
+    EXPECT_EQ(coalescer.counters().compiled_runs, 3 * 48u);
+}
+
+TEST(PipelineTest, CoalescedMatchesSequentialEvaluation)
+{
+    Parser pipelined;
+    Parser sequential;
+    Coalescer coalescer{pipelined};
+
+    string script = "let x = 1\n";
+    for (int i = 1; i <= 300; ++i)
+    {
+        script += std::to_string(i % 5) + " ^ 2\n";
+        script += "x = x + " + std::to_string(i % 5) + " ^ 2\n";
+        script += "x / " + std::to_string(i % 3) + "\n";
+    }
+
+    istringstream in{script};
+    ostringstream out;
+    run_pipeline(pipelined, in, out, 8, &coalescer);
+
+    ostringstream expected;
+    istringstream lines{script};
+    for (string line; std::getline(lines, line);)
+    {
+        try
+        {
+            const auto result = sequential.evaluate(line);
+            expected << "= " << result << "\n";
+        }
+        catch (std::exception &ex)
+        {
+            expected << "! " << ex.what() << "\n";
+        }
+    }
+
+    EXPECT_EQ(out.str(), expected.str());
+    EXPECT_EQ(coalescer.counters().reused, 295u);
+}
+
+TEST(CheckTest, ReportsEveryError)
+{
+    Parser calc;
+    calc.unit_system.add_new_unit(
+        Unit_information{"meter", Unit_type::length, 0, 1});
+    calc.unit_system.add_new_unit(
+        Unit_information{"second", Unit_type::time, 0, 1});
+
+    const vector<string_view> lines{
+        "let x = 2 meter", "x + 1 second", "", "  ", "y", "x $", "x / 0",
+        "let x = 3"};
+    ostringstream out;
+    EXPECT_EQ(check_lines(calc, lines, out), 4u);
+    EXPECT_EQ(out.str(),
+              "2:3: Primaries measuring different quantities can't be "
+              "added.\n"
+              "5:1: Variable not found.\n"
+              "6:3: Unknown token.\n"
+              "8:5: Redeclaration of variable.\n");
+    EXPECT_TRUE(calc.variables().empty());
+}
@@ -2,17 +2,23 @@
 #include <cmath>
 #include <map>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "parser/parser.hpp"
 #include "parser/exceptions.hpp"
+#include "parser/variable_store.hpp"
 #include "primary/primary.hpp"
 #include "primary/exceptions.hpp"
+#include "token/exceptions.hpp"
 
 using std::cbrt;
 using std::map;
 using std::pow;
 using std::string;
 using std::tgamma;
+using std::thread;
+using std::vector;
 
 TEST(ParserPrimaryTest, Numbers)
 {
@@ -374,3 +380,649 @@ TEST(ParserAssignmentTest, ExternalVariableBadAssignments)
     EXPECT_THROW(calc.evaluate("x 5 = 12", vtab), Syntax_error);
     EXPECT_THROW(calc.evaluate("5 x = 42", vtab), Syntax_error);
 }
+
+TEST(ParserLimitsTest, Unlimited)
+{
+    Parser calc;
+    string expr = string(500, '(') + "1" + string(500, ')');
+    for (int i = 0; i < 500; ++i)
+    {
+        expr += " + 1";
+    }
+
+    EXPECT_EQ(calc.evaluate(expr).get_value(), 501);
+}
+
+TEST(ParserLimitsTest, Tokens)
+{
+    Parser calc;
+    calc.limits.max_tokens = 5;
+
+    EXPECT_EQ(calc.evaluate("1 + 2 + 3").get_value(), 6);
+    EXPECT_THROW(calc.evaluate("1 + 2 + 3 + 4"), Limit_exceeded);
+}
+
+TEST(ParserLimitsTest, Depth)
+{
+    Parser calc;
+    calc.limits.max_depth = 3;
+
+    EXPECT_EQ(calc.evaluate("((1) + ((2)))").get_value(), 3);
+    EXPECT_THROW(calc.evaluate("((((1))))"), Limit_exceeded);
+    // refused before recursing into it
+    EXPECT_THROW(calc.evaluate(string(100000, '(') + "1" +
+                               string(100000, ')')),
+                 Limit_exceeded);
+}
+
+TEST(ParserLimitsTest, Steps)
+{
+    Parser calc;
+    calc.limits.max_steps = 100;
+
+    EXPECT_EQ(calc.evaluate("2 ^ 10").get_value(), 1024);
+    string expr = "1";
+    for (int i = 0; i < 100; ++i)
+    {
+        expr += " + 1";
+    }
+    EXPECT_THROW(calc.evaluate(expr), Limit_exceeded);
+
+    // every evaluation starts with a full budget
+    EXPECT_EQ(calc.evaluate("2 ^ 10").get_value(), 1024);
+}
+
+TEST(ParserLimitsTest, Time)
+{
+    Parser calc;
+    calc.limits.max_time = std::chrono::microseconds(1);
+
+    string expr = "1";
+    for (int i = 0; i < 5000; ++i)
+    {
+        expr += " + 1";
+    }
+    EXPECT_THROW(calc.evaluate(expr), Limit_exceeded);
+}
+
+TEST(ParserDepthTest, DeepNesting)
+{
+    Parser calc;
+    const int depth = 200000;
+
+    EXPECT_EQ(calc.evaluate(string(depth, '(') + "1" + string(depth, ')'))
+                  .get_value(),
+              1);
+    EXPECT_EQ(calc.evaluate(string(depth, '-') + "1").get_value(), 1);
+
+    string powers = "1";
+    for (int i = 0; i < depth; ++i)
+    {
+        powers += " ^ 1";
+    }
+    EXPECT_EQ(calc.evaluate(powers).get_value(), 1);
+
+    calc.evaluate("let x = 0");
+    string assignments;
+    for (int i = 0; i < depth; ++i)
+    {
+        assignments += "(x = ";
+    }
+    assignments += "7" + string(depth, ')');
+    EXPECT_EQ(calc.evaluate(assignments).get_value(), 7);
+    EXPECT_EQ(calc.evaluate("x").get_value(), 7);
+
+    EXPECT_THROW(calc.evaluate(string(depth, '(') + "1" +
+                               string(depth - 1, ')')),
+                 Syntax_error);
+}
+
+TEST(ParserDepthTest, IncompleteExpressions)
+{
+    Parser calc;
+
+    EXPECT_THROW(calc.evaluate("12 +"), Syntax_error);
+    EXPECT_THROW(calc.evaluate("2 ^"), Syntax_error);
+    EXPECT_THROW(calc.evaluate("-"), Syntax_error);
+    EXPECT_THROW(calc.evaluate("()"), Syntax_error);
+    EXPECT_THROW(calc.evaluate("1)"), Syntax_error);
+    EXPECT_THROW(calc.evaluate("2 (3)"), Syntax_error);
+}
+
+TEST(ParserDepthTest, SyntaxBeforeEvaluation)
+{
+    Parser calc;
+    calc.evaluate("let x = 1");
+
+    // nothing is assigned when the expression is malformed
+    EXPECT_THROW(calc.evaluate("(x = 5) + 2 3"), Syntax_error);
+    EXPECT_EQ(calc.evaluate("x").get_value(), 1);
+}
+
+TEST(ParserTryEvaluateTest, Values)
+{
+    Parser calc;
+
+    const auto r = calc.try_evaluate("let x = 6 * 7");
+    ASSERT_TRUE(r);
+    EXPECT_EQ(r.value().get_value(), 42);
+    EXPECT_EQ(calc.try_evaluate("x / 2").value().get_value(), 21);
+}
+
+TEST(ParserTryEvaluateTest, Errors)
+{
+    Parser calc;
+    calc.unit_system.add_new_unit(
+        Unit_information{"meter", Unit_type::length, 0, 1});
+
+    const auto check = [&calc](const string &expr, Evaluation_errc code,
+                               std::size_t begin, std::size_t end,
+                               const string &message)
+    {
+        const auto r = calc.try_evaluate(expr);
+        ASSERT_FALSE(r) << expr;
+        EXPECT_EQ(r.error().code, code) << expr;
+        EXPECT_EQ(r.error().span.begin, begin) << expr;
+        EXPECT_EQ(r.error().span.end, end) << expr;
+        EXPECT_EQ(r.error().message(expr), message) << expr;
+    };
+
+    check("", Evaluation_errc::syntax_error, 0, 0, "Empty expression.");
+    check("1 + $", Evaluation_errc::unknown_token, 4, 5, "Unknown token.");
+    check("12 +", Evaluation_errc::syntax_error, 4, 4, "Primary expected.");
+    check("(1 + 2", Evaluation_errc::syntax_error, 6, 6, "Missing ')'.");
+    check("y * 2", Evaluation_errc::runtime_error, 0, 1,
+          "Variable not found.");
+    check("2 parsec", Evaluation_errc::unknown_unit, 2, 8,
+          "parsec is not a known unit.");
+    check("1 + 2 meter", Evaluation_errc::incompatible_units, 2, 3,
+          "Primaries measuring different quantities can't be added.");
+    check("4 / (2 - 2)", Evaluation_errc::division_by_zero, 2, 3,
+          "Division by 0 is not allowed.");
+    check("(-3)!", Evaluation_errc::invalid_operands, 4, 5,
+          "Factorial is not defined for negative values.");
+
+    calc.limits.max_steps = 4;
+    check("1 + 2 + 3", Evaluation_errc::limit_exceeded, 8, 9,
+          "Too many evaluation steps.");
+}
+
+TEST(ParserTryEvaluateTest, ThrowingWrapper)
+{
+    Parser calc;
+
+    EXPECT_THROW(calc.evaluate("2 parsec"), Unknown_unit);
+    try
+    {
+        calc.evaluate("2 parsec");
+    }
+    catch (Unknown_unit &ex)
+    {
+        EXPECT_STREQ(ex.what(), "parsec is not a known unit.");
+    }
+    EXPECT_THROW(calc.evaluate("1 / 0"), Division_by_zero);
+    EXPECT_THROW(calc.evaluate("(-1)!"), Invalid_operands);
+}
+
+TEST(ParserTryEvaluateTest, TokenBuffer)
+{
+    Parser calc;
+    Token_buffer tokens;
+    Token_error error;
+
+    tokens.assign("let x = 6 * 7", error);
+    ASSERT_EQ(error.code, Token_errc::none);
+    const auto r = calc.try_evaluate(tokens);
+    ASSERT_TRUE(r);
+    EXPECT_EQ(r.value().get_value(), 42);
+
+    tokens.assign("x / y", error);
+    const auto missing = calc.try_evaluate(tokens);
+    ASSERT_FALSE(missing);
+    EXPECT_EQ(missing.error().code, Evaluation_errc::runtime_error);
+    EXPECT_EQ(missing.error().span.begin, 4u);
+
+    tokens.assign("x / 2", error);
+    EXPECT_EQ(calc.try_evaluate(tokens).value().get_value(), 21);
+}
+
+TEST(ParserTryEvaluateTest, SharedBetweenThreads)
+{
+    // evaluating text or a Token_buffer changes nothing in the Parser, so
+    // threads with variables of their own can share one
+    Parser calc;
+    calc.unit_system.add_new_unit(
+        Unit_information{"meter", Unit_type::length, 0, 1});
+    vector<int> wrong(4);
+    vector<thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back(
+            [&calc, &wrong, t]()
+            {
+                Variable_store variables;
+                Token_buffer tokens;
+                Token_error error;
+                for (int i = 0; i < 2000; ++i)
+                {
+                    const auto name = "v" + std::to_string(i);
+                    const auto declared = calc.try_evaluate(
+                        "let " + name + " = " + std::to_string(t) + " meter",
+                        variables);
+                    tokens.assign(name + " * 2", error);
+                    const auto doubled = calc.try_evaluate(tokens, variables);
+                    if (!declared || !doubled ||
+                        doubled.value().get_value() != 2 * t)
+                    {
+                        ++wrong[t];
+                    }
+                }
+            });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    EXPECT_EQ(wrong, vector<int>(4));
+}
+
+TEST(ParserTryEvaluateTest, ErrorsMatchTokenizingFirst)
+{
+    Parser calc;
+
+    // a bad token is reported before a syntax error in front of it, as
+    // when the line is tokenized first
+    const auto early = calc.try_evaluate("1 + * $");
+    ASSERT_FALSE(early);
+    EXPECT_EQ(early.error().code, Evaluation_errc::unknown_token);
+    EXPECT_EQ(early.error().span.begin, 6u);
+    EXPECT_EQ(calc.try_evaluate(") 2 $").error().code,
+              Evaluation_errc::unknown_token);
+    EXPECT_EQ(calc.try_evaluate("let 2 = 1e").error().code,
+              Evaluation_errc::bad_number);
+    EXPECT_THROW(calc.evaluate(") 2 $"), Unknown_token);
+
+    const auto bad = calc.try_evaluate("1 + 2 $ * ");
+    ASSERT_FALSE(bad);
+    EXPECT_EQ(bad.error().code, Evaluation_errc::unknown_token);
+    EXPECT_EQ(bad.error().span.begin, 6u);
+
+    EXPECT_EQ(calc.try_evaluate("let y = $").error().span.begin, 8u);
+
+    for (const string expr : {"x = ", "x = )", "let", "let y", "(1 + 2"})
+    {
+        const auto streamed = calc.try_evaluate(expr);
+        const auto whole = calc.try_evaluate(tokenize(expr));
+        ASSERT_FALSE(streamed) << expr;
+        EXPECT_EQ(streamed.error().code, whole.error().code) << expr;
+        EXPECT_EQ(streamed.error().span.begin, whole.error().span.begin)
+            << expr;
+    }
+
+    for (const string expr : {") 2 $", "let let = $", "z = 1 $", "(1 2) 3e",
+                              "1 2 3 4 5 6 7 8 9 $"})
+    {
+        Token_error bad_token;
+        tokenize(expr, bad_token);
+        ASSERT_NE(bad_token.code, Token_errc::none) << expr;
+        const auto streamed = calc.try_evaluate(expr);
+        ASSERT_FALSE(streamed) << expr;
+        EXPECT_STREQ(streamed.error().what, bad_token.what()) << expr;
+        EXPECT_EQ(streamed.error().span.begin, bad_token.offset) << expr;
+    }
+
+    calc.limits.max_tokens = 5;
+    calc.limits.max_depth = 2;
+    const auto many = calc.try_evaluate("1 + 2 + 3 + 4");
+    ASSERT_FALSE(many);
+    EXPECT_EQ(many.error().code, Evaluation_errc::limit_exceeded);
+    EXPECT_EQ(many.error().span.begin, 0u);
+    EXPECT_STREQ(calc.try_evaluate("(((1)))").error().what,
+                 "Parentheses nested too deeply.");
+    // the limits are checked before the syntax, and bad tokens before both
+    EXPECT_EQ(calc.try_evaluate(tokenize(") + 2 + 3 + 4")).error().code,
+              Evaluation_errc::limit_exceeded);
+    EXPECT_EQ(calc.try_evaluate(") + 2 + 3 + $").error().code,
+              Evaluation_errc::unknown_token);
+    EXPECT_EQ(calc.try_evaluate(") + 2 + 3 + 4").error().code,
+              Evaluation_errc::limit_exceeded);
+}
+
+TEST(ParserTryEvaluateTest, LongExpressionsBetweenShortOnes)
+{
+    Parser calc;
+    calc.evaluate("let x = 1");
+
+    // more scratch memory than a thread keeps between statements, with
+    // short statements before and after
+    string sum = "0";
+    for (int i = 0; i < 5000; ++i)
+    {
+        sum += " + x";
+    }
+    for (int round = 0; round < 3; ++round)
+    {
+        EXPECT_EQ(calc.evaluate("2 * 3").get_value(), 6);
+        EXPECT_EQ(calc.evaluate(sum).get_value(), 5000);
+        EXPECT_EQ(calc.evaluate("(x = x + 1) * 2").get_value(), 4);
+        EXPECT_EQ(calc.evaluate("x = 1").get_value(), 1);
+    }
+}
+
+TEST(ParserOrderTest, AssignmentsInOperands)
+{
+    Parser calc;
+    calc.evaluate("let b = 4");
+
+    // the right operand goes first, except for ^
+    const vector<std::pair<string, double>> cases{
+        {"b / (b = 2)", 1},      {"b % (b = 3)", 0},
+        {"b - (b = 1)", 0},      {"b + (b = 1)", 2},
+        {"b * (b = 1)", 1},      {"b ^ (b = 1)", 4},
+        {"(b = 1) ^ b", 1},      {"(b = 2) + b * (b = 3)", 11},
+        {"-b + (b = 1)", 0},     {"b meter / (b = 2)", 1}};
+    calc.unit_system.add_new_unit(
+        Unit_information{"meter", Unit_type::length, 0, 1});
+    for (const auto &[expr, value] : cases)
+    {
+        calc.evaluate("b = 4");
+        EXPECT_EQ(calc.evaluate(expr).get_value(), value) << expr;
+        calc.evaluate("b = 4");
+        EXPECT_EQ(calc.evaluate(tokenize(expr)).get_value(), value) << expr;
+    }
+
+    // of two failing operands, the right one's error is reported
+    EXPECT_EQ(calc.try_evaluate("1 / 0 + 0 ^ 0").error().code,
+              Evaluation_errc::invalid_operands);
+    EXPECT_EQ(calc.try_evaluate("q + 1 / 0").error().code,
+              Evaluation_errc::division_by_zero);
+    EXPECT_EQ(calc.try_evaluate("q ^ (1 / 0)").error().code,
+              Evaluation_errc::runtime_error);
+
+    Numeric_program program;
+    ASSERT_EQ(calc.compile(tokenize("x / 0 + 0 ^ x"), {"x"}, program).code,
+              Evaluation_errc::none);
+    ASSERT_TRUE(program);
+    double value;
+    EXPECT_EQ(program.run({0}, value).code,
+              Evaluation_errc::invalid_operands);
+    EXPECT_EQ(program.run({2}, value).code,
+              Evaluation_errc::division_by_zero);
+    ASSERT_EQ(calc.compile(tokenize("x - 2 * x ^ 3 / 4"), {"x"}, program).code,
+              Evaluation_errc::none);
+    ASSERT_EQ(program.run({2}, value).code, Evaluation_errc::none);
+    EXPECT_EQ(value, -2);
+}
+
+TEST(ParserCheckTest, FindsErrorsWithoutEvaluating)
+{
+    Parser calc;
+    calc.unit_system.add_new_unit(
+        Unit_information{"meter", Unit_type::length, 0, 1});
+    calc.unit_system.add_new_unit(
+        Unit_information{"second", Unit_type::time, 0, 1});
+    map<string, Dimension> dimensions;
+
+    const auto code = [&calc, &dimensions](const string &expr)
+    {
+        return calc.check(expr, dimensions).code;
+    };
+
+    EXPECT_EQ(code("let d = 3 meter"), Evaluation_errc::none);
+    EXPECT_EQ(code("let t = 2 second"), Evaluation_errc::none);
+    EXPECT_EQ(code("d / t"), Evaluation_errc::none);
+    EXPECT_EQ(code("d + t"), Evaluation_errc::incompatible_units);
+    EXPECT_EQ(code("d + v"), Evaluation_errc::runtime_error);
+    EXPECT_EQ(code("let d = 1"), Evaluation_errc::runtime_error);
+    EXPECT_EQ(code("2 parsec"), Evaluation_errc::unknown_unit);
+    EXPECT_EQ(code("(1 + 2"), Evaluation_errc::syntax_error);
+    EXPECT_EQ(code("1 + $"), Evaluation_errc::unknown_token);
+    // values aren't computed
+    EXPECT_EQ(code("1 / 0"), Evaluation_errc::none);
+
+    // assignments change the units of a variable
+    EXPECT_EQ(code("d = d / t"), Evaluation_errc::none);
+    EXPECT_EQ(code("d + 1 meter"), Evaluation_errc::incompatible_units);
+    EXPECT_EQ(code("d * t + 1 meter"), Evaluation_errc::none);
+
+    const auto error = calc.check("d + t", dimensions);
+    EXPECT_EQ(error.span.begin, 2u);
+    EXPECT_EQ(error.message("d + t"),
+              "Primaries measuring different quantities can't be added.");
+
+    // nothing was evaluated
+    EXPECT_TRUE(calc.variables().empty());
+}
+
+TEST(ParserCompileTest, MatchesEvaluation)
+{
+    Parser calc;
+    calc.unit_system.add_new_unit(
+        Unit_information{"meter", Unit_type::length, 0, 1});
+    calc.unit_system.add_new_unit(
+        Unit_information{"foot", Unit_type::length, 0, 0.3048});
+    calc.unit_system.add_new_unit(
+        Unit_information{"second", Unit_type::time, 0, 1});
+    calc.unit_system.add_new_unit(
+        Unit_information{"hour", Unit_type::time, 0, 3600});
+    calc.unit_system.add_new_unit(
+        Unit_information{"celsius", Unit_type::temperature, 0, 1});
+    calc.unit_system.add_new_unit(
+        Unit_information{"fahrenheit", Unit_type::temperature,
+                         -32.0 * 5.0 / 9.0, 5.0 / 9.0});
+
+    const vector<string> expressions{
+        "x * y + 3",
+        "-x ^ 2 - y",
+        "x foot + y meter",
+        "(x meter) / (y hour) - 2 foot / (1 second)",
+        "x fahrenheit - y celsius",
+        "x foot * y meter * 2 second / (1 hour)",
+        "(x meter % y foot) * 3",
+        "x foot / (y foot * 2 second)",
+        "x ^ (1 / 3) + y!",
+        "(x / y) meter + 1 foot",
+        "-(x - y) fahrenheit + 0 celsius",
+    };
+    const vector<vector<double>> arguments{
+        {3, 4}, {-2.5, 1.5}, {0.1, 7}, {-0.0, 3}, {1e10, 0.3}};
+
+    for (const auto &expr : expressions)
+    {
+        Numeric_program program;
+        ASSERT_EQ(calc.compile(tokenize(expr), {"x", "y"}, program).code,
+                  Evaluation_errc::none)
+            << expr;
+        ASSERT_TRUE(program) << expr;
+
+        for (const auto &a : arguments)
+        {
+            map<string, Primary> variables;
+            variables.emplace("x", Primary{a[0], calc.unit_system});
+            variables.emplace("y", Primary{a[1], calc.unit_system});
+            const auto expected = calc.try_evaluate(expr, variables);
+
+            double value;
+            const auto error = program.run(a, value);
+            ASSERT_EQ(error.code, expected ? Evaluation_errc::none
+                                           : expected.error().code)
+                << expr;
+            if (expected)
+            {
+                // bit for bit, including the sign of zero
+                EXPECT_EQ(std::signbit(value),
+                          std::signbit(expected.value().get_value()))
+                    << expr;
+                if (!std::isnan(value))
+                {
+                    EXPECT_EQ(value, expected.value().get_value()) << expr;
+                }
+                EXPECT_EQ(program.units(), expected.value().get_units())
+                    << expr;
+            }
+            else
+            {
+                EXPECT_EQ(error.span.begin, expected.error().span.begin)
+                    << expr;
+                EXPECT_STREQ(error.what, expected.error().what) << expr;
+            }
+        }
+    }
+}
+
+TEST(ParserCompileTest, FindsErrorsOnce)
+{
+    Parser calc;
+    calc.unit_system.add_new_unit(
+        Unit_information{"meter", Unit_type::length, 0, 1});
+    calc.unit_system.add_new_unit(
+        Unit_information{"second", Unit_type::time, 0, 1});
+
+    const auto compile = [&calc](const string &expr, Numeric_program &program)
+    {
+        return calc.compile(tokenize(expr), {"x"}, program);
+    };
+
+    Numeric_program program;
+    EXPECT_EQ(compile("x meter + 1 second", program).code,
+              Evaluation_errc::incompatible_units);
+    EXPECT_FALSE(program);
+    EXPECT_EQ(compile("x parsec", program).code,
+              Evaluation_errc::unknown_unit);
+    EXPECT_EQ(compile("x +", program).code, Evaluation_errc::syntax_error);
+    EXPECT_EQ(compile("", program).code, Evaluation_errc::syntax_error);
+
+    // errors that depend on the values are found when running
+    ASSERT_EQ(compile("1 / x", program).code, Evaluation_errc::none);
+    double value;
+    EXPECT_EQ(program.run({0}, value).code, Evaluation_errc::division_by_zero);
+    EXPECT_EQ(program.run({4}, value).code, Evaluation_errc::none);
+    EXPECT_EQ(value, 0.25);
+
+    // the units of other variables aren't known ahead of time
+    for (const string expr : {"x + z", "z = x", "let z = x"})
+    {
+        EXPECT_EQ(compile(expr, program).code, Evaluation_errc::none);
+        EXPECT_FALSE(program) << expr;
+    }
+}
+
+TEST(ParserUnitlessTest, MatchesPrimaries)
+{
+    Parser calc;
+    calc.evaluate("let x = 0");
+
+    // the same expression with and without a variable takes either path
+    for (const string expr : {"(-8) ^ (1 / 3)", "(-8) ^ 0.5", "0 ^ -1",
+                              "3.5!", "(-1)!", "7 % 0", "7 % -3", "-0 * 5",
+                              "1 / 3 * 3", "2 ^ 3 ^ 2", "-2 ^ 2"})
+    {
+        const auto plain = calc.try_evaluate(expr);
+        const auto with_variable = calc.try_evaluate("x + (" + expr + ")");
+        ASSERT_EQ(bool(plain), bool(with_variable)) << expr;
+        if (plain)
+        {
+            EXPECT_EQ(plain.value().get_value(),
+                      with_variable.value().get_value())
+                << expr;
+            EXPECT_EQ(plain.value().get_units(), "") << expr;
+        }
+        else
+        {
+            EXPECT_EQ(plain.error().code, with_variable.error().code) << expr;
+            EXPECT_STREQ(plain.error().what, with_variable.error().what)
+                << expr;
+        }
+    }
+
+    EXPECT_EQ(calc.evaluate("let y = 6 * 7").get_value(), 42);
+    EXPECT_EQ(calc.evaluate("y").get_value(), 42);
+}
+
+TEST(VariableStoreTest, MatchesMap)
+{
+    Parser calc;
+    calc.unit_system.add_new_unit(
+        Unit_information{"meter", Unit_type::length, 0, 1});
+    calc.unit_system.add_new_unit(
+        Unit_information{"second", Unit_type::time, 0, 1});
+
+    map<string, Primary> table;
+    Variable_store store;
+    const vector<string> statements{
+        "let x = 2 meter", "let y = x / 4 second", "let z = 7", "x + z",
+        "let x = 1", "y = z", "z = y * 3 second", "(x = x * x) + 1 meter",
+        "w", "let w = x ^ 2", "w", "z + 1", "1 / 0", "z = 2 meter / second",
+        "y + z"};
+    for (const auto &s : statements)
+    {
+        const auto in_map = calc.try_evaluate(s, table);
+        const auto in_store = calc.try_evaluate(s, store);
+        ASSERT_EQ(bool(in_map), bool(in_store)) << s;
+        if (in_map)
+        {
+            EXPECT_EQ(in_map.value().get_value(),
+                      in_store.value().get_value())
+                << s;
+            EXPECT_EQ(in_map.value().get_units(),
+                      in_store.value().get_units())
+                << s;
+        }
+        else
+        {
+            EXPECT_EQ(in_map.error().code, in_store.error().code) << s;
+        }
+    }
+
+    ASSERT_EQ(store.size(), table.size());
+    for (const auto &[name, value] : table)
+    {
+        const auto stored = store.get(name);
+        ASSERT_TRUE(stored) << name;
+        EXPECT_EQ(stored->get_value(), value.get_value()) << name;
+        EXPECT_EQ(stored->get_units(), value.get_units()) << name;
+    }
+    EXPECT_FALSE(store.contains("v"));
+    EXPECT_THROW(calc.evaluate("let x = 3", store), Runtime_error);
+    EXPECT_THROW(calc.evaluate(tokenize("x + v"), store), Runtime_error);
+}
+
+TEST(VariableStoreTest, ManyVariables)
+{
+    Unit_system units;
+    Variable_store store;
+    const auto n = 1'000'000;
+
+    // names of shared prefixes and lengths, through many rehashes
+    std::size_t name_bytes = 0;
+    for (auto i = 0; i < n; ++i)
+    {
+        const auto name = "v" + std::to_string(i);
+        store.set(name, Primary{double(i), units});
+        name_bytes += name.size();
+    }
+    store.set("v17", Primary{-1, units});
+
+    ASSERT_EQ(store.size(), std::size_t(n));
+    for (auto i = 0; i < n; i += 997)
+    {
+        EXPECT_EQ(store.get("v" + std::to_string(i))->get_value(),
+                  i == 17 ? -1 : i);
+    }
+    EXPECT_FALSE(store.get("v" + std::to_string(n)));
+    EXPECT_FALSE(store.get(""));
+
+    // the names, with room to grow, and under 32 bytes for each variable
+    EXPECT_LT(store.name_capacity(), 2 * name_bytes);
+    EXPECT_LT(store.memory_used() - store.name_capacity(), 32u * n);
+
+    Variable_store reserved;
+    reserved.reserve(n, name_bytes);
+    for (auto i = 0; i < n; ++i)
+    {
+        reserved.set("v" + std::to_string(i), Primary{double(i), units});
+    }
+    EXPECT_LT(reserved.memory_used() - reserved.name_capacity(), 32u * n);
+    EXPECT_LT(reserved.name_capacity(), name_bytes + 32);
+}
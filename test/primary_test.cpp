@@ -326,6 +326,42 @@ TEST(Primary, SameCompoundUnit)
     EXPECT_NEAR((a % b).get_value(), fmod(3.14, 2.71), 0.01);
 }
 
+TEST(Primary, GetUnits)
+{
+    auto usys = Unit_system();
+
+    usys.add_new_unit(
+        Unit_information{
+            "meter",
+            Unit_type::length,
+            0, 1});
+
+    usys.add_new_unit(
+        Unit_information{
+            "second",
+            Unit_type::time,
+            0, 1});
+
+    EXPECT_EQ(Primary(1, usys).get_units(), "");
+    EXPECT_EQ(Primary(1, usys, "meter").get_units(), "meter");
+    EXPECT_EQ(Primary(1, usys, {"meter"}, {"second"}).get_units(),
+              "meter / second");
+    EXPECT_EQ(Primary(1, usys, {}, {"second"}).get_units(), "/second");
+}
+
+TEST(Primary, HasUnitsOf)
+{
+    auto usys = Unit_system();
+    usys.add_new_unit(Unit_information{"meter", Unit_type::length, 0, 1});
+    usys.add_new_unit(Unit_information{"second", Unit_type::time, 0, 1});
+
+    const Primary speed{1, usys, {"meter"}, {"second"}};
+    EXPECT_TRUE(speed.has_units_of(Primary(7, usys, {"meter"}, {"second"})));
+    EXPECT_FALSE(speed.has_units_of(Primary(1, usys, "meter")));
+    EXPECT_FALSE(speed.has_units_of(Primary(1, usys, {"second"}, {"meter"})));
+    EXPECT_TRUE(Primary(1, usys).has_units_of(Primary(2, usys)));
+}
+
 TEST(Primary, DifferentCompoundUnits)
 {
     auto usys = Unit_system();
@@ -614,3 +650,49 @@ TEST(AdditionCompatibility, DifferentUnits)
         {{Unit_type::length, {"meter", 3}}, {Unit_type::mass, {"kg", 2}}},
         {{Unit_type::length, {"miles", 3}}, {Unit_type::time, {"hour", 2}}}));
 }
+
+TEST(Primary, CheckWithoutThrowing)
+{
+    Unit_system usys;
+    usys.add_new_unit(Unit_information{"meter", Unit_type::length, 0, 1});
+    usys.add_new_unit(Unit_information{"second", Unit_type::time, 0, 1});
+    const Primary length{2, usys, "meter"};
+    const Primary time{3, usys, "second"};
+    const Primary zero{0, usys};
+
+    EXPECT_TRUE(length.check('*', time));
+    EXPECT_EQ(length.check('+', time).code, Primary_errc::incompatible_units);
+    EXPECT_THROW(length + time, Incompatible_units);
+    EXPECT_EQ(length.check('/', zero).code, Primary_errc::division_by_zero);
+    EXPECT_STREQ(length.check('/', zero).what,
+                 "Division by 0 is not allowed.");
+    EXPECT_EQ(zero.check('^', zero).code, Primary_errc::invalid_operands);
+    EXPECT_EQ(Primary(-1, usys).check_factorial().code,
+              Primary_errc::invalid_operands);
+    EXPECT_TRUE(usys.has_unit("meter"));
+    EXPECT_FALSE(usys.has_unit("parsec"));
+}
+
+TEST(DimensionTest, FollowsPrimary)
+{
+    Unit_system usys;
+    usys.add_new_unit(Unit_information{"meter", Unit_type::length, 0, 1});
+    usys.add_new_unit(Unit_information{"foot", Unit_type::length, 0, 0.3048});
+    usys.add_new_unit(Unit_information{"second", Unit_type::time, 0, 1});
+    const Dimension meter{usys, "meter"};
+    const Dimension foot{usys, "foot"};
+    const Dimension second{usys, "second"};
+
+    EXPECT_TRUE(meter.check('+', foot));
+    EXPECT_EQ(meter.combine('+', foot), foot);
+    EXPECT_EQ(meter.check('-', second).code, Primary_errc::incompatible_units);
+    EXPECT_TRUE(meter.check('/', second));
+
+    const auto speed = meter.combine('/', second);
+    EXPECT_EQ(speed.get_units(), (Primary{1, usys, "meter"} /
+                                  Primary{1, usys, "second"})
+                                     .get_units());
+    EXPECT_EQ(speed.combine('*', second), meter);
+    EXPECT_EQ(Dimension{Primary(2, usys, "foot")}, foot);
+    EXPECT_EQ(meter.combine('^', Dimension{}), Dimension{});
+}
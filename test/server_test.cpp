@@ -0,0 +1,537 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "server/client.hpp"
+#include "server/exceptions.hpp"
+#include "server/protocol.hpp"
+#include "server/server.hpp"
+#include "server/shm_channel.hpp"
+#include "parser/parser.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::string;
+using std::thread;
+using std::vector;
+
+namespace
+{
+    /**
+     * A blocking client connected to a Server.
+     */
+    class Socket_client
+    {
+    public:
+        explicit Socket_client(const string &path)
+        {
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+            fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            EXPECT_EQ(::connect(fd, reinterpret_cast<sockaddr *>(&addr),
+                                sizeof(addr)),
+                      0);
+        }
+
+        explicit Socket_client(int port)
+        {
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(static_cast<uint16_t>(port));
+            fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            EXPECT_EQ(::connect(fd, reinterpret_cast<sockaddr *>(&addr),
+                                sizeof(addr)),
+                      0);
+        }
+
+        ~Socket_client()
+        {
+            ::close(fd);
+        }
+
+        void send(const string &s)
+        {
+            ASSERT_EQ(::write(fd, s.data(), s.size()),
+                      static_cast<ssize_t>(s.size()));
+        }
+
+        void finish()
+        {
+            ::shutdown(fd, SHUT_WR);
+        }
+
+        /**
+         * Read until lines lines have arrived, or until the server closes
+         * the connection if lines is 0.
+         */
+        string receive(int lines = 0)
+        {
+            string received;
+            char buf[4096];
+            while (lines == 0 || count_lines(received) < lines)
+            {
+                const auto n = ::read(fd, buf, sizeof(buf));
+                if (n <= 0)
+                {
+                    break;
+                }
+                received.append(buf, n);
+            }
+            return received;
+        }
+
+    private:
+        static int count_lines(const string &s)
+        {
+            int n = 0;
+            for (auto c : s)
+            {
+                n += c == '\n';
+            }
+            return n;
+        }
+
+        int fd;
+    };
+
+    string socket_path()
+    {
+        return testing::TempDir() + "pcalc_server_test.sock";
+    }
+}
+
+TEST(ServerTest, SessionsAreIndependent)
+{
+    Parser calc;
+    Server_options options;
+    options.unix_path = socket_path();
+    options.threads = 2;
+    Server server{calc, options};
+    thread serving{[&server]()
+                   { server.run(); }};
+
+    {
+        Socket_client a{options.unix_path};
+        Socket_client b{options.unix_path};
+
+        a.send("let x = 2\n");
+        EXPECT_EQ(a.receive(1), "= 2\n");
+        b.send("x\n");
+        EXPECT_EQ(b.receive(1), "! Variable not found.\n");
+        b.send("let x = 5\n");
+        EXPECT_EQ(b.receive(1), "= 5\n");
+        a.send("x * 21\n");
+        EXPECT_EQ(a.receive(1), "= 42\n");
+    }
+
+    server.stop();
+    serving.join();
+}
+
+TEST(ServerTest, AnswersPipelinedLinesInOrder)
+{
+    Parser calc;
+    Server_options options;
+    options.tcp_port = 0;
+    Server server{calc, options};
+    ASSERT_NE(server.port(), 0);
+    thread serving{[&server]()
+                   { server.run(); }};
+
+    {
+        Socket_client c{server.port()};
+        c.send("let x = 2\r\nx = x * 21\nx + y\n4 $ 2\n\nx ");
+        c.send("/ 4\n");
+        EXPECT_EQ(c.receive(6), "= 2\n"
+                                "= 42\n"
+                                "! Variable not found.\n"
+                                "! Unknown token.\n"
+                                "! Empty expression.\n"
+                                "= 10.5\n");
+    }
+
+    server.stop();
+    serving.join();
+}
+
+TEST(ServerTest, TokenizesLinesSplitAnywhere)
+{
+    Parser calc;
+    Server_options options;
+    options.unix_path = socket_path();
+    Server server{calc, options};
+    thread serving{[&server]()
+                   { server.run(); }};
+
+    {
+        Socket_client c{options.unix_path};
+        // the pauses let the server read the pieces one at a time
+        for (const string piece :
+             {"let dist", "ance = 4.2", "e", "1 * 2\n:sess", "ion other\n",
+              "dista", "nce\nlet y = 4.2e", "+1\n2 $ dist", "ance\n1e", "\n"})
+        {
+            c.send(piece);
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        EXPECT_EQ(c.receive(6), "= 84\n"
+                                "= session other\n"
+                                "! Variable not found.\n"
+                                "= 42\n"
+                                "! Unknown token.\n"
+                                "! Not a valid number.\n");
+    }
+
+    server.stop();
+    serving.join();
+}
+
+TEST(ServerTest, AnswersEverythingBeforeClosing)
+{
+    Parser calc;
+    Server_options options;
+    options.unix_path = socket_path();
+    Server server{calc, options};
+    thread serving{[&server]()
+                   { server.run(); }};
+
+    {
+        Socket_client c{options.unix_path};
+        string script;
+        string expected;
+        for (int i = 0; i < 20000; ++i)
+        {
+            script += std::to_string(i) + " * 2\n";
+            expected += "= " + std::to_string(i * 2) + "\n";
+        }
+        script += "1 + 1";
+        expected += "= 2\n";
+
+        thread sender{[&c, &script]()
+                      {
+                          c.send(script);
+                          c.finish();
+                      }};
+        EXPECT_EQ(c.receive(), expected);
+        sender.join();
+    }
+
+    server.stop();
+    serving.join();
+}
+
+TEST(ServerTest, RefusesSocketInUse)
+{
+    Parser calc;
+    Server_options options;
+    options.unix_path = socket_path();
+    Server server{calc, options};
+
+    EXPECT_THROW(Server(calc, options), Server_error);
+}
+
+TEST(ServerTest, NamedSessionsPersist)
+{
+    Parser calc;
+    Server_options options;
+    options.unix_path = socket_path();
+    options.threads = 2;
+    Server server{calc, options};
+    thread serving{[&server]()
+                   { server.run(); }};
+
+    EXPECT_EQ(Client::connect(options.unix_path)
+                  ->ask({":session work", "let x = 6"}),
+              (vector<string>{"= session work", "= 6"}));
+    EXPECT_EQ(Client::connect(options.unix_path)
+                  ->ask({":session other", "x"}),
+              (vector<string>{"= session other", "! Variable not found."}));
+    EXPECT_EQ(Client::connect(options.unix_path)
+                  ->ask({":session  work ", "x * 7", ":session"}),
+              (vector<string>{"= session work", "= 42",
+                              "! Session name expected."}));
+    EXPECT_EQ(Client::connect(options.unix_path)->ask({"x"}),
+              (vector<string>{"! Variable not found."}));
+
+    server.stop();
+    serving.join();
+}
+
+TEST(ClientTest, NoServer)
+{
+    EXPECT_EQ(Client::connect(socket_path()), nullptr);
+}
+
+TEST(ClientTest, ListensInPrivateDirectory)
+{
+    const auto runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+    const string saved = runtime_dir ? runtime_dir : "";
+    ::unsetenv("XDG_RUNTIME_DIR");
+    const auto path = default_socket_path();
+    if (runtime_dir)
+    {
+        ::setenv("XDG_RUNTIME_DIR", saved.c_str(), 1);
+    }
+
+    struct stat status;
+    ASSERT_EQ(::lstat(path.substr(0, path.rfind('/')).c_str(), &status), 0);
+    EXPECT_TRUE(S_ISDIR(status.st_mode));
+    EXPECT_EQ(status.st_mode & 0777, 0700u);
+    EXPECT_EQ(status.st_uid, ::geteuid());
+
+    int fds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    EXPECT_TRUE(is_peer_this_user(fds[0]));
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+TEST(ProtocolTest, WritesLittleEndian)
+{
+    string frame;
+    Frame_writer w{frame};
+    w.u8(1);
+    w.u16(0x0203);
+    w.u32(0x04050607);
+    w.f64(-2.5);
+    w.str16("ab");
+
+    EXPECT_EQ(frame.substr(0, 7), string("\x01\x03\x02\x07\x06\x05\x04", 7));
+
+    Frame_reader r{frame};
+    EXPECT_EQ(r.u8(), 1);
+    EXPECT_EQ(r.u16(), 0x0203);
+    EXPECT_EQ(r.u32(), 0x04050607u);
+    EXPECT_EQ(r.f64(), -2.5);
+    EXPECT_EQ(r.str16(), "ab");
+    EXPECT_TRUE(r.done());
+    EXPECT_THROW(r.u8(), Protocol_error);
+}
+
+TEST(ServerTest, AnswersBinaryFrames)
+{
+    Parser calc;
+    calc.unit_system.add_new_unit(
+        Unit_information{"meter", Unit_type::length, 0, 1});
+    Server_options options;
+    options.unix_path = socket_path();
+    Server server{calc, options};
+    thread serving{[&server]()
+                   { server.run(); }};
+
+    {
+        auto client = Client::connect(options.unix_path);
+        Request_frame frame;
+        frame.compile({"x", "y"}, "x * y");
+        frame.compile({}, "(x + 1) meter");
+        frame.compile({}, "4 $");
+        frame.compile({"x"}, "x = x * 2");
+        frame.evaluate(0, {6, 7});
+        frame.evaluate(1, {});
+        frame.evaluate(2, {3});
+        frame.evaluate(1, {});
+        frame.evaluate(0, {1});
+        frame.evaluate(7, {});
+        frame.evaluate(0, {1, 0});
+        const auto r = client->ask(frame);
+
+        ASSERT_EQ(r.size(), 11u);
+        EXPECT_EQ(r[0].type, Message_type::compile);
+        EXPECT_EQ(r[0].error, Error_code::none);
+        EXPECT_EQ(r[0].handle, 0u);
+        EXPECT_EQ(r[1].handle, 1u);
+        EXPECT_EQ(r[2].error, Error_code::unknown_token);
+        EXPECT_EQ(r[3].handle, 2u);
+        EXPECT_EQ(r[4].type, Message_type::evaluate);
+        EXPECT_EQ(r[4].value, 42);
+        EXPECT_EQ(r[4].unit, 0u);
+        // programs compiled down to numbers bind no variables...
+        EXPECT_EQ(r[5].error, Error_code::runtime_error);
+        // ...but the others do, and their bindings stay in the variables of
+        // the connection
+        EXPECT_EQ(r[6].value, 6);
+        EXPECT_EQ(r[7].value, 7);
+        EXPECT_NE(r[7].unit, 0u);
+        EXPECT_EQ(r[8].error, Error_code::wrong_argument_count);
+        EXPECT_EQ(r[9].error, Error_code::unknown_handle);
+        EXPECT_EQ(r[10].value, 0);
+
+        frame.clear();
+        frame.describe_unit(r[7].unit);
+        frame.describe_unit(1000);
+        const auto units = client->ask(frame);
+        ASSERT_EQ(units.size(), 2u);
+        EXPECT_EQ(units[0].units, "meter");
+        EXPECT_EQ(units[1].error, Error_code::unknown_unit_signature);
+    }
+
+    {
+        // a malformed frame ends the connection: this evaluate request is
+        // cut short
+        Socket_client c{options.unix_path};
+        c.send(string("\0\x03\0\0\0\x02\0\0", 8));
+        EXPECT_EQ(c.receive(), "");
+    }
+
+    server.stop();
+    serving.join();
+}
+
+TEST(ShmChannelTest, CarriesMessagesAcrossMappings)
+{
+    auto channel = Shm_channel::create(64);
+    auto other = Shm_channel::attach(::dup(channel->fd()));
+
+    // messages wrap around the small ring many times
+    thread producer{[&channel]()
+                    {
+                        for (int i = 0; i < 10000; ++i)
+                        {
+                            channel->requests().push(string(i % 40, 'a' + i % 26));
+                        }
+                        channel->requests().push("");
+                    }};
+
+    string message;
+    for (int i = 0; i < 10000; ++i)
+    {
+        ASSERT_TRUE(other->requests().pop(message));
+        EXPECT_EQ(message, string(i % 40, 'a' + i % 26));
+    }
+    ASSERT_TRUE(other->requests().pop(message));
+    EXPECT_EQ(message, "");
+    producer.join();
+
+    EXPECT_THROW(channel->requests().push(string(61, 'x')), Protocol_error);
+
+    other->close();
+    EXPECT_FALSE(channel->responses().pop(message));
+    EXPECT_THROW(channel->responses().push("x"), Server_error);
+}
+
+TEST(ShmChannelTest, RefusesResizableMemory)
+{
+    auto channel = Shm_channel::create(64);
+    EXPECT_LT(::ftruncate(channel->fd(), 4096), 0);
+    EXPECT_LT(::ftruncate(channel->fd(), 16), 0);
+
+    // memory as a client could make it, then shrink it
+    const auto fd = ::memfd_create("unsealed", MFD_CLOEXEC);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(::ftruncate(fd, 1 << 16), 0);
+    EXPECT_THROW(Shm_channel::attach(fd), Protocol_error);
+}
+
+TEST(ServerTest, AnswersThroughSharedMemory)
+{
+    Parser calc;
+    Server_options options;
+    options.unix_path = socket_path();
+    auto server = std::make_unique<Server>(calc, options);
+    thread serving{[&server]()
+                   { server->run(); }};
+
+    auto client = Shm_client::connect(options.unix_path, 1 << 12);
+    ASSERT_NE(client, nullptr);
+
+    Request_frame frame;
+    frame.compile({"x"}, "x ^ 2");
+    ASSERT_EQ(client->ask(frame)[0].handle, 0u);
+    for (int i = 0; i < 1000; ++i)
+    {
+        frame.clear();
+        frame.evaluate(0, {static_cast<double>(i)});
+        frame.evaluate(0, {-static_cast<double>(i)});
+        const auto r = client->ask(frame);
+        ASSERT_EQ(r.size(), 2u);
+        EXPECT_EQ(r[0].value, i * i);
+        EXPECT_EQ(r[1].value, i * i);
+    }
+
+    server->stop();
+    serving.join();
+    server.reset();
+
+    // the server is gone
+    frame.clear();
+    frame.evaluate(0, {1});
+    EXPECT_THROW(client->ask(frame), Server_error);
+}
+
+TEST(ServerTest, CountsCoalescedRequests)
+{
+    Parser calc;
+    Server_options options;
+    options.unix_path = socket_path();
+    Server server{calc, options};
+    thread serving{[&server]()
+                   { server.run(); }};
+
+    {
+        Socket_client c{options.unix_path};
+        c.send("2 ^ 10\n2^10\nlet y = 3\ny ^ 10\n3 ^ 10\n:stats\n");
+        EXPECT_EQ(c.receive(6), "= 1024\n= 1024\n= 3\n= 59049\n= 59049\n"
+                                "= requests 5, pure 3, coalesced 0, "
+                                "reused 1, shapes 3, shape repeats 2, "
+                                "compiled runs 0\n");
+    }
+
+    server.stop();
+    serving.join();
+
+    EXPECT_EQ(server.counters().reused, 1u);
+}
+
+TEST(ServerTest, ChecksUnitsWhenCompiling)
+{
+    Parser calc;
+    calc.unit_system.add_new_unit(
+        Unit_information{"meter", Unit_type::length, 0, 1});
+    calc.unit_system.add_new_unit(
+        Unit_information{"foot", Unit_type::length, 0, 0.3048});
+    calc.unit_system.add_new_unit(
+        Unit_information{"second", Unit_type::time, 0, 1});
+    Server_options options;
+    options.unix_path = socket_path();
+    Server server{calc, options};
+    thread serving{[&server]()
+                   { server.run(); }};
+
+    {
+        auto client = Client::connect(options.unix_path);
+        Request_frame frame;
+        frame.compile({"x"}, "x meter + 1 second");
+        frame.compile({"x", "y"}, "x foot + y meter");
+        frame.compile({"x"}, "1 / x");
+        // a failed compile takes no handle
+        frame.evaluate(0, {1, 2});
+        frame.evaluate(1, {0});
+        const auto r = client->ask(frame);
+
+        ASSERT_EQ(r.size(), 5u);
+        EXPECT_EQ(r[0].error, Error_code::incompatible_units);
+        EXPECT_EQ(r[1].error, Error_code::none);
+        EXPECT_EQ(r[2].handle, 1u);
+        EXPECT_EQ(r[3].error, Error_code::none);
+        EXPECT_EQ(r[3].value, calc.evaluate("1 foot + 2 meter").get_value());
+        EXPECT_EQ(r[4].error, Error_code::division_by_zero);
+
+        frame.clear();
+        frame.describe_unit(r[3].unit);
+        EXPECT_EQ(client->ask(frame)[0].units, "meter");
+    }
+
+    server.stop();
+    serving.join();
+}
@@ -161,3 +161,319 @@ TEST(TokenizeTest, BadVarNames)
     EXPECT_THROW(tokenize("$xyz"), Unknown_token);
     EXPECT_THROW(tokenize("xyz$"), Unknown_token);
 }
+
+TEST(TokenizeTest, ReadsInPlace)
+{
+    // only the first five characters belong to the expression
+    const std::string buffer = "12 x!9999";
+    const auto toks = tokenize(std::string_view{buffer}.substr(0, 5));
+
+    ASSERT_EQ(toks.size(), 3);
+    EXPECT_EQ(toks[0].kind, Token_type::number);
+    EXPECT_DOUBLE_EQ(toks[0].val, 12);
+    EXPECT_EQ(toks[1].kind, Token_type::identifier);
+    EXPECT_EQ(toks[1].name, "x");
+    EXPECT_EQ(toks[2].kind, Token_type::operator_type);
+    EXPECT_EQ(toks[2].op, '!');
+
+    // "1e5" ends where the view ends, even though digits follow in memory
+    const std::string number = "1e59";
+    const auto n = tokenize(std::string_view{number}.substr(0, 3));
+    ASSERT_EQ(n.size(), 1);
+    EXPECT_DOUBLE_EQ(n[0].val, 1e5);
+}
+
+TEST(TokenizeTest, ReportsErrorsWithoutThrowing)
+{
+    Token_error error;
+    const auto toks = tokenize("12 + x$", error);
+
+    EXPECT_EQ(error.code, Token_errc::unknown_token);
+    EXPECT_EQ(error.offset, 6);
+    EXPECT_EQ(error.length, 1);
+    EXPECT_STREQ(error.what(), "Unknown token.");
+    ASSERT_EQ(toks.size(), 3);
+    EXPECT_EQ(toks[2].offset, 5);
+    EXPECT_EQ(toks[2].length, 1);
+
+    tokenize("1 + 1e999", error);
+    EXPECT_EQ(error.code, Token_errc::bad_number);
+    EXPECT_EQ(error.offset, 4);
+
+    tokenize("1 + 2", error);
+    EXPECT_EQ(error.code, Token_errc::none);
+}
+
+TEST(TokenizeTest, LongRuns)
+{
+    // runs longer than a block and ending at every position within one
+    for (std::size_t n = 1; n < 40; ++n)
+    {
+        const std::string name = "_" + std::string(n, 'Z') + "9";
+        const std::string digits(n, '7');
+        const std::string expr = std::string(n, ' ') + name + "\t\r\n\v\f" +
+                                 digits + "." + digits + "e+" + digits +
+                                 std::string(n, ' ');
+
+        Token_error error;
+        const auto toks = tokenize(expr, error);
+        ASSERT_EQ(error.code, n < 3 ? Token_errc::none : Token_errc::bad_number)
+            << n;
+        ASSERT_EQ(toks.size(), n < 3 ? 2u : 1u) << n;
+        EXPECT_EQ(toks[0].name, name);
+        EXPECT_EQ(toks[0].offset, n);
+        if (n < 3)
+        {
+            EXPECT_EQ(toks[1].length, 3 * n + 3);
+        }
+    }
+
+    // characters outside ASCII end a run in the middle of a block: a
+    // letter continues the name, a multiplication sign belongs to no token
+    Token_error error;
+    auto toks = tokenize("abcdefghijklmnop\xc3\xa9qrstuvwxyz", error);
+    EXPECT_EQ(error.code, Token_errc::none);
+    ASSERT_EQ(toks.size(), 1u);
+    EXPECT_EQ(toks[0].length, 28u);
+
+    toks = tokenize("abcdefghijklmnop\xc3\x97qrstuvwxyz", error);
+    EXPECT_EQ(error.code, Token_errc::unknown_token);
+    EXPECT_EQ(error.offset, 16u);
+    EXPECT_EQ(error.length, 2u);
+    ASSERT_EQ(toks.size(), 1u);
+    EXPECT_EQ(toks[0].name, "abcdefghijklmnop");
+}
+
+TEST(TokenizeTest, UnicodeIdentifiers)
+{
+    // µs, Ω (Greek), Ω (ohm sign), °C, été, 半径 and a mathematical bold A
+    for (const std::string name :
+         {"\xc2\xb5s", "\xce\xa9", "\xe2\x84\xa6", "\xc2\xb0" "C",
+          "\xc3\xa9t\xc3\xa9", "\xe5\x8d\x8a\xe5\xbe\x84",
+          "\xf0\x9d\x90\x80"})
+    {
+        const auto toks = tokenize("2 " + name + "*" + name);
+        ASSERT_EQ(toks.size(), 4u) << name;
+        EXPECT_EQ(toks[1].kind, Token_type::identifier) << name;
+        EXPECT_EQ(toks[1].name, name);
+        EXPECT_EQ(toks[1].offset, 2u) << name;
+        EXPECT_EQ(toks[1].length, name.size()) << name;
+        EXPECT_EQ(toks[3].name, name);
+    }
+
+    // digits and combining marks go on with a name but don't start one
+    EXPECT_THROW(tokenize("\xcc\x81" "a"), Unknown_token);
+    EXPECT_EQ(tokenize("a\xcc\x81").size(), 1u);
+    EXPECT_THROW(tokenize("\xd9\xa3"), Unknown_token);
+    EXPECT_EQ(tokenize("x\xd9\xa3").size(), 1u);
+
+    // symbols (€, subscript 1), spaces outside ASCII and invalid UTF-8
+    // (a stray byte, overlong, a surrogate, cut short) aren't tokens
+    for (const std::string bad :
+         {"\xe2\x82\xac", "\xe2\x82\x81", "\xc2\xa0", "\xff",
+          "\xc0\xaf", "\xed\xa0\x80", "\xc3"})
+    {
+        Token_error error;
+        const auto toks = tokenize("a " + bad + " b", error);
+        EXPECT_EQ(error.code, Token_errc::unknown_token) << bad;
+        EXPECT_EQ(error.offset, 2u) << bad;
+        ASSERT_EQ(toks.size(), 1u) << bad;
+    }
+}
+
+TEST(TokenBufferTest, MatchesTokenize)
+{
+    Token_buffer buffer;
+    // one buffer for all of them: longer and shorter expressions in turn
+    for (const std::string expr :
+         {"let distance = 12.5e3 meter", "1", "(a + b_2) * -3!", "",
+          "x ^ 2 % 7 $ 4", "1.5e", "   width*height / 2  "})
+    {
+        Token_error expected_error;
+        const auto expected = tokenize(expr, expected_error);
+        Token_error error;
+        buffer.assign(expr, error);
+
+        EXPECT_EQ(error.code, expected_error.code) << expr;
+        EXPECT_EQ(error.offset, expected_error.offset) << expr;
+        ASSERT_EQ(buffer.size(), expected.size()) << expr;
+        EXPECT_EQ(buffer.empty(), expected.empty()) << expr;
+        for (std::size_t i = 0; i < expected.size(); ++i)
+        {
+            EXPECT_EQ(buffer.kind(i), expected[i].kind) << expr;
+            EXPECT_EQ(buffer.op(i), expected[i].op) << expr;
+            EXPECT_EQ(buffer.val(i), expected[i].val) << expr;
+            EXPECT_EQ(buffer.name(i), expected[i].name) << expr;
+            EXPECT_EQ(buffer.offset(i), expected[i].offset) << expr;
+            EXPECT_EQ(buffer.length(i), expected[i].length) << expr;
+
+            const auto t = buffer.token(i);
+            EXPECT_EQ(t.kind, expected[i].kind) << expr;
+            EXPECT_EQ(t.name, expected[i].name) << expr;
+        }
+    }
+
+    buffer.clear();
+    EXPECT_TRUE(buffer.empty());
+}
+
+TEST(TokenBufferTest, PullsOneTokenAtATime)
+{
+    Token_buffer buffer;
+    Token_error error;
+
+    buffer.start("  12 *x ");
+    ASSERT_TRUE(buffer.empty());
+    ASSERT_TRUE(buffer.pull(error));
+    ASSERT_EQ(buffer.size(), 1u);
+    EXPECT_EQ(buffer.val(0), 12);
+    EXPECT_EQ(buffer.offset(0), 2u);
+    ASSERT_TRUE(buffer.pull(error));
+    EXPECT_EQ(buffer.op(1), '*');
+    ASSERT_TRUE(buffer.pull(error));
+    EXPECT_EQ(buffer.name(2), "x");
+    EXPECT_FALSE(buffer.pull(error));
+    EXPECT_EQ(error.code, Token_errc::none);
+    EXPECT_EQ(buffer.size(), 3u);
+
+    // the tokens before a bad one are kept; the rest is never scanned
+    buffer.start("x $ 1.5e");
+    ASSERT_TRUE(buffer.pull(error));
+    EXPECT_EQ(buffer.name(0), "x");
+    EXPECT_FALSE(buffer.pull(error));
+    EXPECT_EQ(error.code, Token_errc::unknown_token);
+    EXPECT_EQ(error.offset, 2u);
+    EXPECT_EQ(buffer.size(), 1u);
+}
+
+TEST(TokenizeBatchTest, MatchesTokenize)
+{
+    const std::vector<std::string_view> lines{
+        "let distance = 12.5e3 meter", "", "(a + b_2) * -3!", "x $ 4",
+        "1.5e", "   width*height / 2  "};
+    std::string text;
+    for (const auto line : lines)
+    {
+        text.append(line).append("\n");
+    }
+
+    for (const auto &batch : {tokenize_batch(text), tokenize_batch(lines)})
+    {
+        ASSERT_EQ(batch.size(), lines.size());
+        for (std::size_t l = 0; l < lines.size(); ++l)
+        {
+            Token_error expected_error;
+            const auto expected = tokenize(lines[l], expected_error);
+            const auto tokens = batch.line(l);
+
+            EXPECT_EQ(batch.errors[l].code, expected_error.code) << lines[l];
+            EXPECT_EQ(batch.errors[l].offset, expected_error.offset)
+                << lines[l];
+            ASSERT_EQ(tokens.size(), expected.size()) << lines[l];
+            for (std::size_t i = 0; i < expected.size(); ++i)
+            {
+                EXPECT_EQ(tokens[i].kind, expected[i].kind) << lines[l];
+                EXPECT_EQ(tokens[i].op, expected[i].op) << lines[l];
+                EXPECT_EQ(tokens[i].val, expected[i].val) << lines[l];
+                EXPECT_EQ(tokens[i].name, expected[i].name) << lines[l];
+                EXPECT_EQ(tokens[i].offset, expected[i].offset) << lines[l];
+            }
+        }
+        // one array behind all the lines
+        EXPECT_EQ(batch.line(lines.size() - 1).end(),
+                  batch.tokens.data() + batch.tokens.size());
+    }
+
+    // like std::getline: no empty line after the last '\n', but one
+    // without a '\n' still counts
+    EXPECT_EQ(tokenize_batch("").size(), 0u);
+    EXPECT_EQ(tokenize_batch("\n").size(), 1u);
+    EXPECT_EQ(tokenize_batch("1\n2").size(), 2u);
+}
+
+namespace
+{
+    /**
+     * Expect the line the tokenizer is done with to match tokenize(line).
+     */
+    void expect_line(const Chunk_tokenizer &lines, const std::string &line,
+                     const std::string &how)
+    {
+        Token_error expected_error;
+        const auto expected = tokenize(line, expected_error);
+        EXPECT_EQ(lines.error().code, expected_error.code) << how;
+        EXPECT_EQ(lines.error().offset, expected_error.offset) << how;
+        EXPECT_EQ(lines.error().length, expected_error.length) << how;
+        ASSERT_EQ(lines.tokens().size(), expected.size()) << how;
+        for (std::size_t i = 0; i < expected.size(); ++i)
+        {
+            const auto &t = lines.tokens()[i];
+            EXPECT_EQ(t.kind, expected[i].kind) << how;
+            EXPECT_EQ(t.op, expected[i].op) << how;
+            EXPECT_EQ(t.val, expected[i].val) << how;
+            EXPECT_EQ(t.name, expected[i].name) << how;
+            EXPECT_EQ(t.offset, expected[i].offset) << how;
+            EXPECT_EQ(t.length, expected[i].length) << how;
+        }
+    }
+}
+
+TEST(ChunkTokenizerTest, SplitAnywhere)
+{
+    for (const std::string line :
+         {"4.2e1 * kilometer", "  let x_1 = .5e-3 / (y2+7)! ", "1e+x",
+          "3 $ 4", "12.5e", "1.2.3", "a1 2b", "", "x",
+          // 5 µs*Ω, °C€, x \xe2\x84 y (cut short in the line itself)
+          "5 \xc2\xb5s*\xce\xa9", "\xc2\xb0" "C\xe2\x82\xac", "x \xe2\x84 y"})
+    {
+        // in two pieces, split at every byte
+        for (std::size_t split = 0; split <= line.size(); ++split)
+        {
+            Chunk_tokenizer lines;
+            const auto input = line + "\n";
+            std::string_view rest{input};
+            rest.remove_prefix(lines.feed(rest.substr(0, split)));
+            ASSERT_FALSE(lines.line_done());
+            EXPECT_EQ(lines.feed(rest), rest.size());
+            ASSERT_TRUE(lines.line_done());
+            EXPECT_EQ(lines.line_size(), line.size());
+            expect_line(lines, line, line + " split at " +
+                                         std::to_string(split));
+        }
+
+        // a byte at a time, with no newline at the end
+        Chunk_tokenizer lines;
+        for (const char ch : line)
+        {
+            EXPECT_EQ(lines.feed(std::string_view{&ch, 1}), 1u);
+        }
+        lines.finish();
+        ASSERT_TRUE(lines.line_done());
+        expect_line(lines, line, line + " a byte at a time");
+    }
+}
+
+TEST(ChunkTokenizerTest, Lines)
+{
+    Chunk_tokenizer lines;
+    std::string_view input{"1 + 2\n$ 3\nabc"};
+
+    input.remove_prefix(lines.feed(input));
+    ASSERT_TRUE(lines.line_done());
+    EXPECT_EQ(lines.tokens().size(), 3u);
+
+    // the rest of the chunk is the next line's
+    lines.next_line();
+    input.remove_prefix(lines.feed(input));
+    ASSERT_TRUE(lines.line_done());
+    EXPECT_EQ(lines.error().code, Token_errc::unknown_token);
+    EXPECT_TRUE(lines.tokens().empty());
+
+    lines.next_line();
+    EXPECT_EQ(lines.feed(input), 3u);
+    EXPECT_FALSE(lines.line_done());
+    EXPECT_TRUE(lines.tokens().empty());
+    lines.finish();
+    ASSERT_EQ(lines.tokens().size(), 1u);
+    EXPECT_EQ(lines.tokens()[0].name, "abc");
+}
@@ -1,26 +1,384 @@
-#include <sstream>
+#include <algorithm>
+#include <array>
 #include <string>
-#include <cctype>
+#include <string_view>
+#include <cstdlib>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "token.hpp"
 #include "exceptions.hpp"
+#include "xid.hpp"
 
-using std::istringstream;
-using std::isalpha;
-using std::isalnum;
 using std::string;
+using std::string_view;
+using std::uint32_t;
 
-/**
- * Return a vector of tokens obtained from breaking the given string into
- * valid tokens.
- * If an unknown token is encountered, throw an Unknown_token exception.
-*/
-std::vector<Token> tokenize(const std::string& expr)
+namespace
 {
-    istringstream ss{expr};
-    std::vector<Token> toks;
-    for (char ch {}; ss >> ch; )
+    /**
+     * What a byte can be part of, as bit flags. Only ASCII bytes belong to
+     * any class; other characters are decoded from UTF-8 and looked up in
+     * the Unicode tables of xid.hpp.
+     */
+    enum Char_class : unsigned char
+    {
+        space = 1,
+        digit = 2,
+        // letters and '_': what identifiers start with
+        letter = 4,
+    };
+
+    constexpr std::array<unsigned char, 256> make_classes()
+    {
+        std::array<unsigned char, 256> classes{};
+        for (int c = 0; c < 256; ++c)
+        {
+            if (c == ' ' || (c >= '\t' && c <= '\r'))
+            {
+                classes[c] = space;
+            }
+            else if (c >= '0' && c <= '9')
+            {
+                classes[c] = digit;
+            }
+            else if (c == '_' || (c >= 'a' && c <= 'z') ||
+                     (c >= 'A' && c <= 'Z'))
+            {
+                classes[c] = letter;
+            }
+        }
+        return classes;
+    }
+
+    constexpr auto char_classes = make_classes();
+
+    bool is(char ch, unsigned char classes)
+    {
+        return char_classes[static_cast<unsigned char>(ch)] & classes;
+    }
+
+#ifdef __SSE2__
+    /**
+     * The bytes of block lo <= b <= hi, for ASCII lo and hi; bytes above
+     * 0x7f compare as negative and are never in range.
+     */
+    __m128i in_range(__m128i block, char lo, char hi)
+    {
+        return _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(lo - 1)),
+                             _mm_cmplt_epi8(block, _mm_set1_epi8(hi + 1)));
+    }
+
+    /**
+     * The bytes of block that belong to one of classes, as 0xff.
+     */
+    __m128i classify(__m128i block, unsigned char classes)
+    {
+        auto in = _mm_setzero_si128();
+        if (classes & space)
+        {
+            in = _mm_or_si128(in, _mm_cmpeq_epi8(block, _mm_set1_epi8(' ')));
+            in = _mm_or_si128(in, in_range(block, '\t', '\r'));
+        }
+        if (classes & digit)
+        {
+            in = _mm_or_si128(in, in_range(block, '0', '9'));
+        }
+        if (classes & letter)
+        {
+            // setting bit 5 turns upper case letters into lower case ones
+            // and nothing else into a letter
+            const auto lower = _mm_or_si128(block, _mm_set1_epi8(0x20));
+            in = _mm_or_si128(in, in_range(lower, 'a', 'z'));
+            in = _mm_or_si128(in, _mm_cmpeq_epi8(block, _mm_set1_epi8('_')));
+        }
+        return in;
+    }
+#endif
+
+    /**
+     * Return the end of the run of bytes of s, starting at i, that belong to
+     * one of classes. With SSE2, whole blocks of 16 bytes are classified at
+     * once, so long runs (padding, long names and numbers) are skipped
+     * quickly; the bytes after the last whole block are looked up one by
+     * one, so nothing past s is read.
+     */
+    size_t skip(string_view s, size_t i, unsigned char classes)
+    {
+#ifdef __SSE2__
+        for (; i + 16 <= s.size(); i += 16)
+        {
+            const auto block = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(s.data() + i));
+            const auto in = _mm_movemask_epi8(classify(block, classes));
+            if (in != 0xffff)
+            {
+                return i + __builtin_ctz(~in);
+            }
+        }
+#endif
+        while (i < s.size() && is(s[i], classes))
+        {
+            ++i;
+        }
+        return i;
+    }
+
+    /**
+     * Decode the UTF-8 sequence at s[i] into c and return its length, or
+     * return 0 if the bytes there aren't valid UTF-8, e.g., because s ends
+     * in the middle of the sequence.
+     */
+    size_t decode(string_view s, size_t i, char32_t &c)
+    {
+        const auto lead = static_cast<unsigned char>(s[i]);
+        size_t length;
+        // the smallest code point that needs length bytes: anything below
+        // is an overlong encoding
+        char32_t least;
+        if (lead < 0x80)
+        {
+            c = lead;
+            return 1;
+        }
+        else if (lead >= 0xc2 && lead <= 0xdf)
+        {
+            length = 2;
+            c = lead & 0x1f;
+            least = 0x80;
+        }
+        else if (lead >= 0xe0 && lead <= 0xef)
+        {
+            length = 3;
+            c = lead & 0x0f;
+            least = 0x800;
+        }
+        else if (lead >= 0xf0 && lead <= 0xf4)
+        {
+            length = 4;
+            c = lead & 0x07;
+            least = 0x10000;
+        }
+        else
+        {
+            return 0;
+        }
+
+        if (s.size() - i < length)
+        {
+            return 0;
+        }
+        for (size_t k = 1; k < length; ++k)
+        {
+            const auto b = static_cast<unsigned char>(s[i + k]);
+            if ((b & 0xc0) != 0x80)
+            {
+                return 0;
+            }
+            c = c << 6 | (b & 0x3f);
+        }
+
+        // surrogates aren't characters
+        if (c < least || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+        {
+            return 0;
+        }
+        return length;
+    }
+
+    /**
+     * The number of bytes at the end of s that begin a UTF-8 sequence cut
+     * short by the end of s, and in missing how many more it needs.
+     */
+    size_t cut_short(string_view s, size_t &missing)
     {
+        missing = 0;
+        for (size_t n = 1; n <= 3 && n <= s.size(); ++n)
+        {
+            const auto b = static_cast<unsigned char>(s[s.size() - n]);
+            if ((b & 0xc0) == 0x80)
+            {
+                continue;
+            }
+
+            const size_t length = b >= 0xf0   ? 4
+                                  : b >= 0xe0 ? 3
+                                  : b >= 0xc0 ? 2
+                                              : 1;
+            if (length > n)
+            {
+                missing = length - n;
+                return n;
+            }
+            return 0;
+        }
+        return 0;
+    }
+
+    /**
+     * The degree sign isn't a letter, but units such as °C start with it.
+     */
+    constexpr char32_t degree_sign = 0xb0;
+
+    /**
+     * The length of the character at s[i] if identifiers can start with
+     * it, or 0: an ASCII letter or '_', or a character with the XID_Start
+     * property.
+     */
+    size_t identifier_start(string_view s, size_t i)
+    {
+        if (is(s[i], letter))
+        {
+            return 1;
+        }
+
+        char32_t c;
+        const auto n = decode(s, i, c);
+        return n > 1 && (c == degree_sign || is_xid_start(c)) ? n : 0;
+    }
+
+    /**
+     * Return the end of the run of characters of s, starting at i, that
+     * identifiers can go on with: ASCII letters, digits and '_', and
+     * characters with the XID_Continue property. ASCII is skipped with
+     * skip(), a block of 16 bytes at a time; only the bytes above 0x7f it
+     * stops at are decoded.
+     */
+    size_t identifier_end(string_view s, size_t i)
+    {
+        while (true)
+        {
+            i = skip(s, i, letter | digit);
+            char32_t c;
+            const auto n = i < s.size() ? decode(s, i, c) : 0;
+            if (n < 2 || !(c == degree_sign || is_xid_continue(c)))
+            {
+                return i;
+            }
+            i += n;
+        }
+    }
+
+    /**
+     * Whether a token whose first byte is ch may be an identifier, going by
+     * that byte alone.
+     */
+    bool may_be_identifier(char ch)
+    {
+        return is(ch, letter) || static_cast<unsigned char>(ch) >= 0x80;
+    }
+
+    /**
+     * The length of the unknown token at s[i]: the whole character if it's
+     * valid UTF-8, a single byte otherwise.
+     */
+    size_t unknown_length(string_view s, size_t i)
+    {
+        char32_t c;
+        return std::max(decode(s, i, c), size_t{1});
+    }
+
+    /**
+     * Return the length of the longest prefix of s that looks like a number,
+     * following the same rules as reading a double from an input stream:
+     * digits, at most one decimal point and, once a digit has been seen, an
+     * optionally signed exponent.
+     *
+     * The prefix isn't guaranteed to be a valid number, e.g., "1e" or ".".
+     */
+    size_t number_prefix(string_view s)
+    {
+        auto i = skip(s, 0, digit);
+        bool found_digit = i > 0;
+        if (i < s.size() && s[i] == '.')
+        {
+            const auto fraction = i + 1;
+            i = skip(s, fraction, digit);
+            found_digit = found_digit || i > fraction;
+        }
+
+        if (found_digit && i < s.size() && (s[i] == 'e' || s[i] == 'E'))
+        {
+            ++i;
+            if (i < s.size() && (s[i] == '+' || s[i] == '-'))
+            {
+                ++i;
+            }
+            i = skip(s, i, digit);
+        }
+
+        return i;
+    }
+
+    /**
+     * Convert s, which must be a complete number, to a double in v. Return
+     * false if s isn't a number or doesn't fit in a double.
+     */
+    bool to_number(string_view s, double &v)
+    {
+        // strtod needs a terminated string; numbers are almost always short
+        // enough to be copied to the stack
+        char small[64];
+        string large;
+        const char *begin = small;
+        if (s.size() < sizeof(small))
+        {
+            s.copy(small, s.size());
+            small[s.size()] = '\0';
+        }
+        else
+        {
+            large = s;
+            begin = large.c_str();
+        }
+
+        char *end;
+        v = std::strtod(begin, &end);
+        return end == begin + s.size() && v != HUGE_VAL;
+    }
+
+    /**
+     * The length of a prefix of s that holds whatever of s continues a
+     * number: digits and at most the three others a number can have ('.',
+     * 'e' and a sign).
+     */
+    size_t number_continuation(string_view s)
+    {
+        size_t i = skip(s, 0, digit);
+        for (int others = 0; others < 3 && i < s.size(); ++others)
+        {
+            const char ch = s[i];
+            if (ch != '.' && ch != 'e' && ch != 'E' && ch != '+' && ch != '-')
+            {
+                break;
+            }
+            i = skip(s, i + 1, digit);
+        }
+        return i;
+    }
+
+    /**
+     * Scan the token of expr at i or after the spaces there, passing it to
+     * add(kind, op, value, offset, length), and move i past it. Return false
+     * if expr ends first or the token is bad, which is then reported in
+     * error.
+     */
+    template <class Add>
+    bool scan_token(string_view expr, size_t &i, Token_error &error, Add add)
+    {
+        if (i < expr.size() && is(expr[i], space))
+        {
+            i = skip(expr, i + 1, space);
+        }
+        if (i == expr.size())
+        {
+            return false;
+        }
+
+        const char ch = expr[i];
         switch (ch)
         {
         case '+':
@@ -33,8 +391,9 @@ std::vector<Token> tokenize(const std::string& expr)
         case '(':
         case ')':
         case '=':
-            toks.push_back({.kind = Token_type::operator_type, .op = ch});
-            break;
+            add(Token_type::operator_type, ch, 0.0, i, size_t{1});
+            ++i;
+            return true;
         case '.':
         case '0':
         case '1':
@@ -48,54 +407,390 @@ std::vector<Token> tokenize(const std::string& expr)
         case '9':
         {
             // read entire number
-            ss.putback(ch);
+            const auto len = number_prefix(expr.substr(i));
             double v;
-            ss >> v;
-
-            if (ss.fail())
+            if (!to_number(expr.substr(i, len), v))
             {
-                throw Bad_number{"Not a valid number."};
+                error = {Token_errc::bad_number, i, len};
+                return false;
             }
-
-            toks.push_back({.kind = Token_type::number, .val = v});
-            break;
+            add(Token_type::number, '\0', v, i, len);
+            i += len;
+            return true;
         }
         default:
             /**
-             * Read in a variable name or the name of a command, such as `let`
-            */
-            if (ch == '_' || isalpha(ch))
+             * Read in a variable name or the name of a command, such as
+             * `let`
+             */
+            if (const auto first = identifier_start(expr, i))
             {
-                string identifier(1, ch);
-                char next;
-                while (ss.get(next) && (next == '_' || isalnum(next)))
-                {
-                    identifier += next;
-                }
-
-                /**
-                 * The above loop has ended due to one of the following reasons:
-                 *  - ss has run out of characters
-                 *  - an illegal character for a variable name was read
-                 * 
-                 * If an illegal character for a variable name was read, it must
-                 * be putback because it might be useful to another part of the
-                 * program.
-                */
-                if (ss)
-                {
-                    ss.putback(next);
-                }
-
-                toks.push_back(
-                    {.kind = Token_type::identifier, .name = identifier}
-                );
-
-                break;
+                const auto len = identifier_end(expr, i + first) - i;
+                add(Token_type::identifier, '\0', 0.0, i, len);
+                i += len;
+                return true;
             }
-            throw Unknown_token{"Unknown token."};
+            error = {Token_errc::unknown_token, i, unknown_length(expr, i)};
+            return false;
         }
     }
 
+    /**
+     * Break expr into tokens, passing each to add(kind, op, value, offset,
+     * length), until its end or a bad token, which is then reported in
+     * error.
+     */
+    template <class Add>
+    void scan(string_view expr, Token_error &error, Add add)
+    {
+        error = Token_error{};
+        size_t i = 0;
+        while (scan_token(expr, i, error, add))
+        {
+        }
+    }
+
+    /**
+     * Append the tokens of expr to toks, up to a bad token, which is then
+     * reported in error.
+     */
+    void append_tokens(string_view expr, Token_error &error,
+                       std::vector<Token> &toks)
+    {
+        scan(expr, error,
+             [&toks, expr](Token_type kind, char op, double val,
+                           size_t offset, size_t length)
+             {
+                 Token t{kind, op, val, {}, static_cast<uint32_t>(offset),
+                         static_cast<uint32_t>(length)};
+                 if (kind == Token_type::identifier)
+                 {
+                     t.name = string{expr.substr(offset, length)};
+                 }
+                 toks.push_back(std::move(t));
+             });
+    }
+
+    void append_line(Token_batch &batch, string_view line)
+    {
+        batch.errors.emplace_back();
+        append_tokens(line, batch.errors.back(), batch.tokens);
+        batch.starts.push_back(batch.tokens.size());
+    }
+}
+
+const char *Token_error::what() const
+{
+    switch (code)
+    {
+    case Token_errc::unknown_token:
+        return "Unknown token.";
+    case Token_errc::bad_number:
+        return "Not a valid number.";
+    default:
+        return "";
+    }
+}
+
+/**
+ * Return a vector of tokens obtained from breaking the given string into
+ * valid tokens.
+ * If an unknown token is encountered, throw an Unknown_token exception.
+*/
+std::vector<Token> tokenize(std::string_view expr)
+{
+    Token_error error;
+    auto toks = tokenize(expr, error);
+    switch (error.code)
+    {
+    case Token_errc::unknown_token:
+        throw Unknown_token{error.what()};
+    case Token_errc::bad_number:
+        throw Bad_number{error.what()};
+    default:
+        return toks;
+    }
+}
+
+std::vector<Token> tokenize(std::string_view expr, Token_error &error)
+{
+    std::vector<Token> toks;
+    append_tokens(expr, error, toks);
     return toks;
 }
+
+Token_batch tokenize_batch(string_view text)
+{
+    Token_batch batch;
+    while (!text.empty())
+    {
+        const auto nl = std::min(text.find('\n'), text.size());
+        append_line(batch, text.substr(0, nl));
+        text.remove_prefix(std::min(nl + 1, text.size()));
+    }
+
+    return batch;
+}
+
+Token_batch tokenize_batch(const std::vector<string_view> &lines)
+{
+    Token_batch batch;
+    batch.starts.reserve(lines.size() + 1);
+    batch.errors.reserve(lines.size());
+    for (const auto line : lines)
+    {
+        append_line(batch, line);
+    }
+
+    return batch;
+}
+
+void Token_buffer::assign(string_view expr, Token_error &error)
+{
+    start(expr);
+    error = Token_error{};
+    while (pull(error))
+    {
+    }
+}
+
+void Token_buffer::start(string_view expr)
+{
+    clear();
+    source.assign(expr.data(), expr.size());
+}
+
+bool Token_buffer::pull(Token_error &error)
+{
+    return scan_token(
+        source, scanned, error,
+        [this](Token_type kind, char op, double val, size_t offset,
+               size_t length)
+        {
+            kinds.push_back(kind);
+            ops.push_back(op);
+            numbers.push_back(val);
+            offsets.push_back(offset);
+            lengths.push_back(length);
+        });
+}
+
+void Token_buffer::clear()
+{
+    kinds.clear();
+    ops.clear();
+    numbers.clear();
+    offsets.clear();
+    lengths.clear();
+    source.clear();
+    scanned = 0;
+}
+
+Token Token_buffer::token(size_t i) const
+{
+    return {kinds[i], ops[i], numbers[i], string{name(i)},
+            static_cast<uint32_t>(offsets[i]),
+            static_cast<uint32_t>(lengths[i])};
+}
+
+size_t Chunk_tokenizer::feed(string_view chunk)
+{
+    const auto newline = chunk.find('\n');
+    const auto piece = chunk.substr(0, newline);
+    if (!done)
+    {
+        scan(piece, newline != string_view::npos);
+        line_bytes += piece.size();
+        done = newline != string_view::npos;
+    }
+
+    return newline == string_view::npos ? chunk.size() : newline + 1;
+}
+
+void Chunk_tokenizer::finish()
+{
+    if (!done)
+    {
+        scan({}, true);
+        done = true;
+    }
+}
+
+void Chunk_tokenizer::next_line()
+{
+    line_tokens.clear();
+    bad = Token_error{};
+    partial.clear();
+    line_bytes = 0;
+    done = false;
+}
+
+void Chunk_tokenizer::scan(string_view piece, bool last)
+{
+    if (bad.code != Token_errc::none)
+    {
+        return;
+    }
+
+    size_t i = 0;
+    if (!partial.empty())
+    {
+        i = resume(piece, last);
+        if (bad.code != Token_errc::none || !partial.empty())
+        {
+            return;
+        }
+    }
+
+    // a character the chunk cuts short is scanned with the next chunk,
+    // together with the identifier before it, if any
+    size_t missing;
+    const auto tail = last ? 0 : cut_short(piece.substr(i), missing);
+    const auto visible = piece.substr(0, piece.size() - tail);
+
+    // a token that reaches the end of what can be scanned may go on in
+    // the next chunk
+    const auto keep = [this, piece, last](size_t offset, size_t length,
+                                          size_t end)
+    {
+        if (last || offset + length != end)
+        {
+            return false;
+        }
+        partial.assign(piece.data() + offset, length);
+        partial_offset = line_bytes + offset;
+        return true;
+    };
+    const auto add = [this, piece, &keep, &visible](Token_type kind, char op,
+                                                    double val, size_t offset,
+                                                    size_t length)
+    {
+        // a number can't go on with the character cut short
+        const auto end = kind == Token_type::identifier ? visible.size()
+                                                        : piece.size();
+        if (kind != Token_type::operator_type && keep(offset, length, end))
+        {
+            return;
+        }
+
+        Token t{kind, op, val, {}, static_cast<uint32_t>(line_bytes + offset),
+                static_cast<uint32_t>(length)};
+        if (kind == Token_type::identifier)
+        {
+            t.name = string{piece.substr(offset, length)};
+        }
+        line_tokens.push_back(std::move(t));
+    };
+
+    Token_error error;
+    while (partial.empty() && scan_token(visible, i, error, add))
+    {
+    }
+    // e.g., "4.2e" may be the start of "4.2e1"
+    if (error.code == Token_errc::bad_number &&
+        keep(error.offset, error.length, piece.size()))
+    {
+        return;
+    }
+    if (error.code != Token_errc::none)
+    {
+        bad = error;
+        bad.offset += line_bytes;
+        return;
+    }
+
+    if (tail > 0)
+    {
+        if (partial.empty())
+        {
+            partial_offset = line_bytes + visible.size();
+        }
+        partial.append(piece.substr(visible.size()));
+    }
+}
+
+size_t Chunk_tokenizer::resume(string_view piece, bool last)
+{
+    if (may_be_identifier(partial[0]))
+    {
+        return resume_identifier(piece, last);
+    }
+
+    // a number can't be told apart from what follows it by its bytes
+    // alone: "1e" is followed by "+5" or by "+x"
+    const auto before = partial.size();
+    partial.append(piece.data(), number_continuation(piece));
+    const auto length = number_prefix(partial);
+    const auto taken = length - before;
+
+    if (!last && taken == piece.size() && length == partial.size())
+    {
+        return taken;
+    }
+
+    double v;
+    if (!to_number(string_view{partial}.substr(0, length), v))
+    {
+        bad = {Token_errc::bad_number, partial_offset, length};
+    }
+    else
+    {
+        line_tokens.push_back({Token_type::number, '\0', v, {},
+                               static_cast<uint32_t>(partial_offset),
+                               static_cast<uint32_t>(length)});
+    }
+    partial.clear();
+    return taken;
+}
+
+size_t Chunk_tokenizer::resume_identifier(string_view piece, bool last)
+{
+    // first complete the character the last chunk cut short, if any
+    size_t missing;
+    cut_short(partial, missing);
+    size_t taken = 0;
+    while (missing > 0 && taken < piece.size() &&
+           (static_cast<unsigned char>(piece[taken]) & 0xc0) == 0x80)
+    {
+        ++taken;
+        --missing;
+    }
+    partial.append(piece.data(), taken);
+    if (!last && missing > 0 && taken == piece.size())
+    {
+        return taken;
+    }
+
+    const auto first = identifier_start(partial, 0);
+    auto length = first == 0 ? 0 : identifier_end(partial, first);
+    if (length > 0 && length == partial.size())
+    {
+        const auto end = identifier_end(piece, taken);
+        if (!last && end + cut_short(piece.substr(end), missing) ==
+                         piece.size())
+        {
+            partial.append(piece.substr(taken));
+            return piece.size();
+        }
+        partial.append(piece.substr(taken, end - taken));
+        taken = end;
+        length = partial.size();
+    }
+
+    if (length > 0)
+    {
+        line_tokens.push_back({Token_type::identifier, '\0', 0.0,
+                               partial.substr(0, length),
+                               static_cast<uint32_t>(partial_offset),
+                               static_cast<uint32_t>(length)});
+    }
+    // whatever else was kept is a single character, which identifiers
+    // can neither start nor go on with
+    if (length < partial.size())
+    {
+        bad = {Token_errc::unknown_token, partial_offset + length,
+               unknown_length(partial, length)};
+    }
+    partial.clear();
+    return taken;
+}
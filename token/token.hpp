@@ -7,10 +7,19 @@
  * - Token UDT to represent a calculator token
  * - Token_type UDT to differentiate between different types of Token
  * - The tokenize() function to get a vector of tokens from a string
+ * - Token_error UDT to report a bad token without throwing
+ * - Token_range UDT, a view of consecutive tokens
+ * - tokenize_batch() and the Token_batch UDT, the tokens of many lines in
+ *   one array
+ * - Token_buffer UDT, which stores tokens compactly and reuses its memory
+ * - Chunk_tokenizer UDT, which tokenizes lines that arrive in pieces
  */
 
+#include <cstddef>
+#include <cstdint>
 #include <istream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 enum class Token_type
@@ -26,8 +35,322 @@ struct Token
     char op{};          // in case the token is an operator
     double val{};       // in case the token is a number
     std::string name{}; // in case the token is an identifier
+    // where the token was found in the expression; 32 bits keep Tokens
+    // small, and only expressions over 4 GiB don't fit
+    std::uint32_t offset{};
+    std::uint32_t length{};
 };
 
-std::vector<Token> tokenize(const std::string &expr);
+enum class Token_errc
+{
+    none,
+    unknown_token,
+    bad_number,
+};
+
+/**
+ * Why and where tokenizing failed; code is Token_errc::none if it didn't.
+ */
+struct Token_error
+{
+    Token_errc code = Token_errc::none;
+    std::size_t offset = 0;
+    std::size_t length = 0;
+
+    /**
+     * The message of the exception tokenize() throws for this error.
+     */
+    const char *what() const;
+};
+
+/**
+ * expr is read in place and doesn't have to be terminated, so it can point
+ * into a larger buffer, e.g., a memory-mapped file.
+ */
+std::vector<Token> tokenize(std::string_view expr);
+
+/**
+ * Like tokenize(), but report a bad token in error instead of throwing. The
+ * tokens before the bad one are returned.
+ */
+std::vector<Token> tokenize(std::string_view expr, Token_error &error);
+
+/**
+ * A view of consecutive Tokens owned by something else, such as a
+ * vector<Token> or one line of a Token_batch.
+ */
+class Token_range
+{
+public:
+    Token_range() = default;
+
+    Token_range(const Token *first, std::size_t count)
+        : first{first}, count{count}
+    {
+    }
+
+    Token_range(const std::vector<Token> &tokens)
+        : first{tokens.data()}, count{tokens.size()}
+    {
+    }
+
+    const Token *begin() const
+    {
+        return first;
+    }
+
+    const Token *end() const
+    {
+        return first + count;
+    }
+
+    std::size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    const Token &operator[](std::size_t i) const
+    {
+        return first[i];
+    }
+
+private:
+    const Token *first = nullptr;
+    std::size_t count = 0;
+};
+
+/**
+ * The tokens of many lines, back to back in one array. The tokens of line i
+ * are [starts[i]:starts[i + 1]) of tokens, with offsets from the start of
+ * the line, and errors[i] is its bad token, if any, as with
+ * tokenize(line, error). Lines are independent of each other, so a batch
+ * can be shared out between threads by line.
+ */
+struct Token_batch
+{
+    std::vector<Token> tokens;
+    std::vector<std::size_t> starts{0};
+    std::vector<Token_error> errors;
+
+    std::size_t size() const
+    {
+        return errors.size();
+    }
+
+    Token_range line(std::size_t i) const
+    {
+        return {tokens.data() + starts[i], starts[i + 1] - starts[i]};
+    }
+};
+
+/**
+ * Tokenize every line of text, which are separated by '\n' the way
+ * std::getline separates them: a trailing '\n' doesn't start another
+ * (empty) line.
+ */
+Token_batch tokenize_batch(std::string_view text);
+
+/**
+ * The same for lines that have already been split.
+ */
+Token_batch tokenize_batch(const std::vector<std::string_view> &lines);
+
+/**
+ * The tokens of an expression, stored as one array per member of Token
+ * instead of one array of Tokens, so that going over, e.g., the kinds of
+ * the tokens touches nothing else. Identifiers are views into a copy of the
+ * expression rather than strings of their own.
+ *
+ * Tokens can also be read one at a time with start() and pull(), so that a
+ * reader can stop at the first it can't use without scanning the rest.
+ *
+ * assign() reuses the memory of the previous expression: a buffer kept
+ * around allocates nothing once it has held an expression as long as the
+ * next one.
+ */
+class Token_buffer
+{
+public:
+    /**
+     * Replace the tokens with those of expr, like tokenize(expr, error).
+     */
+    void assign(std::string_view expr, Token_error &error);
+
+    /**
+     * Replace the tokens with none, to be read from expr by pull().
+     */
+    void start(std::string_view expr);
+
+    /**
+     * Scan the next token of the expression given to start() and append
+     * it. Return false at the end of the expression or at a bad token,
+     * which is then reported in error.
+     */
+    bool pull(Token_error &error);
+
+    /**
+     * The number of bytes of the expression pull() hasn't scanned yet, which
+     * bounds the number of tokens still to come.
+     */
+    std::size_t unscanned() const
+    {
+        return source.size() - scanned;
+    }
+
+    /**
+     * Remove the tokens, keeping the memory.
+     */
+    void clear();
+
+    std::size_t size() const
+    {
+        return kinds.size();
+    }
+
+    bool empty() const
+    {
+        return kinds.empty();
+    }
+
+    Token_type kind(std::size_t i) const
+    {
+        return kinds[i];
+    }
+
+    char op(std::size_t i) const
+    {
+        return ops[i];
+    }
+
+    double val(std::size_t i) const
+    {
+        return numbers[i];
+    }
+
+    std::string_view name(std::size_t i) const
+    {
+        return kinds[i] == Token_type::identifier
+                   ? std::string_view{source}.substr(offsets[i], lengths[i])
+                   : std::string_view{};
+    }
+
+    std::size_t offset(std::size_t i) const
+    {
+        return offsets[i];
+    }
+
+    std::size_t length(std::size_t i) const
+    {
+        return lengths[i];
+    }
+
+    /**
+     * Token i as a Token.
+     */
+    Token token(std::size_t i) const;
+
+private:
+    std::vector<Token_type> kinds;
+    std::vector<char> ops;
+    std::vector<double> numbers;
+    std::vector<std::size_t> offsets;
+    std::vector<std::size_t> lengths;
+    std::string source;
+    // how much of source pull() has scanned
+    std::size_t scanned = 0;
+};
+
+/**
+ * Tokenizes input that arrives in chunks split anywhere, even in the middle
+ * of a token, such as reads from a socket. Each chunk is scanned as it
+ * comes and the tokens of a line are ready once its newline has been fed.
+ * Lines aren't put back together: only the bytes of a token that a chunk
+ * cuts off are kept until the next chunk.
+ */
+class Chunk_tokenizer
+{
+public:
+    /**
+     * Scan chunk, the next bytes of the input, up to and including the
+     * first newline. Return the number of bytes used; if that includes a
+     * newline, the line is done.
+     */
+    std::size_t feed(std::string_view chunk);
+
+    /**
+     * End the current line at the end of the input, which has no newline.
+     */
+    void finish();
+
+    bool line_done() const
+    {
+        return done;
+    }
+
+    /**
+     * The tokens of the current line found so far, with offsets from its
+     * start. A bad token ends them, as with tokenize().
+     */
+    const std::vector<Token> &tokens() const
+    {
+        return line_tokens;
+    }
+
+    /**
+     * The bad token of the current line, if any; the rest of the line is
+     * then skipped.
+     */
+    const Token_error &error() const
+    {
+        return bad;
+    }
+
+    /**
+     * The number of bytes of the current line fed so far, without the
+     * newline.
+     */
+    std::size_t line_size() const
+    {
+        return line_bytes;
+    }
+
+    /**
+     * Start on the next line, keeping the memory.
+     */
+    void next_line();
+
+private:
+    /**
+     * Scan piece, the next bytes of the line; last if the line ends there.
+     */
+    void scan(std::string_view piece, bool last);
+
+    /**
+     * Add the token cut off by the last chunk, continued in piece, and
+     * return how many bytes of piece it took; or keep it if it may go on
+     * beyond piece too.
+     */
+    std::size_t resume(std::string_view piece, bool last);
+
+    /**
+     * resume() for an identifier, or for a character the last chunk cut
+     * short.
+     */
+    std::size_t resume_identifier(std::string_view piece, bool last);
+
+    std::vector<Token> line_tokens;
+    Token_error bad;
+    // the bytes of a token that may continue in the next chunk, and where
+    // in the line it starts
+    std::string partial;
+    std::size_t partial_offset = 0;
+    std::size_t line_bytes = 0;
+    bool done = false;
+};
 
 #endif
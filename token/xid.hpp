@@ -0,0 +1,17 @@
+#ifndef A2100_PCALC_XID
+#define A2100_PCALC_XID 1
+#pragma once
+
+/**
+ * This library provides:
+ * - is_xid_start() and is_xid_continue(), the Unicode properties XID_Start
+ *   and XID_Continue, which say what identifiers may start and go on with
+ *
+ * Only code points from U+0080 on are covered; ASCII is up to the caller.
+ */
+
+bool is_xid_start(char32_t c);
+
+bool is_xid_continue(char32_t c);
+
+#endif